@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "async_writer.h"
+#include "utils.h"
+
+struct async_writer_s{
+  FILE *f;
+  char *name;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  unsigned char *buffer;
+  size_t size;
+  //head and tail grow monotonically, the data live at (pos % size)
+  size_t head;
+  size_t tail;
+  bool finish;
+  bool write_failed;
+  uint64_t dropped;
+  uint64_t records;
+};
+
+static void *writer(void *arg)
+{
+  async_writer_t *w = (async_writer_t *)arg;
+  pthread_mutex_lock(&w->mutex);
+  while(1){
+    while((w->head == w->tail) && !w->finish){
+      pthread_cond_wait(&w->cond, &w->mutex);
+    }
+    if(w->head == w->tail){
+      break;
+    }
+    //Write the contiguous part, the rest goes in the next round
+    size_t start = w->head % w->size;
+    size_t len = w->tail - w->head;
+    if(start + len > w->size){
+      len = w->size - start;
+    }
+    pthread_mutex_unlock(&w->mutex);
+    bool ok = w->write_failed || (fwrite(w->buffer + start, 1, len, w->f) == len);
+    pthread_mutex_lock(&w->mutex);
+    if(!ok){
+      ltr_int_log_message("Problem writing %s, dropping the rest!\n", w->name);
+      w->write_failed = true;
+    }
+    w->head += len;
+  }
+  pthread_mutex_unlock(&w->mutex);
+  return NULL;
+}
+
+static void free_writer(async_writer_t *w)
+{
+  free(w->buffer);
+  free(w->name);
+  free(w);
+}
+
+async_writer_t *ltr_int_async_writer_open(const char *fname, const char *name,
+                                          const void *hdr, size_t hdr_size, size_t buffer_size)
+{
+  async_writer_t *w = (async_writer_t *)ltr_int_my_malloc(sizeof(async_writer_t));
+  memset(w, 0, sizeof(async_writer_t));
+  w->name = ltr_int_my_strdup(name);
+  w->size = buffer_size;
+  w->f = fopen(fname, "wb");
+  if(w->f == NULL){
+    ltr_int_my_perror("fopen");
+    ltr_int_log_message("Can't open %s '%s'!\n", name, fname);
+    free_writer(w);
+    return NULL;
+  }
+  w->buffer = (unsigned char *)malloc(buffer_size);
+  if((w->buffer == NULL) || (fwrite(hdr, hdr_size, 1, w->f) != 1)){
+    ltr_int_log_message("Can't start %s!\n", name);
+    fclose(w->f);
+    free_writer(w);
+    return NULL;
+  }
+  //Fault the buffer in now rather than on the producer's thread
+  memset(w->buffer, 0, buffer_size);
+  pthread_mutex_init(&w->mutex, NULL);
+  pthread_cond_init(&w->cond, NULL);
+  if(pthread_create(&w->thread, NULL, writer, w) != 0){
+    ltr_int_log_message("Can't start %s writer!\n", name);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->mutex);
+    fclose(w->f);
+    free_writer(w);
+    return NULL;
+  }
+  return w;
+}
+
+static void put(async_writer_t *w, const void *data, size_t size)
+{
+  size_t start = w->tail % w->size;
+  size_t first = w->size - start;
+  if(first > size){
+    first = size;
+  }
+  memcpy(w->buffer + start, data, first);
+  memcpy(w->buffer, (const unsigned char *)data + first, size - first);
+  w->tail += size;
+}
+
+bool ltr_int_async_writer_put(async_writer_t *w, const void *parts[], const size_t sizes[],
+                              int count)
+{
+  size_t total = 0;
+  int i;
+  for(i = 0; i < count; ++i){
+    total += sizes[i];
+  }
+  bool res = false;
+  pthread_mutex_lock(&w->mutex);
+  if(w->size - (w->tail - w->head) < total){
+    ++w->dropped;
+  }else{
+    for(i = 0; i < count; ++i){
+      if(sizes[i] > 0){
+        put(w, parts[i], sizes[i]);
+      }
+    }
+    ++w->records;
+    pthread_cond_signal(&w->cond);
+    res = true;
+  }
+  pthread_mutex_unlock(&w->mutex);
+  return res;
+}
+
+void ltr_int_async_writer_close(async_writer_t *w)
+{
+  if(w == NULL){
+    return;
+  }
+  pthread_mutex_lock(&w->mutex);
+  w->finish = true;
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->mutex);
+  pthread_join(w->thread, NULL);
+  fclose(w->f);
+  ltr_int_log_message("Closed %s (%llu records, %llu dropped).\n", w->name,
+                      (unsigned long long)w->records, (unsigned long long)w->dropped);
+  pthread_cond_destroy(&w->cond);
+  pthread_mutex_destroy(&w->mutex);
+  free_writer(w);
+}
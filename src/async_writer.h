@@ -0,0 +1,36 @@
+#ifndef ASYNC_WRITER__H
+#define ASYNC_WRITER__H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bounded asynchronous file writer used by the USB capture and the frame
+ *   recorder.
+ *
+ * The producer only copies records into a memory buffer; a background
+ *   thread writes them out. When the buffer is full, whole records are
+ *   dropped (and counted) rather than stalling the producer.
+ */
+typedef struct async_writer_s async_writer_t;
+
+//Creates the file, writes the header and starts the writer thread;
+//  name is used in the log messages
+async_writer_t *ltr_int_async_writer_open(const char *fname, const char *name,
+                                          const void *hdr, size_t hdr_size, size_t buffer_size);
+//Queues the parts as one record, all or nothing; false when it was dropped
+bool ltr_int_async_writer_put(async_writer_t *w, const void *parts[], const size_t sizes[],
+                              int count);
+//Writes out everything queued and closes the file
+void ltr_int_async_writer_close(async_writer_t *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -16,8 +16,6 @@ struct axis_def{
   bool enabled;
   bool inverted;
   splines_def curve_defs;
-  splines curves;
-  bool valid;
   float factor;
   float l_limit, r_limit;
   float filter_factor;
@@ -33,6 +31,10 @@ struct ltr_axes {
   struct axis_def tz_axis;
   bool initialized;
   bool axes_changed_flag;
+  ltr_filter_type_t filter_type;
+  struct axes_snapshot *snapshot;
+  uint32_t readers;              //calls currently using a snapshot
+  bool have_older;               //replaced snapshots wait to be freed
   char *section;
 };
 
@@ -104,6 +106,12 @@ static const char *fields[] = {NULL, "-deadzone", "-inverted",
 				"-left-curvature", "-right-curvature", 
 				"-sensitivity", "-left-multiplier", "-right-multiplier",
 				"-limits", "-left-limit", "-right-limit", "-filter", "-enabled", NULL};
+//Tuning of the timestamp based filters; filter factor 0 means "almost no filtering"
+static const float c_EURO_CUTOFF_BASE = 0.5f; //[Hz] min cutoff at filter factor 1.0
+static const float c_EURO_BETA = 2.0f;        //cutoff increase per (limit / s) of speed
+static const float c_KALMAN_NOISE = 0.05f;    //measurement noise std per unit of nonlin. ff
+static const float c_KALMAN_ACCEL = 4.0f;     //acceleration noise, in limits / s^2
+
 static const char *axes_desc[] = {"PITCH", "ROLL", "YAW", "TX", "TY", "TZ"};
 static const char *axis_param_desc[] = {"Deadzone", "Inverted", "Left Curvature", "Right Curvature",
                    "Sensitivity", "Left Sensitivity", "Right Sensitivity", "Limit", "Left Limit", "Right Limit", 
@@ -123,6 +131,10 @@ const char *ltr_int_axis_param_get_desc(enum axis_param_t id)
   return axis_param_desc[id];
 }
 
+static void signal_change(ltr_axes_t axes);
+static void publish_snapshot(ltr_axes_t axes);
+static void free_snapshots(ltr_axes_t axes);
+
 static struct axis_def *get_axis(ltr_axes_t axes, enum axis_t id)
 {
   switch(id){
@@ -193,68 +205,210 @@ bool ltr_int_get_axes_ff(ltr_axes_t axes, double ffs[])
 }
 */
 
-float ltr_int_filter_axis(ltr_axes_t axes, enum axis_t id, float x, float *y_minus_1)
+/*
+ * Lookup tables are built from the axis definition whenever it changes
+ *   and published as an immutable snapshot; the per-frame functions
+ *   (ltr_int_val_on_axis, ltr_int_filter_axis_ts) only read the current
+ *   snapshot, so they never take axes_mutex nor evaluate the spline.
+ * Readers count themselves in axes->readers for as long as they use
+ *   a snapshot; replaced snapshots are freed only when no reader is
+ *   counted, either by the next publish or by the last reader leaving
+ *   (or on close).
+ */
+#define AXIS_LUT_SIZE 512
+
+struct axis_lut{
+  bool enabled;
+  float sign;              //-1 for inverted axis
+  float in_scale[2];       //[0] left (x < 0), [1] right; factor / limit
+  float out_scale[2];      //l_limit, r_limit (0 if the limit is 0)
+  float filter_factor;
+  float max_limit;
+  float table[2][AXIS_LUT_SIZE + 1]; //spline on <0; 1>, left and right
+};
+
+struct axes_snapshot{
+  struct axis_lut axis[MISC];
+  ltr_filter_type_t filter_type;
+  struct axes_snapshot *older; //replaced snapshots, newest first
+};
+
+static void compile_axis(struct axis_def *def, struct axis_lut *lut)
 {
-  pthread_mutex_lock(&axes_mutex);
-  struct axis_def *axis = get_axis(axes, id);
-  if(!axis->enabled){
+  splines curves;
+  int i;
+  ltr_int_curve2pts(&(def->curve_defs), &curves);
+  lut->enabled = def->enabled;
+  lut->sign = def->inverted ? -1.0f : 1.0f;
+  lut->in_scale[0] = (def->l_limit < 1e-5) ? 0.0f : def->factor / def->l_limit;
+  lut->in_scale[1] = (def->r_limit < 1e-5) ? 0.0f : def->factor / def->r_limit;
+  lut->out_scale[0] = (def->l_limit < 1e-5) ? 0.0f : def->l_limit;
+  lut->out_scale[1] = (def->r_limit < 1e-5) ? 0.0f : def->r_limit;
+  lut->filter_factor = def->filter_factor;
+  lut->max_limit = (def->l_limit > def->r_limit) ? def->l_limit : def->r_limit;
+  for(i = 0; i <= AXIS_LUT_SIZE; ++i){
+    float x = (float)i / AXIS_LUT_SIZE;
+    lut->table[0][i] = ltr_int_spline_point(&curves, -x);
+    lut->table[1][i] = ltr_int_spline_point(&curves, x);
+  }
+}
+
+static void free_snapshot_chain(struct axes_snapshot *snap)
+{
+  while(snap != NULL){
+    struct axes_snapshot *older = snap->older;
+    free(snap);
+    snap = older;
+  }
+}
+
+//Must be called with axes_mutex locked; no publish can happen meanwhile, so a
+//  reader coming after the readers check sees the current snapshot and
+//  nobody can be using the older ones
+static void free_older_snapshots(ltr_axes_t axes)
+{
+  if(__atomic_load_n(&(axes->readers), __ATOMIC_SEQ_CST) == 0){
+    free_snapshot_chain(axes->snapshot->older);
+    axes->snapshot->older = NULL;
+    __atomic_store_n(&(axes->have_older), false, __ATOMIC_RELAXED);
+  }
+}
+
+//Must be called with axes_mutex locked
+static void publish_snapshot(ltr_axes_t axes)
+{
+  struct axes_snapshot *snap = ltr_int_my_malloc(sizeof(struct axes_snapshot));
+  int i;
+  for(i = PITCH; i <= TZ; ++i){
+    compile_axis(get_axis(axes, i), &(snap->axis[i]));
+  }
+  snap->filter_type = axes->filter_type;
+  snap->older = axes->snapshot;
+  __atomic_store_n(&(axes->snapshot), snap, __ATOMIC_SEQ_CST);
+  if(snap->older != NULL){
+    __atomic_store_n(&(axes->have_older), true, __ATOMIC_RELAXED);
+    free_older_snapshots(axes);
+  }
+}
+
+static void free_snapshots(ltr_axes_t axes)
+{
+  free_snapshot_chain(axes->snapshot);
+  axes->snapshot = NULL;
+}
+
+//Each get_snapshot must be paired with put_snapshot once done with it
+static inline const struct axes_snapshot *get_snapshot(ltr_axes_t axes)
+{
+  __atomic_add_fetch(&(axes->readers), 1, __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&(axes->snapshot), __ATOMIC_SEQ_CST);
+}
+
+static inline void put_snapshot(ltr_axes_t axes)
+{
+  if((__atomic_sub_fetch(&(axes->readers), 1, __ATOMIC_SEQ_CST) == 0) &&
+     __atomic_load_n(&(axes->have_older), __ATOMIC_RELAXED) &&
+     (pthread_mutex_trylock(&axes_mutex) == 0)){
+    free_older_snapshots(axes);
     pthread_mutex_unlock(&axes_mutex);
+  }
+}
+
+/*
+ * Filters the axis value; the filter used is selected per profile
+ *   (see ltr_int_set_filter_type), strength is derived from the axis
+ *   filter factor.
+ */
+float ltr_int_filter_axis_ts(ltr_axes_t axes, enum axis_t id, float x, int64_t ts, ltr_filter_state_t *state)
+{
+  const struct axes_snapshot *snap = get_snapshot(axes);
+  const struct axis_lut *lut = &(snap->axis[id]);
+  bool enabled = lut->enabled;
+  float filter_factor = lut->filter_factor;
+  float limit = lut->max_limit;
+  ltr_filter_type_t filter_type = snap->filter_type;
+  put_snapshot(axes);
+  if(!enabled){
+    ltr_int_filter_reset(state);
     return 0.0f;
   }
-  
-  pthread_mutex_unlock(&axes_mutex);
-  float trans_koef;
-  switch(id){
-//    case TX:
-//    case TY:
-    case TZ:
-      trans_koef = 10;
+  float trans_koef = (id == TZ) ? 10.0f : 1.0f;
+  float ff = trans_koef * filter_factor * limit;
+  if(limit < 1e-5){
+    limit = 1e-5;
+  }
+  float noise;
+  switch(filter_type){
+    case LTR_FILTER_KALMAN:
+      noise = c_KALMAN_NOISE * ff;
+      return ltr_int_filter_kalman(state, x, ts, ltr_int_sqr(c_KALMAN_ACCEL * limit),
+                                   (noise * noise) + 1e-6);
+      break;
+    case LTR_FILTER_ONE_EURO:
+      return ltr_int_filter_one_euro(state, x, ts,
+                                     c_EURO_CUTOFF_BASE / (filter_factor > 0.01f ? filter_factor : 0.01f),
+                                     c_EURO_BETA / limit);
       break;
     default:
-      trans_koef = 1.0;
+      return ltr_int_filter_nonlin(state, x, ts, ff);
       break;
   }
-  float ff = trans_koef * (axis->filter_factor) * (axis->l_limit > axis->r_limit ? axis->l_limit : axis->r_limit);
-  return *y_minus_1 = ltr_int_nonlinfilt(x, *y_minus_1, ff);
 }
 
-float ltr_int_val_on_axis(ltr_axes_t axes, enum axis_t id, float x)
+void ltr_int_set_filter_type(ltr_axes_t axes, ltr_filter_type_t type)
 {
   pthread_mutex_lock(&axes_mutex);
-  struct axis_def *axis = get_axis(axes, id);
-  if(!axis->enabled){
-    pthread_mutex_unlock(&axes_mutex);
-    return 0.0f;
-  }
-  if(axis->inverted){
-    x = -x;
+  if(axes->filter_type != type){
+    axes->filter_type = type;
+    ltr_int_change_key(axes->section, "Filter-type", ltr_int_filter_type_to_str(type));
+    signal_change(axes);
   }
-  if(!(axis->valid)){
-    ltr_int_curve2pts(&(axis->curve_defs), &(axis->curves));
+  pthread_mutex_unlock(&axes_mutex);
+}
+
+ltr_filter_type_t ltr_int_get_filter_type(ltr_axes_t axes)
+{
+  pthread_mutex_lock(&axes_mutex);
+  ltr_filter_type_t res = axes->filter_type;
+  pthread_mutex_unlock(&axes_mutex);
+  return res;
+}
+
+static float val_on_lut(const struct axis_lut *lut, float x)
+{
+  if(!lut->enabled){
+    return 0.0f;
   }
-  float mf = axis->factor;
-  float lim = x < 0 ? axis->l_limit : axis->r_limit;
-  if(lim < 1e-5){
-    pthread_mutex_unlock(&axes_mutex);
-    return 0.0;
+  if(x != x){
+    return x; //NaN; let the caller detect it
   }
-  x *= mf; //apply factor (sensitivity)
-  x /= lim; //normalize to apply the spline
-  if(x < -1.0){
-    x = -1.0;
+  x *= lut->sign;
+  int side = (x < 0.0f) ? 0 : 1;
+  float pos = fabsf(x) * lut->in_scale[side]; //apply factor and normalize
+  if(pos > 1.0f){
+    pos = 1.0f;
   }
-  if(x > 1.0){
-    x = 1.0;
+  pos *= AXIS_LUT_SIZE;
+  int i = (int)pos;
+  if(i >= AXIS_LUT_SIZE){
+    i = AXIS_LUT_SIZE - 1;
   }
-  float raw = ltr_int_spline_point(&(axis->curves), x) * lim;
-//  float res = ltr_int_nonlinfilt(raw, axis->last_val, axis->filter_factor);
-  pthread_mutex_unlock(&axes_mutex);
-  return raw;
+  const float *t = lut->table[side];
+  float raw = t[i] + (pos - i) * (t[i + 1] - t[i]);
+  return raw * lut->out_scale[side];
+}
+
+float ltr_int_val_on_axis(ltr_axes_t axes, enum axis_t id, float x)
+{
+  float res = val_on_lut(&(get_snapshot(axes)->axis[id]), x);
+  put_snapshot(axes);
+  return res;
 }
 
 static void signal_change(ltr_axes_t axes)
 {
   axes->axes_changed_flag = true;
+  publish_snapshot(axes);
 }
 
 static bool save_val_flt(ltr_axes_t axes, enum axis_t id, axis_fields field, float val)
@@ -292,7 +446,6 @@ bool ltr_int_set_axis_param(ltr_axes_t axes, enum axis_t id, enum axis_param_t p
 {
   pthread_mutex_lock(&axes_mutex);
   struct axis_def *axis = get_axis(axes, id);
-  axis->valid = false;
   
   switch(param){
     case AXIS_DEADZONE:
@@ -460,7 +613,6 @@ static char *ltr_int_axis_get_key(const char *section, const char *key_name)
 static void ltr_int_init_axis(const char *sec_name, struct axis_def *axis, const char *prefix)
 {
   assert(axis != NULL);
-  axis->valid = false;
   axis->enabled = true;
   axis->inverted = false;
   axis->prefix = ltr_int_my_strdup(prefix);
@@ -492,7 +644,6 @@ static void ltr_int_close_axis(ltr_axes_t axes, enum axis_t id)
 static void set_axis_field(struct axis_def *axis, axis_fields field, float val, enum axis_t id)
 {
   assert(axis != NULL);
-  axis->valid = false;
   switch(field){
     case(DEADZONE):
       axis->curve_defs.dead_zone = val;
@@ -640,9 +791,11 @@ void ltr_int_init_axes(ltr_axes_t *axes, const char *profile)
     ltr_int_close_axes(axes);
   }
   *axes = ltr_int_my_malloc(sizeof(struct ltr_axes));
+  memset(*axes, 0, sizeof(struct ltr_axes));
   pthread_mutex_lock(&axes_mutex);
   bool res = true;
   (*axes)->axes_changed_flag = false;
+  (*axes)->filter_type = LTR_FILTER_NONLINEAR;
   
   char *sec_name = ltr_int_prepare_section(profile);
   if(sec_name != NULL){
@@ -653,10 +806,14 @@ void ltr_int_init_axes(ltr_axes_t *axes, const char *profile)
     res &= ltr_int_get_axis(sec_name, TX, &((*axes)->tx_axis));
     res &= ltr_int_get_axis(sec_name, TY, &((*axes)->ty_axis));
     res &= ltr_int_get_axis(sec_name, TZ, &((*axes)->tz_axis));
+    char *filter = ltr_int_get_key(sec_name, "Filter-type");
+    (*axes)->filter_type = ltr_int_filter_type_from_str(filter);
+    free(filter);
     (*axes)->initialized = res;
     //now the section should exist anyway...
     (*axes)->section = sec_name;
   }
+  publish_snapshot(*axes);
   pthread_mutex_unlock(&axes_mutex);
 }
 
@@ -677,6 +834,7 @@ void ltr_int_close_axes(ltr_axes_t *axes)
   ltr_int_close_axis(*axes, TX);
   ltr_int_close_axis(*axes, TY);
   ltr_int_close_axis(*axes, TZ);
+  free_snapshots(*axes);
   free((*axes)->section);
   free(*axes);
   *axes = NULL;
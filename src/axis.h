@@ -6,6 +6,8 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stdint.h>
+#include "pose_filter.h"
 
 struct ltr_axes;
 typedef struct ltr_axes *ltr_axes_t;
@@ -19,12 +21,14 @@ enum axis_param_t {AXIS_ENABLED, AXIS_DEADZONE,
                    AXIS_LLIMIT, AXIS_RLIMIT,
                    AXIS_FILTER,
                    AXIS_INVERTED,
-                   AXIS_FULL, MISC_LEGR, MISC_ALTER, MISC_ALIGN, MISC_FOCAL_LENGTH, AXIS_DEFAULT = 1024};
+                   AXIS_FULL, MISC_LEGR, MISC_ALTER, MISC_ALIGN, MISC_FOCAL_LENGTH, MISC_FILTER_TYPE, AXIS_DEFAULT = 1024};
 
 void ltr_int_init_axes(ltr_axes_t *axes, const char *profile);
 void ltr_int_close_axes(ltr_axes_t *axes);
 float ltr_int_val_on_axis(ltr_axes_t axes, enum axis_t id, float x);
-float ltr_int_filter_axis(ltr_axes_t axes, enum axis_t id, float x, float *y_minus_1);
+float ltr_int_filter_axis_ts(ltr_axes_t axes, enum axis_t id, float x, int64_t ts, ltr_filter_state_t *state);
+void ltr_int_set_filter_type(ltr_axes_t axes, ltr_filter_type_t type);
+ltr_filter_type_t ltr_int_get_filter_type(ltr_axes_t axes);
 
 bool ltr_int_is_symetrical(ltr_axes_t axes, enum axis_t id);
 
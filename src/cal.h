@@ -40,7 +40,8 @@ struct frame_type {
   unsigned int width;
   unsigned int height;
   unsigned int counter;
-  int usec; /* save a precise timestamp at frame capture time for later pose extrapolation */
+  int64_t ts_ns; /* capture time (ltr_int_get_ts_ns) for later pose extrapolation;
+                    drivers may fill it in, otherwise the runloop does */
   unsigned char *bitmap; /* 8bits per pixel, monochrome 0x00 or 0xff */
 };
 
@@ -55,7 +56,8 @@ typedef enum cal_device_category_type {
   mac_webcam_ft,
   joystick,
   mac_ps3eye,
-  mac_ps3eye_ft
+  mac_ps3eye_ft,
+  frame_replay
 } cal_device_category_type;
 
 struct cal_device_type {
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <sys/file.h>
 #include <string.h>
@@ -9,9 +10,19 @@
 #include <cal.h>
 #include <utils.h>
 #include <ipc_utils.h>
+#include <pose_ring.h>
 
+/*
+ * One process (wii_server, the mac camera helper) produces the blobs,
+ *   the driver consumes them; no locks are taken on either side.
+ * Scalars are read and written atomically (the command with release/acquire
+ *   semantics). The blobs are guarded by blob_seq, a seqlock: the writer
+ *   never waits, the reader retries when it raced a write. The reader
+ *   stores the counter of the last report it took in read_counter; a report
+ *   overwritten before that happened is counted in missed.
+ */
 typedef struct{
-  command_t        command;
+  uint32_t         command;
   int              threshold;
   int              min_blob;
   int              max_blob;
@@ -19,81 +30,75 @@ typedef struct{
   int              opt_level;
   int              wii_indication;
   bool             frame_filled;
-  int              frame_counter;
+  uint32_t         blob_seq;
+  uint32_t         frame_counter;
+  uint32_t         read_counter;
+  uint32_t         missed;
   int              num_blobs;
   struct blob_type blobs[MAX_BLOBS];
   unsigned char    frame;
 } comm_struct;
 
-//static off_t size = -1;
+//Attempts to get a consistent copy of the blobs before giving up for now
+#define BLOB_READ_RETRIES 16
+
+static int get_int(int *var)
+{
+  return __atomic_load_n(var, __ATOMIC_RELAXED);
+}
+
+static void set_int(int *var, int val)
+{
+  __atomic_store_n(var, val, __ATOMIC_RELAXED);
+}
 
 
 command_t ltr_int_getCommand(struct mmap_s *mmm)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  ltr_int_lockSemaphore(mmm->sem);
-  command_t tmp = cs->command;
-  ltr_int_unlockSemaphore(mmm->sem);
-  return tmp;
+  return (command_t)__atomic_load_n(&(cs->command), __ATOMIC_ACQUIRE);
 }
 
 void ltr_int_setCommand(struct mmap_s *mmm, command_t cmd)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  ltr_int_lockSemaphore(mmm->sem);
-  cs->command = cmd;
-  ltr_int_unlockSemaphore(mmm->sem);
+  __atomic_store_n(&(cs->command), (uint32_t)cmd, __ATOMIC_RELEASE);
 }
 
 int ltr_int_getThreshold(struct mmap_s *mmm)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  ltr_int_lockSemaphore(mmm->sem);
-  int tmp = cs->threshold;
-  ltr_int_unlockSemaphore(mmm->sem);
-  return tmp;
+  return get_int(&(cs->threshold));
 }
 
 void ltr_int_setThreshold(struct mmap_s *mmm, int thr)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  ltr_int_lockSemaphore(mmm->sem);
-  cs->threshold = thr;
-  ltr_int_unlockSemaphore(mmm->sem);
+  set_int(&(cs->threshold), thr);
 }
 
 int ltr_int_getMinBlob(struct mmap_s *mmm)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  ltr_int_lockSemaphore(mmm->sem);
-  int tmp = cs->min_blob;
-  ltr_int_unlockSemaphore(mmm->sem);
-  return tmp;
+  return get_int(&(cs->min_blob));
 }
 
 void ltr_int_setMinBlob(struct mmap_s *mmm, int pix)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  ltr_int_lockSemaphore(mmm->sem);
-  cs->min_blob = pix;
-  ltr_int_unlockSemaphore(mmm->sem);
+  set_int(&(cs->min_blob), pix);
 }
 
 int ltr_int_getMaxBlob(struct mmap_s *mmm)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  ltr_int_lockSemaphore(mmm->sem);
-  int tmp = cs->max_blob;
-  ltr_int_unlockSemaphore(mmm->sem);
-  return tmp;
+  return get_int(&(cs->max_blob));
 }
 
 void ltr_int_setMaxBlob(struct mmap_s *mmm, int pix)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  ltr_int_lockSemaphore(mmm->sem);
-  cs->max_blob = pix;
-  ltr_int_unlockSemaphore(mmm->sem);
+  set_int(&(cs->max_blob), pix);
 }
 
 
@@ -117,43 +122,68 @@ void ltr_int_setBlobs(struct mmap_s *mmm, struct blob_type *b, int num_blobs)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
   int i;
-  ltr_int_lockSemaphore(mmm->sem);
   int blobs = (num_blobs < MAX_BLOBS) ? num_blobs : MAX_BLOBS;
+  uint32_t counter = __atomic_load_n(&(cs->frame_counter), __ATOMIC_RELAXED);
+  if(__atomic_load_n(&(cs->read_counter), __ATOMIC_RELAXED) != counter){
+    //The previous report wasn't taken yet
+    __atomic_store_n(&(cs->missed), __atomic_load_n(&(cs->missed), __ATOMIC_RELAXED) + 1,
+                     __ATOMIC_RELAXED);
+  }
+  ltr_int_seqlock_write_begin(&(cs->blob_seq));
   for(i = 0; i < blobs; ++i){
     (cs->blobs[i]).x = b[i].x;
     (cs->blobs[i]).y = b[i].y;
     (cs->blobs[i]).score = b[i].score;
   }
   cs->num_blobs = blobs;
-  ++(cs->frame_counter);
-  ltr_int_unlockSemaphore(mmm->sem);
+  __atomic_store_n(&(cs->frame_counter), counter + 1, __ATOMIC_RELAXED);
+  ltr_int_seqlock_write_end(&(cs->blob_seq));
 }
 
-static int last_val = 0;
+static uint32_t last_val = 0;
 bool ltr_int_haveNewBlobs(struct mmap_s *mmm)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  if(cs->frame_counter != last_val){
-    last_val = cs->frame_counter;
-    return true;
-  }
-  return false;
+  return __atomic_load_n(&(cs->frame_counter), __ATOMIC_ACQUIRE) != last_val;
 }
 
+//Returns the number of blobs of the newest report, -1 if it couldn't be read
+//  consistently (the producer kept overwriting it)
 int ltr_int_getBlobs(struct mmap_s *mmm, struct blob_type *b, int num_blobs)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  int i;
-  ltr_int_lockSemaphore(mmm->sem);
-  int blobs = (cs->num_blobs > num_blobs) ? num_blobs : cs->num_blobs;
-  for(i = 0; i < blobs; ++i){
-    b[i].x = (cs->blobs[i]).x;
-    b[i].y = (cs->blobs[i]).y;
-    b[i].score = (cs->blobs[i]).score;
+  struct blob_type tmp[MAX_BLOBS];
+  int i, retries;
+  for(retries = 0; retries < BLOB_READ_RETRIES; ++retries){
+    uint32_t start;
+    if(!ltr_int_seqlock_read_begin(&(cs->blob_seq), &start)){
+      continue;
+    }
+    int total = cs->num_blobs;
+    uint32_t counter = cs->frame_counter;
+    if((total < 0) || (total > MAX_BLOBS)){
+      continue;
+    }
+    memcpy(tmp, cs->blobs, total * sizeof(struct blob_type));
+    if(!ltr_int_seqlock_read_end(&(cs->blob_seq), start)){
+      continue;
+    }
+    int blobs = (total > num_blobs) ? num_blobs : total;
+    for(i = 0; i < blobs; ++i){
+      b[i] = tmp[i];
+    }
+    last_val = counter;
+    __atomic_store_n(&(cs->read_counter), counter, __ATOMIC_RELAXED);
+    return total;
   }
-  last_val = cs->frame_counter;
-  ltr_int_unlockSemaphore(mmm->sem);
-  return cs->num_blobs;
+  return -1;
+}
+
+//Reports overwritten by the producer before the consumer took them
+uint32_t ltr_int_getMissedBlobs(struct mmap_s *mmm)
+{
+  comm_struct *cs = (comm_struct*)mmm->data;
+  return __atomic_load_n(&(cs->missed), __ATOMIC_RELAXED);
 }
 
 unsigned char* ltr_int_getFramePtr(struct mmap_s *mmm)
@@ -162,39 +192,35 @@ unsigned char* ltr_int_getFramePtr(struct mmap_s *mmm)
   return &(cs->frame);
 }
 
+//The flag hands the frame over; acquire/release keep the bitmap in order with it
 bool ltr_int_getFrameFlag(struct mmap_s *mmm)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  return cs->frame_filled;
+  return __atomic_load_n(&(cs->frame_filled), __ATOMIC_ACQUIRE);
 }
 
 void ltr_int_setFrameFlag(struct mmap_s *mmm)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  cs->frame_filled = true;
+  __atomic_store_n(&(cs->frame_filled), true, __ATOMIC_RELEASE);
 }
 
 void ltr_int_resetFrameFlag(struct mmap_s *mmm)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  cs->frame_filled = false;
+  __atomic_store_n(&(cs->frame_filled), false, __ATOMIC_RELEASE);
 }
 
 void ltr_int_setWiiIndication(struct mmap_s *mmm, int new_ind)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  ltr_int_lockSemaphore(mmm->sem);
-  cs->wii_indication = new_ind;
-  ltr_int_unlockSemaphore(mmm->sem);
+  set_int(&(cs->wii_indication), new_ind);
 }
 
 int ltr_int_getWiiIndication(struct mmap_s *mmm)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  ltr_int_lockSemaphore(mmm->sem);
-  int res = cs->wii_indication;
-  ltr_int_unlockSemaphore(mmm->sem);
-  return res;
+  return get_int(&(cs->wii_indication));
 }
 
 int ltr_int_get_com_size()
@@ -205,34 +231,26 @@ int ltr_int_get_com_size()
 int ltr_int_getOptLevel(struct mmap_s *mmm)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  ltr_int_lockSemaphore(mmm->sem);
-  int res = cs->opt_level;
-  ltr_int_unlockSemaphore(mmm->sem);
-  return res;
+  return get_int(&(cs->opt_level));
 }
 
 void ltr_int_setOptLevel(struct mmap_s *mmm, int new_opt)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  ltr_int_lockSemaphore(mmm->sem);
-  cs->opt_level = new_opt;
-  ltr_int_unlockSemaphore(mmm->sem);
+  set_int(&(cs->opt_level), new_opt);
 }
 
 float ltr_int_getEff(struct mmap_s *mmm)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  ltr_int_lockSemaphore(mmm->sem);
-  float res = cs->exp_filt_factor;
-  ltr_int_unlockSemaphore(mmm->sem);
+  float res;
+  __atomic_load(&(cs->exp_filt_factor), &res, __ATOMIC_RELAXED);
   return res;
 }
 
 void ltr_int_setEff(struct mmap_s *mmm, float new_eff)
 {
   comm_struct *cs = (comm_struct*)mmm->data;
-  ltr_int_lockSemaphore(mmm->sem);
-  cs->exp_filt_factor = new_eff;
-  ltr_int_unlockSemaphore(mmm->sem);
+  __atomic_store(&(cs->exp_filt_factor), &new_eff, __ATOMIC_RELAXED);
 }
 
@@ -6,6 +6,7 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <ipc_utils.h>
 
 typedef enum {STOP, SLEEP, WAKEUP} command_t;
@@ -28,6 +29,7 @@ void ltr_int_setMaxBlob(struct mmap_s *mmm, int pix);
 void ltr_int_setBlobs(struct mmap_s *mmm, struct blob_type *b, int num_blobs);
 bool ltr_int_haveNewBlobs(struct mmap_s *mmm);
 int ltr_int_getBlobs(struct mmap_s *mmm, struct blob_type * b, int num_blobs);
+uint32_t ltr_int_getMissedBlobs(struct mmap_s *mmm);
 unsigned char* ltr_int_getFramePtr(struct mmap_s *mmm);
 bool ltr_int_getFrameFlag(struct mmap_s *mmm);
 void ltr_int_setFrameFlag(struct mmap_s *mmm);
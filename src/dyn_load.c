@@ -33,6 +33,24 @@ void *ltr_int_load_library(char *lib_name, lib_fun_def_t *func_defs)
   return libhandle;
 }
 
+//Functions the library may or may not provide; the missing ones stay NULL
+void ltr_int_load_optional(void *libhandle, lib_fun_def_t *func_defs)
+{
+  while(func_defs->name != NULL){
+    *(void **) (func_defs->ref) = dlsym(libhandle, func_defs->name);
+    ++func_defs;
+  }
+  dlerror();
+}
+
+void ltr_int_unload_optional(lib_fun_def_t *func_defs)
+{
+  while(func_defs->name != NULL){
+    *(void **)(func_defs->ref) = NULL;
+    ++func_defs;
+  }
+}
+
 int ltr_int_unload_library(void *libhandle, lib_fun_def_t *func_defs)
 {
   while(func_defs->name != NULL){
@@ -11,6 +11,8 @@ typedef struct{
 } lib_fun_def_t;
 
 void *ltr_int_load_library(char *lib_name, lib_fun_def_t *func_defs);
+void ltr_int_load_optional(void *libhandle, lib_fun_def_t *func_defs);
+void ltr_int_unload_optional(lib_fun_def_t *func_defs);
 int ltr_int_unload_library(void *libhandle, lib_fun_def_t *func_defs);
 
 
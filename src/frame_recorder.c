@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <string.h>
+#include "frame_recorder.h"
+#include "async_writer.h"
+#include "utils.h"
+
+#define RECORD_BUFFER_SIZE (8 * 1024 * 1024)
+
+static async_writer_t *recording = NULL;
+static unsigned int bitmap_every = 1;
+static uint64_t frames_seen = 0;
+
+bool ltr_int_frame_rec_open(const char *fname, unsigned int every)
+{
+  if(recording != NULL){
+    ltr_int_frame_rec_close();
+  }
+  frame_rec_hdr_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  strncpy(hdr.magic, FRAME_REC_MAGIC, sizeof(hdr.magic));
+  hdr.version = FRAME_REC_VERSION;
+  hdr.start_ns = ltr_int_get_ts_ns();
+  bitmap_every = every;
+  frames_seen = 0;
+  recording = ltr_int_async_writer_open(fname, "frame recording", &hdr, sizeof(hdr),
+                                        RECORD_BUFFER_SIZE);
+  if(recording == NULL){
+    return false;
+  }
+  ltr_int_log_message("Recording frames to '%s' (bitmap of every %u. frame).\n", fname, every);
+  return true;
+}
+
+bool ltr_int_frame_rec_open_env(void)
+{
+  const char *fname = getenv("LINUXTRACK_FRAME_RECORD");
+  if((fname == NULL) || (fname[0] == '\0')){
+    return false;
+  }
+  const char *every = getenv("LINUXTRACK_FRAME_RECORD_BITMAPS");
+  return ltr_int_frame_rec_open(fname, (every != NULL) ? (unsigned int)atoi(every) : 1);
+}
+
+bool ltr_int_frame_rec_active(void)
+{
+  return recording != NULL;
+}
+
+bool ltr_int_frame_rec_wants_bitmap(void)
+{
+  return (recording != NULL) && (bitmap_every > 0);
+}
+
+void ltr_int_frame_rec_add(const struct frame_type *frame)
+{
+  if(recording == NULL){
+    return;
+  }
+  frame_rec_t rec = {.ts_ns = frame->ts_ns, .counter = frame->counter, .width = frame->width,
+                     .height = frame->height, .num_blobs = frame->bloblist.num_blobs,
+                     .bitmap_size = 0, .reserved = 0};
+  if(rec.num_blobs > MAX_BLOBS){
+    rec.num_blobs = MAX_BLOBS;
+  }
+  if((frame->bitmap != NULL) && (bitmap_every > 0) && (frames_seen % bitmap_every == 0)){
+    rec.bitmap_size = frame->width * frame->height;
+  }
+  ++frames_seen;
+  frame_rec_blob_t blobs[MAX_BLOBS];
+  unsigned int i;
+  for(i = 0; i < rec.num_blobs; ++i){
+    blobs[i].x = frame->bloblist.blobs[i].x;
+    blobs[i].y = frame->bloblist.blobs[i].y;
+    blobs[i].score = frame->bloblist.blobs[i].score;
+  }
+  const void *parts[] = {&rec, blobs, frame->bitmap};
+  size_t sizes[] = {sizeof(rec), rec.num_blobs * sizeof(frame_rec_blob_t), rec.bitmap_size};
+  ltr_int_async_writer_put(recording, parts, sizes, 3);
+}
+
+void ltr_int_frame_rec_close(void)
+{
+  ltr_int_async_writer_close(recording);
+  recording = NULL;
+}
+
+bool ltr_int_frame_rec_read_hdr(FILE *f, frame_rec_hdr_t *hdr)
+{
+  if((fread(hdr, sizeof(*hdr), 1, f) != 1) ||
+     (strncmp(hdr->magic, FRAME_REC_MAGIC, sizeof(hdr->magic)) != 0)){
+    ltr_int_log_message("Not a frame recording!\n");
+    return false;
+  }
+  if(hdr->version != FRAME_REC_VERSION){
+    ltr_int_log_message("Unsupported frame recording version %d!\n", hdr->version);
+    return false;
+  }
+  return true;
+}
+
+//Reads the next frame; a recorded bitmap is skipped when there is no room for it
+bool ltr_int_frame_rec_read(FILE *f, frame_rec_t *rec, struct blob_type blobs[],
+                            unsigned char *bitmap, size_t bitmap_size)
+{
+  if(fread(rec, sizeof(*rec), 1, f) != 1){
+    return false;
+  }
+  if(rec->num_blobs > MAX_BLOBS){
+    ltr_int_log_message("Too many blobs in the frame recording (%d)!\n", rec->num_blobs);
+    return false;
+  }
+  frame_rec_blob_t rb[MAX_BLOBS];
+  if(fread(rb, sizeof(frame_rec_blob_t), rec->num_blobs, f) != rec->num_blobs){
+    return false;
+  }
+  unsigned int i;
+  for(i = 0; i < rec->num_blobs; ++i){
+    blobs[i].x = rb[i].x;
+    blobs[i].y = rb[i].y;
+    blobs[i].score = rb[i].score;
+  }
+  if(rec->bitmap_size == 0){
+    return true;
+  }
+  if((bitmap == NULL) || (rec->bitmap_size > bitmap_size)){
+    long skip = rec->bitmap_size;
+    rec->bitmap_size = 0;
+    return fseek(f, skip, SEEK_CUR) == 0;
+  }
+  return fread(bitmap, 1, rec->bitmap_size, f) == rec->bitmap_size;
+}
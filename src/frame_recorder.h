@@ -0,0 +1,70 @@
+#ifndef FRAME_RECORDER__H
+#define FRAME_RECORDER__H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "cal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Recording of the frames coming from a driver, for offline replay.
+ *
+ * The file starts with frame_rec_hdr_t, records follow back to back:
+ *   frame_rec_t, num_blobs times frame_rec_blob_t and bitmap_size bytes
+ *   of bitmap. Everything is in host byte order. Blobs are recorded for
+ *   every frame, the bitmap only for every n-th one (or never).
+ * The capture thread only copies the frame into a bounded buffer; a
+ *   background thread writes it out. When the buffer is full, whole
+ *   frames are dropped (and counted) rather than stalling the driver.
+ */
+#define FRAME_REC_MAGIC "LTRFRMR"
+#define FRAME_REC_VERSION 1
+
+typedef struct{
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  int64_t start_ns;    //ltr_int_get_ts_ns() when the recording started
+} frame_rec_hdr_t;
+
+typedef struct{
+  int64_t ts_ns;       //capture time of the frame
+  uint32_t counter;
+  uint32_t width;
+  uint32_t height;
+  uint32_t num_blobs;
+  uint32_t bitmap_size; //0 or width * height
+  uint32_t reserved;
+} frame_rec_t;
+
+typedef struct{
+  float x, y;
+  uint32_t score;
+} frame_rec_blob_t;
+
+//Recording side; bitmap_every = 0 records blobs only
+bool ltr_int_frame_rec_open(const char *fname, unsigned int bitmap_every);
+//Opens the recording when LINUXTRACK_FRAME_RECORD names a file
+//  (LINUXTRACK_FRAME_RECORD_BITMAPS sets bitmap_every, 1 by default)
+bool ltr_int_frame_rec_open_env(void);
+bool ltr_int_frame_rec_active(void);
+//True when the recorded frames need the driver to draw the bitmap
+bool ltr_int_frame_rec_wants_bitmap(void);
+void ltr_int_frame_rec_add(const struct frame_type *frame);
+void ltr_int_frame_rec_close(void);
+
+//Reading side; blobs must have room for MAX_BLOBS, the bitmap for bitmap_size bytes
+bool ltr_int_frame_rec_read_hdr(FILE *f, frame_rec_hdr_t *hdr);
+bool ltr_int_frame_rec_read(FILE *f, frame_rec_t *rec, struct blob_type blobs[],
+                            unsigned char *bitmap, size_t bitmap_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,217 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "frame_ring.h"
+#include "pose_ring.h"
+#include "utils.h"
+
+char *ltr_int_frame_ring_name(void)
+{
+  return ltr_int_get_default_file_name("frame_ring.dat");
+}
+
+static uint8_t *slot_data(struct ltr_frame_ring *ring, uint32_t slot)
+{
+  return (uint8_t *)ring + FRAME_RING_DATA_OFFSET + (size_t)slot * ring->slot_size;
+}
+
+static void no_request(ltr_frame_req_t *req);
+
+//Producer owns the slot while its seq is odd
+static void take_slot(struct ltr_frame_ring *ring, uint32_t slot)
+{
+  if((__atomic_load_n(&(ring->slot[slot].seq), __ATOMIC_RELAXED) & 1) == 0){
+    ltr_int_seqlock_write_begin(&(ring->slot[slot].seq));
+  }
+}
+
+/*
+ * (Re)creates the ring so that each slot can hold frame_size bytes; slots
+ *   only grow. All slots are owned by the producer afterwards.
+ * Readers notice a new ring by the size growing past their mapping or by
+ *   the old one going stale.
+ */
+bool ltr_int_frame_ring_setup(struct mmap_s *m, uint32_t frame_size)
+{
+  struct ltr_frame_ring *ring = (struct ltr_frame_ring *)m->data;
+  uint32_t i;
+  if((ring != NULL) && (ring->slot_size >= frame_size)){
+    return true;
+  }
+  size_t size = FRAME_RING_DATA_OFFSET + (size_t)FRAME_RING_SLOTS * frame_size;
+  int64_t reader_ts = 0;
+  if(ring != NULL){
+    //Invalidate whatever readers are looking at and make them remap
+    for(i = 0; i < FRAME_RING_SLOTS; ++i){
+      take_slot(ring, i);
+    }
+    reader_ts = ring->reader_ts;
+    __atomic_store_n(&(ring->size), size, __ATOMIC_RELEASE);
+    ltr_int_unmap_file(m);
+  }
+  //Always start a fresh file, so that mappings of the old one stay valid
+  char *fname = ltr_int_frame_ring_name();
+  unlink(fname);
+  bool res = ltr_int_mmap_file(fname, size, m);
+  free(fname);
+  if(!res){
+    m->data = NULL;
+    return false;
+  }
+  ring = (struct ltr_frame_ring *)m->data;
+  memset(ring, 0, sizeof(struct ltr_frame_ring));
+  no_request(&(ring->req));
+  ring->version = FRAME_RING_VERSION;
+  ring->slot_size = frame_size;
+  ring->reader_ts = reader_ts;
+  for(i = 0; i < FRAME_RING_SLOTS; ++i){
+    take_slot(ring, i);
+  }
+  __atomic_store_n(&(ring->size), size, __ATOMIC_RELEASE);
+  __atomic_store_n(&(ring->magic), FRAME_RING_MAGIC, __ATOMIC_RELEASE);
+  return true;
+}
+
+//Returns the bitmap of the slot, the slot is owned by the producer till commit
+uint8_t *ltr_int_frame_ring_acquire(struct ltr_frame_ring *ring, uint32_t slot)
+{
+  take_slot(ring, slot);
+  return slot_data(ring, slot);
+}
+
+void ltr_int_frame_ring_commit(struct ltr_frame_ring *ring, uint32_t slot, const ltr_frame_hdr_t *hdr)
+{
+  ltr_frame_hdr_t *dst = &(ring->slot[slot]);
+  dst->counter = hdr->counter;
+  dst->width = hdr->width;
+  dst->height = hdr->height;
+  dst->x = hdr->x;
+  dst->y = hdr->y;
+  dst->scale = hdr->scale;
+  dst->ts_ns = hdr->ts_ns;
+  ltr_int_seqlock_write_end(&(dst->seq));
+  __atomic_store_n(&(ring->latest), slot, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&(ring->published), 1, __ATOMIC_RELEASE);
+}
+
+bool ltr_int_frame_ring_readers_active(const struct ltr_frame_ring *ring, int64_t now,
+                                       int64_t idle_ns)
+{
+  return (now - __atomic_load_n(&(ring->reader_ts), __ATOMIC_RELAXED)) < idle_ns;
+}
+
+/*
+ * Zero-copy view of the newest frame; the data may be used in place, but
+ *   only count if ltr_int_frame_ring_view_valid says so afterwards.
+ *   mapped is the size of the caller's mapping.
+ */
+bool ltr_int_frame_ring_view(const struct ltr_frame_ring *ring, size_t mapped,
+                             ltr_frame_view_t *view)
+{
+  if((mapped < sizeof(struct ltr_frame_ring)) ||
+     (__atomic_load_n(&(ring->magic), __ATOMIC_ACQUIRE) != FRAME_RING_MAGIC) ||
+     (__atomic_load_n(&(ring->published), __ATOMIC_ACQUIRE) == 0)){
+    return false;
+  }
+  uint32_t slot = __atomic_load_n(&(ring->latest), __ATOMIC_ACQUIRE);
+  if(slot >= FRAME_RING_SLOTS){
+    return false;
+  }
+  const ltr_frame_hdr_t *hdr = &(ring->slot[slot]);
+  uint32_t start;
+  if(!ltr_int_seqlock_read_begin(&(hdr->seq), &start)){
+    return false;
+  }
+  view->slot = slot;
+  view->seq = start;
+  view->width = hdr->width;
+  view->height = hdr->height;
+  view->counter = hdr->counter;
+  view->x = hdr->x;
+  view->y = hdr->y;
+  view->scale = hdr->scale;
+  view->ts_ns = hdr->ts_ns;
+  size_t slot_size = ring->slot_size;
+  size_t end = FRAME_RING_DATA_OFFSET + (slot + 1) * slot_size;
+  if(((size_t)view->width * view->height > slot_size) || (end > mapped)){
+    return false;
+  }
+  view->data = (const uint8_t *)ring + FRAME_RING_DATA_OFFSET + slot * slot_size;
+  return ltr_int_seqlock_read_end(&(hdr->seq), start);
+}
+
+bool ltr_int_frame_ring_view_valid(const struct ltr_frame_ring *ring, const ltr_frame_view_t *view)
+{
+  return ltr_int_seqlock_read_end(&(ring->slot[view->slot].seq), view->seq);
+}
+
+void ltr_int_frame_ring_touch(struct ltr_frame_ring *ring, int64_t now)
+{
+  __atomic_store_n(&(ring->reader_ts), now, __ATOMIC_RELAXED);
+}
+
+static void no_request(ltr_frame_req_t *req)
+{
+  req->scale = UINT32_MAX;
+  req->margin = 0;
+  req->period_us = UINT32_MAX;
+}
+
+//Keeps whatever is needed to satisfy both requests
+void ltr_int_frame_req_merge(ltr_frame_req_t *into, const ltr_frame_req_t *req)
+{
+  if(req->scale < into->scale){
+    into->scale = req->scale;
+  }
+  if(req->margin > into->margin){
+    into->margin = req->margin;
+  }
+  if(req->period_us < into->period_us){
+    into->period_us = req->period_us;
+  }
+}
+
+static void atomic_min(uint32_t *val, uint32_t x)
+{
+  uint32_t old = __atomic_load_n(val, __ATOMIC_RELAXED);
+  while((x < old) &&
+        !__atomic_compare_exchange_n(val, &old, x, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void atomic_max(uint32_t *val, uint32_t x)
+{
+  uint32_t old = __atomic_load_n(val, __ATOMIC_RELAXED);
+  while((x > old) &&
+        !__atomic_compare_exchange_n(val, &old, x, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void ltr_int_frame_ring_request(struct ltr_frame_ring *ring, const ltr_frame_req_t *req)
+{
+  atomic_min(&(ring->req.period_us), req->period_us);
+  atomic_max(&(ring->req.margin), req->margin);
+  //scale last, it marks the request as present
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  atomic_min(&(ring->req.scale), (req->scale > 0) ? req->scale : 1);
+}
+
+/*
+ * Producer side: the merged request of the readers; with reset, the next
+ *   collection only sees requests made after this one.
+ *   Returns false if nobody asked; req then holds a request that changes
+ *   nothing when merged.
+ */
+bool ltr_int_frame_ring_collect(struct ltr_frame_ring *ring, bool reset, ltr_frame_req_t *req)
+{
+  ltr_frame_req_t none;
+  no_request(&none);
+  if(reset){
+    req->scale = __atomic_exchange_n(&(ring->req.scale), none.scale, __ATOMIC_ACQUIRE);
+    req->margin = __atomic_exchange_n(&(ring->req.margin), none.margin, __ATOMIC_RELAXED);
+    req->period_us = __atomic_exchange_n(&(ring->req.period_us), none.period_us, __ATOMIC_RELAXED);
+  }else{
+    req->scale = __atomic_load_n(&(ring->req.scale), __ATOMIC_ACQUIRE);
+    req->margin = __atomic_load_n(&(ring->req.margin), __ATOMIC_RELAXED);
+    req->period_us = __atomic_load_n(&(ring->req.period_us), __ATOMIC_RELAXED);
+  }
+  return req->scale != UINT32_MAX;
+}
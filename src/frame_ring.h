@@ -0,0 +1,98 @@
+#ifndef FRAME_RING__H
+#define FRAME_RING__H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "ipc_utils.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Preview frames shared by the master (single producer) with the clients.
+ *
+ * The file starts with struct ltr_frame_ring, the bitmaps (slot_size bytes
+ *   each) follow at FRAME_RING_DATA_OFFSET. Each slot has its own header
+ *   guarded by a seqlock (odd while the producer owns the slot), so readers
+ *   can use the bitmap in place and check afterwards that it wasn't
+ *   overwritten meanwhile.
+ * Readers stamp reader_ts; when nobody did so for a while, the producer
+ *   doesn't publish at all.
+ * Readers also merge the preview they want into req (the least reduced
+ *   request wins); the producer collects and resets it periodically and
+ *   renders only that variant.
+ */
+#define FRAME_RING_MAGIC 0x4C544652 //"LTFR"
+#define FRAME_RING_VERSION 1
+#define FRAME_RING_SLOTS 3
+#define FRAME_RING_DATA_OFFSET 256
+#define FRAME_RING_NO_CROP UINT32_MAX
+
+typedef struct{
+  uint32_t seq;
+  uint32_t counter;
+  uint32_t width;
+  uint32_t height;
+  uint32_t x;          //origin of the (cropped) frame in the full frame
+  uint32_t y;
+  uint32_t scale;      //downsampling factor the frame was rendered with
+  int64_t ts_ns __attribute__((aligned(8)));
+} ltr_frame_hdr_t;
+
+typedef struct{
+  uint32_t scale;      //downsampling factor, 1 = full resolution
+  uint32_t margin;     //pixels kept around the blobs, FRAME_RING_NO_CROP for all
+  uint32_t period_us;  //minimal spacing of published frames, 0 = every frame
+} ltr_frame_req_t;
+
+struct ltr_frame_ring{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;       //size of the whole file
+  uint32_t slot_size;  //bytes reserved for each bitmap
+  uint32_t latest;     //slot holding the newest frame
+  uint32_t published;  //frames published so far
+  int64_t reader_ts __attribute__((aligned(8)));
+  ltr_frame_req_t req; //scale == UINT32_MAX when nobody asked since the last collection
+  ltr_frame_hdr_t slot[FRAME_RING_SLOTS];
+};
+
+typedef struct{
+  const uint8_t *data;
+  uint32_t width;
+  uint32_t height;
+  uint32_t counter;
+  uint32_t x;
+  uint32_t y;
+  uint32_t scale;
+  int64_t ts_ns;
+  uint32_t slot;
+  uint32_t seq;
+} ltr_frame_view_t;
+
+//Caller frees the name
+char *ltr_int_frame_ring_name(void);
+
+//Producer side
+bool ltr_int_frame_ring_setup(struct mmap_s *m, uint32_t frame_size);
+uint8_t *ltr_int_frame_ring_acquire(struct ltr_frame_ring *ring, uint32_t slot);
+void ltr_int_frame_ring_commit(struct ltr_frame_ring *ring, uint32_t slot, const ltr_frame_hdr_t *hdr);
+bool ltr_int_frame_ring_readers_active(const struct ltr_frame_ring *ring, int64_t now,
+                                       int64_t idle_ns);
+bool ltr_int_frame_ring_collect(struct ltr_frame_ring *ring, bool reset, ltr_frame_req_t *req);
+void ltr_int_frame_req_merge(ltr_frame_req_t *into, const ltr_frame_req_t *req);
+
+//Reader side
+bool ltr_int_frame_ring_view(const struct ltr_frame_ring *ring, size_t mapped,
+                             ltr_frame_view_t *view);
+bool ltr_int_frame_ring_view_valid(const struct ltr_frame_ring *ring, const ltr_frame_view_t *view);
+void ltr_int_frame_ring_touch(struct ltr_frame_ring *ring, int64_t now);
+void ltr_int_frame_ring_request(struct ltr_frame_ring *ring, const ltr_frame_req_t *req);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -261,29 +261,25 @@ static bool store_preblobs(bool all)
   return true;
 }
 
-bool ltr_int_add_stripe(stripe_t *stripe, image_t *img)
+static bool stripe_valid(const stripe_t *stripe, float max_x, unsigned int max_y)
 {
-  assert(current.ranges != NULL);
-  assert(stripe != NULL);
-  assert(img != NULL);
-  
   bool stripe_ok = true;
-  
-  if(stripe->vline > (unsigned int)img->h){
+
+  if(stripe->vline > max_y){
     ltr_int_log_message("Stripe ignored. (vline %d > img. height %d)\n", 
-                        stripe->vline, img->h);
+                        stripe->vline, max_y);
     stripe_ok = false;
   }
   
-  if(stripe->hstart > (unsigned int)img->w * img->ratio){
+  if(stripe->hstart > max_x){
     ltr_int_log_message("Stripe ignored. (hstart %d > img. width %d)\n",
-                        stripe->hstart, img->w * img->ratio);
+                        stripe->hstart, (int)max_x);
     stripe_ok = false;
   }
 
-  if(stripe->hstop > (unsigned int)img->w * img->ratio){
+  if(stripe->hstop > max_x){
     ltr_int_log_message("Stripe ignored. (hstop %d > img. width %d)\n",
-                        stripe->hstop, img->w * img->ratio);
+                        stripe->hstop, (int)max_x);
     stripe_ok = false;
   }
 
@@ -292,14 +288,12 @@ bool ltr_int_add_stripe(stripe_t *stripe, image_t *img)
                         stripe->hstart, stripe->hstop);
     stripe_ok = false;
   }
-  
-  if(!stripe_ok){
-    return false;
-  }
-  
-  if(img->bitmap != NULL){
-    draw_stripe(img, stripe->hstart, stripe->vline, stripe->hstop, 0x80);
-  }
+  return stripe_ok;
+}
+
+//Adds a stripe (already checked) to the preblobs
+static void label_stripe(stripe_t *stripe)
+{
 #ifdef DBG_MSG
   printf("Adding stripe: y:%d   x:%d - %d (%d   %d)\n", stripe->vline, stripe->hstart, 
          stripe->hstop, stripe->sum, stripe->sum_x);
@@ -372,9 +366,45 @@ bool ltr_int_add_stripe(stripe_t *stripe, image_t *img)
   new_rng->x1 = stripe->hstart;
   new_rng->x2 = stripe->hstop;
   new_rng->pb = pb;
+}
+
+bool ltr_int_add_stripe(stripe_t *stripe, image_t *img)
+{
+  assert(current.ranges != NULL);
+  assert(stripe != NULL);
+  assert(img != NULL);
+  
+  if(!stripe_valid(stripe, img->w * img->ratio, img->h)){
+    return false;
+  }
+  if(img->bitmap != NULL){
+    draw_stripe(img, stripe->hstart, stripe->vline, stripe->hstop, 0x80);
+  }
+  label_stripe(stripe);
   return true;
 }
 
+//Batch version of ltr_int_add_stripe; returns number of stripes accepted
+size_t ltr_int_add_stripes(stripe_t stripes[], size_t count, image_t *img)
+{
+  assert(current.ranges != NULL);
+  assert(img != NULL);
+  float max_x = img->w * img->ratio;
+  unsigned int max_y = img->h;
+  size_t i, accepted = 0;
+  for(i = 0; i < count; ++i){
+    if(!stripe_valid(&(stripes[i]), max_x, max_y)){
+      continue;
+    }
+    if(img->bitmap != NULL){
+      draw_stripe(img, stripes[i].hstart, stripes[i].vline, stripes[i].hstop, 0x80);
+    }
+    label_stripe(&(stripes[i]));
+    ++accepted;
+  }
+  return accepted;
+}
+
 
 static dbg_flag_type img_dbg_flag = DBG_CHECK;
 
@@ -405,9 +435,12 @@ void ltr_int_cleanup_after_processing()
   next.limit = 0;
 }
 
-void ltr_int_to_stripes(image_t *img)
+//Extracts the stripes of rows y0 to y1 - 1; rows must come in order, the blobs
+//  are then finished by ltr_int_stripes_to_blobs (or dropped by ltr_int_discard_stripes)
+void ltr_int_rows_to_stripes(image_t *img, int y0, int y1)
 {
   assert(img != NULL);
+  assert((y0 >= 0) && (y1 <= img->h));
   int x, y;
   unsigned char *ptr;
   bool in_stripe = false;
@@ -417,7 +450,7 @@ void ltr_int_to_stripes(image_t *img)
   printf(">\n");
 #endif
   
-  for(y = 0; y < img->h; ++y){
+  for(y = y0; y < y1; ++y){
     ptr = img->bitmap + (y * img->w);
     for(x = 0; x < img->w; ++x){
       if(*ptr != 0){
@@ -460,6 +493,25 @@ void ltr_int_to_stripes(image_t *img)
   //printf("\n");
 }
 
+void ltr_int_to_stripes(image_t *img)
+{
+  assert(img != NULL);
+  ltr_int_rows_to_stripes(img, 0, img->h);
+}
+
+//Drops the stripes gathered so far (e.g. when a frame turns out to be incomplete)
+void ltr_int_discard_stripes(void)
+{
+  store_preblobs(true);
+  current.limit= 0;
+  next.limit = 0;
+  current_vline = -2;
+  if(preblobs != NULL){
+    ltr_int_free_list(preblobs, true);
+    preblobs = NULL;
+  }
+}
+
 int ltr_int_stripes_to_blobs(unsigned int num_blobs, struct bloblist_type *blt, 
 		     int min_pts, int max_pts, image_t *img)
 {
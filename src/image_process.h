@@ -26,9 +26,12 @@ typedef struct {
 void ltr_int_prepare_for_processing(int w, int h);
 void ltr_int_cleanup_after_processing();
 void ltr_int_to_stripes(image_t *img);
+void ltr_int_rows_to_stripes(image_t *img, int y0, int y1);
+void ltr_int_discard_stripes(void);
 int ltr_int_stripes_to_blobs(unsigned int num_blobs, struct bloblist_type *blt, 
 		     int min_pts, int max_pts, image_t *img);
 bool ltr_int_add_stripe(stripe_t *stripe, image_t *img);
+size_t ltr_int_add_stripes(stripe_t stripes[], size_t count, image_t *img);
 void ltr_int_draw_cross(image_t *img, int x, int y, int size);
 void ltr_int_draw_empty_square(image_t *img, int x1, int y1, int x2, int y2);
 void ltr_int_draw_square(image_t *img, int x, int y, int size);
@@ -296,6 +296,42 @@ bool ltr_int_mmap_file(const char *fname, size_t tmp_size, struct mmap_s *m)
   return true;
 }
 
+//Maps an existing file at its current size (no creation, no truncation);
+//  meant for readers of segments someone else owns, so unmapping it
+//  leaves the file in place.
+bool ltr_int_mmap_existing_file(const char *fname, struct mmap_s *m)
+{
+  int fd = open(fname, O_RDWR | O_NOFOLLOW);
+  if(fd < 0){
+    return false;
+  }
+  struct stat file_stat;
+  if((fstat(fd, &file_stat) != 0) || (file_stat.st_size <= 0)){
+    close(fd);
+    return false;
+  }
+  if(!ltr_int_mmap(fd, file_stat.st_size, m)){
+    return false;
+  }
+  m->fname = NULL;
+  m->size = file_stat.st_size;
+  m->sem = ltr_int_semaphoreFromFd(fd);
+  m->lock_sem = NULL;
+  m->sem->fd = fd;
+  return true;
+}
+
+//Checks the mapping still refers to the file currently found under fname
+//  (it might have been removed and recreated by its owner meanwhile).
+bool ltr_int_mmap_is_current(const char *fname, const struct mmap_s *m)
+{
+  struct stat mapped, current;
+  if((m->data == NULL) || (fstat(m->sem->fd, &mapped) != 0) || (stat(fname, &current) != 0)){
+    return false;
+  }
+  return (mapped.st_dev == current.st_dev) && (mapped.st_ino == current.st_ino);
+}
+
 bool ltr_int_mmap_file_exclusive(size_t tmp_size, struct mmap_s *m)
 {
   umask(S_IWGRP | S_IWOTH);
@@ -335,8 +371,8 @@ bool ltr_int_unmap_file(struct mmap_s *m)
   if(res < 0){
     ltr_int_my_perror("munmap: ");
   }
-  unlink(m->fname);
   if(m->fname != NULL){
+    unlink(m->fname);
     free(m->fname);
     m->fname = NULL;
   }
@@ -37,6 +37,8 @@ bool ltr_int_unlockSemaphore(semaphore_p semaphore);
 void ltr_int_closeSemaphore(semaphore_p semaphore);
 
 bool ltr_int_mmap_file(const char *name, size_t tmp_size, struct mmap_s *m);
+bool ltr_int_mmap_existing_file(const char *name, struct mmap_s *m);
+bool ltr_int_mmap_is_current(const char *name, const struct mmap_s *m);
 LIBLINUXTRACK_PRIVATE bool ltr_int_mmap_file_exclusive(size_t tmp_size, struct mmap_s *m);
 LIBLINUXTRACK_PRIVATE bool ltr_int_unmap_file(struct mmap_s *m);
 int ltr_int_open_tmp_file(char *fname);
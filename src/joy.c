@@ -16,6 +16,8 @@
 #include <unistd.h>
 #include <poll.h>
 #include <ctype.h>
+#include <errno.h>
+#include <time.h>
 
 #include <utils.h>
 #include <cal.h>
@@ -473,6 +475,29 @@ static unsigned int cntr = 0;
 static unsigned char bm;
 static struct pollfd desc;
 
+#define EVENT_BATCH 64
+
+//Axis values of the report being read, applied on SYN_REPORT
+typedef struct{
+  uint16_t code;
+  int value;
+} pending_axis_t;
+
+static pending_axis_t pending[ABS_CNT];
+static unsigned int num_pending = 0;
+static bool syn_dropped = false;
+static bool monotonic_events = false;
+static float last_sent[6];
+static int64_t last_sent_ts = 0;
+static int64_t report_ts = 0;
+//Without any change, a frame is still emitted this often; read on every
+//  poll, so a change of PollsPerSecond in the GUI applies immediately
+static int64_t keepalive_ns(void)
+{
+  int pps = ltr_int_joy_get_pps();
+  return 1000000000LL / ((pps > 0) ? pps : 1);
+}
+
 
 
 
@@ -500,6 +525,16 @@ int ltr_int_tracker_init(struct camera_control_block *ccb)
   yaw = pitch = roll = tx = ty = tz = 0.0f;
   cntr = 0;
   bm = 0;
+  num_pending = 0;
+  syn_dropped = false;
+  last_sent_ts = 0;
+  report_ts = 0;
+  //Have the kernel stamp the events with the clock the frames use
+  monotonic_events = false;
+  if(ifc == e_EVDEV){
+    int clk = CLOCK_MONOTONIC;
+    monotonic_events = (ioctl(fd, EVIOCSCLOCKID, &clk) == 0);
+  }
   return 0;
 }
 
@@ -544,51 +579,179 @@ static int mapAxis(uint8_t axisNumber, int value)
 }
 
 
+static int64_t event_ts(const struct timeval *tv)
+{
+  int64_t ts = tv->tv_sec * 1000000000LL + tv->tv_usec * 1000LL;
+  if(monotonic_events){
+    return ts;
+  }
+  //Events stamped with CLOCK_REALTIME
+  struct timespec real;
+  clock_gettime(CLOCK_REALTIME, &real);
+  int64_t age = real.tv_sec * 1000000000LL + real.tv_nsec - ts;
+  int64_t now = ltr_int_get_ts_ns();
+  return ((age >= 0) && (age < 1000000000LL)) ? now - age : now;
+}
+
+//After the kernel dropped events, the whole state has to be read anew
+static void resync_axes(void)
+{
+  size_t i;
+  for(i = 0; i < axes.axes; ++i){
+    struct input_absinfo ai;
+    if(ioctl(fd, EVIOCGABS(axes.axesList[i]), &ai) == 0){
+      mapAxis(axes.axesList[i], normalize(ai.value, &axes, axes.axesList[i]));
+    }
+  }
+}
+
+static void add_pending(uint16_t code, int value)
+{
+  unsigned int i;
+  for(i = 0; i < num_pending; ++i){
+    if(pending[i].code == code){
+      pending[i].value = value;
+      return;
+    }
+  }
+  if(num_pending < ABS_CNT){
+    pending[num_pending].code = code;
+    pending[num_pending].value = value;
+    ++num_pending;
+  }
+}
+
+/*
+ * Reads everything the device has queued; axis values are applied report by
+ *   report (on SYN_REPORT), so a partially read report never gets out.
+ *   report_ts is the kernel time of the newest complete report.
+ */
+static int read_evdev(void)
+{
+  struct input_event event[EVENT_BATCH];
+  size_t i;
+  while(1){
+    ssize_t res = read(fd, event, sizeof(event));
+    if(res < 0){
+      if((errno == EAGAIN) || (errno == EWOULDBLOCK)){
+        return 0;
+      }
+      ltr_int_my_perror("read");
+      return -1;
+    }
+    if(res % sizeof(struct input_event) != 0){
+      ltr_int_log_message("Partial evdev event read!\n");
+      return -1;
+    }
+    for(i = 0; i < res / sizeof(struct input_event); ++i){
+      switch(event[i].type){
+        case EV_ABS:
+          if(!syn_dropped){
+            add_pending(event[i].code, event[i].value);
+          }
+          break;
+        case EV_SYN:
+          if(event[i].code == SYN_DROPPED){
+            syn_dropped = true;
+            num_pending = 0;
+          }else if(event[i].code == SYN_REPORT){
+            if(syn_dropped){
+              resync_axes();
+              syn_dropped = false;
+            }else{
+              unsigned int j;
+              for(j = 0; j < num_pending; ++j){
+                mapAxis(pending[j].code, normalize(pending[j].value, &axes, pending[j].code));
+              }
+            }
+            num_pending = 0;
+            report_ts = event_ts(&(event[i].time));
+          }
+          break;
+        default:
+          break;
+      }
+    }
+    if((size_t)res < sizeof(event)){
+      return 0;
+    }
+  }
+}
+
+//The js interface has no report boundaries; everything queued makes one frame
+static int read_js(void)
+{
+  struct js_event js[EVENT_BATCH];
+  size_t i;
+  while(1){
+    ssize_t res = read(fd, js, sizeof(js));
+    if(res < 0){
+      if((errno == EAGAIN) || (errno == EWOULDBLOCK)){
+        return 0;
+      }
+      ltr_int_my_perror("read");
+      return -1;
+    }
+    if(res % sizeof(struct js_event) != 0){
+      ltr_int_log_message("Partial js event read!\n");
+      return -1;
+    }
+    for(i = 0; i < res / sizeof(struct js_event); ++i){
+      if((js[i].type & ~JS_EVENT_INIT) == JS_EVENT_AXIS){
+        mapAxis(js[i].number, js[i].value);
+      }
+    }
+    //js timestamps are in ms of an unspecified base, the read time has to do
+    report_ts = ltr_int_get_ts_ns();
+    if((size_t)res < sizeof(js)){
+      return 0;
+    }
+  }
+}
+
+/*
+ * Blocks until the device reports something; a frame is emitted only when
+ *   the pose changed, or when nothing was emitted for keepalive_ns().
+ */
 int ltr_int_tracker_get_frame(struct camera_control_block *ccb,
                    struct frame_type *f, bool *frame_acquired)
 {
   (void) ccb;
-  struct input_event event[16];
-  struct js_event js[16];
-  size_t i;
+  *frame_acquired = false;
   desc.fd = fd;
   desc.events = POLLIN;
   desc.revents = 0;
-  ssize_t res;
-  int poll_res = poll(&desc, 1, 1000 / ltr_int_joy_get_pps());
+  int64_t now = ltr_int_get_ts_ns();
+  int64_t keepalive = keepalive_ns();
+  int64_t wait_ns = last_sent_ts + keepalive - now;
+  int timeout = (wait_ns > 0) ? (int)((wait_ns + 999999) / 1000000) : 0;
+  int poll_res = poll(&desc, 1, timeout);
   if(poll_res < 0){
+    if(errno == EINTR){
+      return 0;
+    }
     ltr_int_my_perror("poll");
     return -1;
   }else if(poll_res > 0){
-    //timeout
-    switch(ifc){
-      case e_JS:
-        res = read(fd, js, sizeof(js));
-        if((res < 0) || (res % sizeof(struct js_event) != 0)){
-          ltr_int_my_perror("read");
-          return -1;
-        }
-        for(i = 0; i < res / sizeof(struct js_event); ++i){
-          if((js[i].type & ~JS_EVENT_INIT) == JS_EVENT_AXIS){
-            mapAxis(js[i].number, js[i].value);
-          }
-        }
-        break;
-      case e_EVDEV:
-          res = read(fd, &event, sizeof(event));
-          if((res < 0) || (res % sizeof(struct input_event) != 0)){
-            ltr_int_my_perror("read");
-            return -1;
-          }
-          for(i = 0; i < res / sizeof(struct input_event); ++i){
-            if(event[i].type == EV_ABS){
-              mapAxis(event[i].code, normalize(event[i].value, &axes, event[i].code));
-            }
-          }
-        break;
+    if(desc.revents & (POLLERR | POLLHUP | POLLNVAL)){
+      ltr_int_log_message("Joystick device went away.\n");
+      return -1;
+    }
+    int res = (ifc == e_EVDEV) ? read_evdev() : read_js();
+    if(res < 0){
+      return -1;
     }
   }
 
+  float current[6] = {yaw, pitch, roll, tx, ty, tz};
+  bool changed = (memcmp(current, last_sent, sizeof(current)) != 0);
+  now = ltr_int_get_ts_ns();
+  if(!changed && (now - last_sent_ts < keepalive)){
+    return 0;
+  }
+  memcpy(last_sent, current, sizeof(current));
+  last_sent_ts = now;
+
   f->bloblist.num_blobs = 3;
   f->bloblist.blobs[0].x = yaw;
   f->bloblist.blobs[0].y = pitch;
@@ -599,6 +762,10 @@ int ltr_int_tracker_get_frame(struct camera_control_block *ccb,
   f->width = 1;
   f->height = 1;
   f->counter = cntr++;
+  //Keepalives are stamped by the runloop
+  if(changed){
+    f->ts_ns = report_ts;
+  }
   *frame_acquired = true;
   //f->bitmap = &bm;
 
@@ -607,4 +774,3 @@ int ltr_int_tracker_get_frame(struct camera_control_block *ccb,
 
   return 0;
 }
-
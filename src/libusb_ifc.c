@@ -1,8 +1,11 @@
 #include <libusb-1.0/libusb.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
 #define USB_IMPL_ONLY
 #include "usb_ifc.h"
+#include "usb_capture.h"
 #include "utils.h"
 
 static libusb_context *usb_context = NULL;
@@ -233,6 +236,11 @@ dev_found ltr_int_find_tir(void)
   libusb_free_device_list(list, 1);
   ltr_int_log_message("Device list freed.\n");
   if(handle != NULL){
+    //Binary capture of the traffic for offline replay (tests/tir_replay)
+    char *capture = getenv("LINUXTRACK_USB_CAPTURE");
+    if(capture != NULL){
+      ltr_int_usb_capture_open(capture, dev);
+    }
     return dev;
   }else{
     ltr_int_log_message("Bad handle!\n");
@@ -332,6 +340,7 @@ bool ltr_int_send_data(int out_ep, unsigned char data[], size_t size)
   if(comm_dbg_flag == DBG_ON){
     ltr_int_log_packet("out", data, size);
   }
+  ltr_int_usb_capture_add(USB_CAPTURE_OUT, out_ep, data, size, ltr_int_get_ts_ns());
   //ltr_int_log_message("Sending bulk data.\n");
   if((res = libusb_bulk_transfer(handle, out_ep, data, size, &transferred, 500))){
     ltr_int_log_message("Problem writing data to TIR@ep %d! %d - %d transferred\n",
@@ -351,6 +360,7 @@ bool ltr_int_ctrl_data(uint8_t req_type, uint8_t req, uint16_t val, uint16_t ind
                         req_type, req, val, index);
     ltr_int_log_packet("ctrl", data, size);
   }
+  ltr_int_usb_capture_add(USB_CAPTURE_CTRL, req, data, size, ltr_int_get_ts_ns());
   //ltr_int_log_message("Sending control data.\n");
   if((res = libusb_control_transfer(handle, req_type, req, val, index, data, size, 500)) < 0){
     ltr_int_log_message("Problem sending control request req_type: %d req: %d val: %d index: %d! %d\n",
@@ -384,13 +394,190 @@ bool ltr_int_receive_data(int in_ep, unsigned char data[], size_t size, size_t *
     if(comm_dbg_flag == DBG_ON){
       ltr_int_log_packet("in", data, *transferred);
     }
+    ltr_int_usb_capture_add(USB_CAPTURE_IN, in_ep, data, *transferred, ltr_int_get_ts_ns());
   }
   //ltr_int_log_message("Bulk data received.\n");
   return true;
 }
 
+#define MAX_STREAM_TRANSFERS 16
+
+typedef enum {XFER_IDLE, XFER_IN_FLIGHT, XFER_DONE} xfer_state_t;
+
+static struct libusb_transfer *stream_xfer[MAX_STREAM_TRANSFERS];
+static volatile xfer_state_t stream_state[MAX_STREAM_TRANSFERS];
+static int64_t stream_ts[MAX_STREAM_TRANSFERS];
+static unsigned int stream_count = 0;
+static unsigned int stream_head = 0; //transfers complete (and are handed out) in submission order
+static bool stream_held = false;
+
+static void LIBUSB_CALL stream_cbk(struct libusb_transfer *xfer)
+{
+  unsigned int idx = (unsigned int)(uintptr_t)xfer->user_data;
+  stream_ts[idx] = ltr_int_get_ts_ns();
+  stream_state[idx] = XFER_DONE;
+}
+
+static bool stream_submit(unsigned int idx)
+{
+  stream_state[idx] = XFER_IN_FLIGHT;
+  int res = libusb_submit_transfer(stream_xfer[idx]);
+  if(res != 0){
+    stream_state[idx] = XFER_IDLE;
+    ltr_int_log_message("Problem submitting transfer %d! %d\n", idx, res);
+    return false;
+  }
+  return true;
+}
+
+bool ltr_int_stream_start(int in_ep, size_t size, unsigned int transfers)
+{
+  unsigned int i;
+  if(stream_count != 0){
+    ltr_int_stream_stop();
+  }
+  if(transfers > MAX_STREAM_TRANSFERS){
+    transfers = MAX_STREAM_TRANSFERS;
+  }
+  for(i = 0; i < transfers; ++i){
+    stream_xfer[i] = libusb_alloc_transfer(0);
+    unsigned char *buf = (unsigned char *)malloc(size);
+    if((stream_xfer[i] == NULL) || (buf == NULL)){
+      ltr_int_log_message("Can't allocate transfers!\n");
+      libusb_free_transfer(stream_xfer[i]);
+      free(buf);
+      break;
+    }
+    libusb_fill_bulk_transfer(stream_xfer[i], handle, in_ep, buf, size, stream_cbk,
+                              (void *)(uintptr_t)i, 0);
+    stream_xfer[i]->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+    stream_state[i] = XFER_IDLE;
+    stream_count = i + 1;
+  }
+  stream_head = 0;
+  stream_held = false;
+  for(i = 0; i < stream_count; ++i){
+    if(!stream_submit(i)){
+      ltr_int_stream_stop();
+      return false;
+    }
+  }
+  ltr_int_log_message("Streaming from ep %d with %d transfers in flight.\n", in_ep, stream_count);
+  return stream_count > 0;
+}
+
+bool ltr_int_stream_read(unsigned char **data, size_t *transferred, int64_t *ts_ns, long timeout)
+{
+  *transferred = 0;
+  if(stream_count == 0){
+    return false;
+  }
+  if(stream_held){
+    ltr_int_stream_release();
+  }
+  if(timeout == 0){
+    timeout = 500;
+  }
+  int64_t deadline = ltr_int_get_ts_ns() + (int64_t)timeout * 1000000;
+  while(1){
+    unsigned int idx = stream_head;
+    while(stream_state[idx] == XFER_IN_FLIGHT){
+      int64_t left = deadline - ltr_int_get_ts_ns();
+      if(left <= 0){
+        ltr_int_log_message("Data receive request timed out!\n");
+        return true;
+      }
+      struct timeval tv = {.tv_sec = left / 1000000000, .tv_usec = (left % 1000000000) / 1000};
+      int res = libusb_handle_events_timeout_completed(usb_context, &tv, NULL);
+      if((res != 0) && (res != LIBUSB_ERROR_INTERRUPTED)){
+        ltr_int_log_message("Problem handling USB events! %d\n", res);
+        return false;
+      }
+    }
+    if(stream_state[idx] != XFER_DONE){
+      return false;
+    }
+    struct libusb_transfer *xfer = stream_xfer[idx];
+    switch(xfer->status){
+      case LIBUSB_TRANSFER_COMPLETED:
+        *data = xfer->buffer;
+        *transferred = xfer->actual_length;
+        *ts_ns = stream_ts[idx];
+        stream_held = true;
+        if(comm_dbg_flag == DBG_ON){
+          ltr_int_log_packet("in", xfer->buffer, xfer->actual_length);
+        }
+        ltr_int_usb_capture_add(USB_CAPTURE_IN, xfer->endpoint, xfer->buffer, xfer->actual_length,
+                                stream_ts[idx]);
+        return true;
+      case LIBUSB_TRANSFER_NO_DEVICE:
+      case LIBUSB_TRANSFER_CANCELLED:
+        ltr_int_log_message("Stream from TIR@ep %d ended (%d)!\n", xfer->endpoint, xfer->status);
+        return false;
+      default:
+        //Transient problem; requeue the transfer and go on with the next one
+        ltr_int_log_message("Problem reading data from TIR@ep %d! %d\n", xfer->endpoint, xfer->status);
+        stream_held = true;
+        ltr_int_stream_release();
+        break;
+    }
+  }
+}
+
+//Gives the packet returned by the last read back to the endpoint
+void ltr_int_stream_release(void)
+{
+  if(!stream_held){
+    return;
+  }
+  stream_held = false;
+  unsigned int idx = stream_head;
+  stream_head = (stream_head + 1) % stream_count;
+  stream_submit(idx);
+}
+
+void ltr_int_stream_stop(void)
+{
+  unsigned int i;
+  if(stream_count == 0){
+    return;
+  }
+  for(i = 0; i < stream_count; ++i){
+    if(stream_state[i] == XFER_IN_FLIGHT){
+      libusb_cancel_transfer(stream_xfer[i]);
+    }
+  }
+  //Cancellation completes through the callbacks; don't wait forever for them
+  int tries;
+  for(tries = 0; tries < 100; ++tries){
+    bool pending = false;
+    for(i = 0; i < stream_count; ++i){
+      pending = pending || (stream_state[i] == XFER_IN_FLIGHT);
+    }
+    if(!pending){
+      break;
+    }
+    struct timeval tv = {.tv_sec = 0, .tv_usec = 10000};
+    libusb_handle_events_timeout_completed(usb_context, &tv, NULL);
+  }
+  for(i = 0; i < stream_count; ++i){
+    if(stream_state[i] != XFER_IN_FLIGHT){
+      libusb_free_transfer(stream_xfer[i]);
+    }else{
+      ltr_int_log_message("Transfer %d didn't finish, leaking it!\n", i);
+    }
+    stream_xfer[i] = NULL;
+    stream_state[i] = XFER_IDLE;
+  }
+  stream_count = 0;
+  stream_held = false;
+  ltr_int_log_message("Stream stopped.\n");
+}
+
 void ltr_int_finish_usb(unsigned int interface)
 {
+  ltr_int_stream_stop();
+  ltr_int_usb_capture_close();
   ltr_int_log_message("Closing TrackIR.\n");
   if(interface_claimed){
     ltr_int_log_message("Releasing TrackIR interface.\n");
@@ -34,6 +34,7 @@ THE SOFTWARE.
 #endif
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include "linuxtrack.h"
 
 #ifdef HAVE_CONFIG_H
@@ -57,6 +58,9 @@ typedef const char *(*ltr_explain_t)(linuxtrack_state_type);
 typedef int (*ltr_get_frame_t)(int *req_width, int *req_height, size_t buf_size, uint8_t *buffer);
 typedef int (*ltr_get_notify_pipe_t)(void);
 typedef int (*ltr_wait_t)(int timeout);
+typedef int64_t (*ltr_get_time_ns_t)(void);
+typedef int (*ltr_get_pose_at_t)(int64_t target_ns, linuxtrack_pose_t *pose, int64_t *age_ns);
+typedef linuxtrack_state_type (*ltr_set_preview_t)(int scale, int crop_margin, int max_fps);
 
 
 static ltr_init_t ltr_init_fun = NULL;
@@ -74,6 +78,9 @@ static ltr_get_frame_t ltr_get_frame_fun = NULL;
 static ltr_gp_t ltr_notification_on_fun = NULL;
 static ltr_get_notify_pipe_t ltr_get_notify_pipe_fun = NULL;
 static ltr_wait_t ltr_wait_fun = NULL;
+static ltr_get_time_ns_t ltr_get_time_ns_fun = NULL;
+static ltr_get_pose_at_t ltr_get_pose_at_fun = NULL;
+static ltr_set_preview_t ltr_set_preview_fun = NULL;
 
 static void *lib_handle = NULL;
 
@@ -100,6 +107,9 @@ static struct func_defs_t functions[] =
   {(char*)"ltr_notification_on", (void *)&ltr_notification_on_fun, 0},
   {(char*)"ltr_get_notify_pipe", (void *)&ltr_get_notify_pipe_fun, 0},
   {(char*)"ltr_wait", (void *)&ltr_wait_fun, 0},
+  {(char*)"ltr_get_time_ns", (void *)&ltr_get_time_ns_fun, 0},
+  {(char*)"ltr_get_pose_at", (void *)&ltr_get_pose_at_fun, 0},
+  {(char*)"ltr_set_preview", (void *)&ltr_set_preview_fun, 0},
   {(char*)NULL, NULL, 0}
 };
 
@@ -161,6 +171,15 @@ linuxtrack_state_type linuxtrack_shutdown(void)
     ltr_get_pose_full_fun = NULL;
     ltr_get_tracking_state_fun = NULL;
     ltr_explain_fun = NULL;
+    ltr_get_abs_pose_fun = NULL;
+    ltr_request_frames_fun = NULL;
+    ltr_get_frame_fun = NULL;
+    ltr_notification_on_fun = NULL;
+    ltr_get_notify_pipe_fun = NULL;
+    ltr_wait_fun = NULL;
+    ltr_get_time_ns_fun = NULL;
+    ltr_get_pose_at_fun = NULL;
+    ltr_set_preview_fun = NULL;
 #ifndef __MINGW32__
     dlclose(handle);
 #endif
@@ -514,6 +533,14 @@ int linuxtrack_get_frame(int *req_width, int *req_height, size_t buf_size, uint8
   return ltr_get_frame_fun(req_width, req_height, buf_size, buffer);
 }
 
+linuxtrack_state_type linuxtrack_set_preview(int scale, int crop_margin, int max_fps)
+{
+  if(ltr_set_preview_fun == NULL){
+    return err_NOT_INITIALIZED;
+  }
+  return ltr_set_preview_fun(scale, crop_margin, max_fps);
+}
+
 linuxtrack_state_type linuxtrack_notification_on(void)
 {
   if(ltr_notification_on_fun == NULL){
@@ -537,3 +564,32 @@ int linuxtrack_wait(int timeout)
   }
   return ltr_wait_fun(timeout);
 }
+
+int64_t linuxtrack_get_time_ns(void)
+{
+  if(ltr_get_time_ns_fun == NULL){
+    //Older libraries don't export it; they use the same clock anyway
+#ifndef __MINGW32__
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000000000LL + t.tv_nsec;
+#else
+    return 0;
+#endif
+  }
+  return ltr_get_time_ns_fun();
+}
+
+int linuxtrack_get_pose_at(int64_t target_ns, linuxtrack_pose_t *pose, int64_t *age_ns)
+{
+  if(ltr_get_pose_at_fun == NULL){
+    //Older library - no prediction to target time available
+    if(age_ns != NULL){
+      *age_ns = -1;
+    }
+    int blobs_read;
+    return linuxtrack_get_pose_full(pose, NULL, 0, &blobs_read);
+  }
+  return ltr_get_pose_at_fun(target_ns, pose, age_ns);
+}
+
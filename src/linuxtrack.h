@@ -96,9 +96,19 @@ int linuxtrack_get_abs_pose(float *heading,
 
 linuxtrack_state_type linuxtrack_request_frames(void);
 int linuxtrack_get_frame(int *req_width, int *req_height, size_t buf_size, uint8_t *buffer);
+//Preview returned by linuxtrack_get_frame: downsampled by scale (1 = full resolution),
+//  cropped to the blobs plus crop_margin pixels (negative = whole frame), at most
+//  max_fps frames per second (0 = all).
+linuxtrack_state_type linuxtrack_set_preview(int scale, int crop_margin, int max_fps);
 linuxtrack_state_type linuxtrack_notification_on(void);
 int linuxtrack_get_notify_pipe(void);
 int linuxtrack_wait(int timeout);
+//Time base used by linuxtrack timestamps (CLOCK_MONOTONIC, nanoseconds)
+int64_t linuxtrack_get_time_ns(void);
+//Pose predicted to target_ns (e.g. the time the rendered frame will be displayed);
+//  age_ns (may be NULL) gets target_ns minus the capture time of the measurement.
+//  As with linuxtrack_get_pose_full, returns 1 if pose->counter changed.
+int linuxtrack_get_pose_at(int64_t target_ns, linuxtrack_pose_t *pose, int64_t *age_ns);
 
 #ifdef __cplusplus
 }
@@ -4,18 +4,61 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <math.h>
+#include <dlfcn.h>
+#include <sched.h>
 
 #include "ltlib_int.h"
 #include "ipc_utils.h"
+#include "pose_ring.h"
+#include "frame_ring.h"
 #include "utils.h"
 
 static struct mmap_s mmm;
 static bool initialized = false;
 static int notify_pipe = -1;
 
+//Spins this many times before yielding to a preempted writer, and gives
+//  up after twice as many (a writer that died mid-update never finishes)
+static const int c_SEQ_SPINS = 100;
+
+static bool ltr_int_seq_stuck(int retries)
+{
+  static bool logged = false;
+  if((retries == 2 * c_SEQ_SPINS) && !logged){
+    ltr_int_log_message("Slave seems to be stuck in the middle of an update!\n");
+    logged = true;
+  }
+  if(retries > c_SEQ_SPINS){
+    sched_yield();
+  }
+  return retries >= 2 * c_SEQ_SPINS;
+}
+
+//Consistent snapshot of the shared segment, without any syscall
+//  (the slave is the only writer, see struct ltr_comm).
+//  Returns false when no consistent copy could be made.
+static bool ltr_int_read_comm(const struct ltr_comm *com, struct ltr_comm *tmp)
+{
+  uint32_t start;
+  int retries = 0;
+  while(1){
+    if(ltr_int_seqlock_read_begin(&(com->data_seq), &start)){
+      memcpy(tmp, com, sizeof(struct ltr_comm));
+      if(ltr_int_seqlock_read_end(&(com->data_seq), start)){
+        return true;
+      }
+    }
+    //Writer got preempted in the middle of the update
+    if(ltr_int_seq_stuck(++retries)){
+      return false;
+    }
+  }
+}
+
 static int make_mmap()
 {
-  if(!ltr_int_mmap_file_exclusive(sizeof(struct mmap_s), &mmm)){
+  if(!ltr_int_mmap_file_exclusive(sizeof(struct ltr_comm), &mmm)){
     ltr_int_my_perror("mmap_file: ");
     ltr_int_log_message("Couldn't mmap!\n");
     return -1;
@@ -32,6 +75,42 @@ static void ltr_int_sanitize_name(char *name)
 
 int ltr_wakeup(void);
 
+typedef bool (*direct_start_fun_t)(const char *c_profile, const char *c_com_file, int notify_fd);
+typedef void (*direct_stop_fun_t)(void);
+static direct_stop_fun_t direct_stop = NULL;
+
+//Direct mode (LINUXTRACK_DIRECT=1) - instead of forking ltr_server1 slave,
+//  load libltr and run the slave inside of this process.
+static bool ltr_int_want_direct(void)
+{
+  const char *env = getenv("LINUXTRACK_DIRECT");
+  return (env != NULL) && (env[0] == '1');
+}
+
+static bool ltr_int_start_direct(const char *section, int notify_fd)
+{
+  char *lib_name = ltr_int_get_lib_path("libltr");
+  if(lib_name == NULL){
+    return false;
+  }
+  //Never unloaded - libltr keeps its state in statics
+  void *handle = dlopen(lib_name, RTLD_NOW | RTLD_LOCAL);
+  free(lib_name);
+  if(handle == NULL){
+    ltr_int_log_message("Can't load libltr for the direct mode (%s)!\n", dlerror());
+    return false;
+  }
+  direct_start_fun_t direct_start = (direct_start_fun_t)dlsym(handle, "ltr_int_slave_direct_start");
+  direct_stop = (direct_stop_fun_t)dlsym(handle, "ltr_int_slave_direct_stop");
+  if((direct_start == NULL) || (direct_stop == NULL) ||
+     (!direct_start(section, mmm.fname, notify_fd))){
+    ltr_int_log_message("Direct mode not available, starting slave process.\n");
+    direct_stop = NULL;
+    return false;
+  }
+  return true;
+}
+
 static char *ltr_int_init_helper(const char *cust_section, bool standalone)
 {
   char pid[16];
@@ -42,8 +121,10 @@ static char *ltr_int_init_helper(const char *cust_section, bool standalone)
   if(initialized) return mmm.fname;
   if(make_mmap() != 0) return NULL;
   struct ltr_comm *com = mmm.data;
+  ltr_int_seqlock_write_begin(&(com->data_seq));
   com->state = INITIALIZING;
   com->preparing_start = true;
+  ltr_int_seqlock_write_end(&(com->data_seq));
   initialized = true;
   if(standalone){
     if(pipe(fd) < 0){
@@ -55,21 +136,25 @@ static char *ltr_int_init_helper(const char *cust_section, bool standalone)
     }
     char *section = ltr_int_my_strdup(cust_section);
     ltr_int_sanitize_name(section);
-    snprintf(pid, sizeof(pid), "%lu", (unsigned long)getpid());
-    snprintf(pipe0, sizeof(pipe0), "%d", fd[0]);
-    snprintf(pipe1, sizeof(pipe1), "%d", fd[1]);
-    char *args[] = {server, section, mmm.fname, pid, pipe0, pipe1, NULL};
-    if(!ltr_int_fork_child(args, &is_child)){
-      com->state = err_NOT_INITIALIZED;
-      free(server);
-      if(is_child){
-        exit(1);
+    //In direct mode the write end of the notify pipe belongs to the slave thread
+    bool direct = ltr_int_want_direct() && ltr_int_start_direct(section, fd[1]);
+    if(!direct){
+      snprintf(pid, sizeof(pid), "%lu", (unsigned long)getpid());
+      snprintf(pipe0, sizeof(pipe0), "%d", fd[0]);
+      snprintf(pipe1, sizeof(pipe1), "%d", fd[1]);
+      char *args[] = {server, section, mmm.fname, pid, pipe0, pipe1, NULL};
+      if(!ltr_int_fork_child(args, &is_child)){
+        com->state = err_NOT_INITIALIZED;
+        free(server);
+        if(is_child){
+          exit(1);
+        }
+        return NULL;
       }
-      return NULL;
+      close(fd[1]);
     }
     free(server);
     free(section);
-    close(fd[1]);
     notify_pipe = fd[0];
     fcntl(notify_pipe, F_SETFL, fcntl(notify_pipe, F_GETFL) | O_NONBLOCK);
   }
@@ -88,65 +173,160 @@ linuxtrack_state_type ltr_init(const char *cust_section)
   }
 }
 
-static const float c_EXT_LIMIT = 3.0f;
-static const float c_EXT_ASYMPTOTE = 5.0f;
+//Only samples this close to the newest one take part in the fit
+static const int64_t c_HISTORY_WINDOW_NS = 100000000LL;
+//Never extrapolate further than this
+static const int64_t c_MAX_PREDICT_NS = 100000000LL;
+//Newest sample older than this means tracking is stalled; don't extrapolate
+static const int64_t c_STALE_NS = 250000000LL;
+
+static dbg_flag_type predict_dbg_flag = DBG_CHECK;
+static int predict_order = -1;
+
+//Order of the fitted polynomial - 0 (no prediction), 1 (velocity)
+//  or 2 (velocity and acceleration); set by LINUXTRACK_PREDICTION env var.
+static int ltr_int_get_predict_order(void)
+{
+  if(predict_order < 0){
+    predict_order = 1;
+    const char *env = getenv("LINUXTRACK_PREDICTION");
+    if(env != NULL){
+      predict_order = atoi(env);
+      if(predict_order < 0){
+        predict_order = 0;
+      }else if(predict_order > 2){
+        predict_order = 2;
+      }
+    }
+    predict_dbg_flag = ltr_int_get_dbg_flag('e');
+  }
+  return predict_order;
+}
 
-static float ltr_int_extrapolation_factor(int t1, int t2, int now)
+/*
+ * Least squares fit of a polynomial (order 1 or 2) through n samples
+ *   (t relative to the newest sample, in seconds), evaluated at target.
+ */
+static float ltr_int_fit_eval(const float t[], const float y[], int n, int order, float target)
 {
-  int dt12 = ltr_int_ts_diff(t1, t2);
-  int dt = ltr_int_ts_diff(t2, now);
-  printf("TSdiff: (%d, %d -> %d) -> (%d, %d -> %d)\n", t1, t2, dt12, t2, now, dt);
-  if(dt == 0){
-    printf("  ext = 0.0\n");
-    return 0.0f;
+  float mt = 0.0f, my = 0.0f;
+  int i;
+  for(i = 0; i < n; ++i){
+    mt += t[i];
+    my += y[i];
+  }
+  mt /= n;
+  my /= n;
+  //centered sums
+  float s2 = 0.0f, s3 = 0.0f, s4 = 0.0f, sy1 = 0.0f, sy2 = 0.0f;
+  for(i = 0; i < n; ++i){
+    float dt = t[i] - mt;
+    float dy = y[i] - my;
+    s2 += dt * dt;
+    s3 += dt * dt * dt;
+    s4 += dt * dt * dt * dt;
+    sy1 += dt * dy;
+    sy2 += dt * dt * dy;
+  }
+  if(s2 < 1e-12f){
+    return y[n - 1];
+  }
+  float x = target - mt;
+  if((order < 2) || (n < 3)){
+    return my + x * sy1 / s2;
   }
-  float ext = (float)dt / dt12;
-  //Should the extrapolation go further than c_EXTRAPOLATION_LIMIT
-  //  times the frame interval, start to round out with asymptote
-  //  of c_EXTRAPOLATION_ASYMPTOTE.
-  //Start linear in the interval <0.0; c_EXTRAPOLATION_LIMIT>;
-  //  at c_EXTRAPOLATION_LIMIT switch to -1/x type of curve
-  if(ext > 3){
-    // -1 / x => basic type of curve; we need to get the [1;-1] point
-    //   to [c_EXTRAPOLATION_LIMIT; c_EXTRAPOLATION_LIMIT]
-    // 
-    ext = c_EXT_ASYMPTOTE - 
-         (c_EXT_LIMIT * (c_EXT_ASYMPTOTE - c_EXT_LIMIT)) / ext;
+  //y = my + b * dt + c * (dt^2 - s2/n)
+  float k = s2 / n;
+  float d = s2 * (s4 - k * s2) - s3 * s3;
+  if(fabsf(d) < 1e-12f){
+    return my + x * sy1 / s2;
   }
-  printf("  ext = %g\n", ext);
-  return ext;
+  float b = (sy1 * (s4 - k * s2) - s3 * sy2) / d;
+  float c = (s2 * sy2 - s3 * sy1) / d;
+  return my + b * x + c * (x * x - k);
 }
 
-static inline float ltr_int_extrapolate(float v1, float v2, float ext)
+/*
+ * Predicts all history channels to the target time; returns age of the
+ *   newest measurement relative to target (ns), or -1 if there is no history.
+ */
+static int64_t ltr_int_predict(const struct ltr_comm *com, int64_t target, float res[HISTORY_CHANNELS])
 {
-  return v2 + (v2 - v1) * ext;
+  uint32_t count = com->history_count;
+  if(count == 0){
+    return -1;
+  }
+  int n = (count < POSE_HISTORY) ? (int)count : POSE_HISTORY;
+  const ltr_pose_sample_t *newest = &(com->history[(count - 1) % POSE_HISTORY]);
+  int64_t age = target - newest->timestamp;
+  int order = ltr_int_get_predict_order();
+  int i, ch;
+
+  float t[POSE_HISTORY];
+  float y[HISTORY_CHANNELS][POSE_HISTORY];
+  int used = 0;
+  //oldest first
+  for(i = n; i > 0; --i){
+    const ltr_pose_sample_t *s = &(com->history[(count - i) % POSE_HISTORY]);
+    int64_t dt = s->timestamp - newest->timestamp;
+    if((dt > 0) || (-dt > c_HISTORY_WINDOW_NS)){
+      continue;
+    }
+    t[used] = dt / 1e9f;
+    for(ch = 0; ch < HISTORY_CHANNELS; ++ch){
+      y[ch][used] = s->val[ch];
+    }
+    ++used;
+  }
+
+  int64_t horizon = age;
+  if(horizon > c_MAX_PREDICT_NS){
+    horizon = c_MAX_PREDICT_NS;
+  }
+  if((order == 0) || (used < 2) || (age > c_STALE_NS)){
+    for(ch = 0; ch < HISTORY_CHANNELS; ++ch){
+      res[ch] = newest->val[ch];
+    }
+  }else{
+    for(ch = 0; ch < HISTORY_CHANNELS; ++ch){
+      res[ch] = ltr_int_fit_eval(t, y[ch], used, order, horizon / 1e9f);
+    }
+  }
+  if(predict_dbg_flag == DBG_ON){
+    ltr_int_log_message("Predict: %d samples, age %lld us, horizon %lld us, yaw %g -> %g\n",
+                        used, (long long)(age / 1000), (long long)(horizon / 1000),
+                        newest->val[1], res[1]);
+  }
+  return age;
 }
 
-static void ltr_int_extrapolate_pose(
-       linuxtrack_full_pose_t *pose,
-       linuxtrack_pose_t *result)
+static void ltr_int_predict_pose(const struct ltr_comm *com, int64_t target, linuxtrack_pose_t *result)
 {
-  float ext = ltr_int_extrapolation_factor(pose->prev_timestamp, pose->timestamp, ltr_int_get_ts());
-  result->yaw = ltr_int_extrapolate(pose->prev_pose.yaw, pose->pose.yaw, ext);
-  result->pitch = ltr_int_extrapolate(pose->prev_pose.pitch, pose->pose.pitch, ext);
-  result->roll = ltr_int_extrapolate(pose->prev_pose.roll, pose->pose.roll, ext);
-  result->tx = ltr_int_extrapolate(pose->prev_pose.tx, pose->pose.tx, ext);
-  result->ty = ltr_int_extrapolate(pose->prev_pose.ty, pose->pose.ty, ext);
-  result->tz = ltr_int_extrapolate(pose->prev_pose.tz, pose->pose.tz, ext);
+  float res[HISTORY_CHANNELS];
+  if(ltr_int_predict(com, target, res) < 0){
+    return;
+  }
+  result->pitch = res[0];
+  result->yaw = res[1];
+  result->roll = res[2];
+  result->tx = res[3];
+  result->ty = res[4];
+  result->tz = res[5];
 }
 
 
-static void ltr_int_extrapolate_abs_pose(
-       linuxtrack_full_pose_t *pose,
-       linuxtrack_abs_pose_t *result)
+static void ltr_int_predict_abs_pose(const struct ltr_comm *com, int64_t target, linuxtrack_abs_pose_t *result)
 {
-  float ext = ltr_int_extrapolation_factor(pose->prev_timestamp, pose->timestamp, ltr_int_get_ts());
-  result->abs_yaw = ltr_int_extrapolate(pose->prev_abs_pose.abs_yaw, pose->abs_pose.abs_yaw, ext);
-  result->abs_pitch = ltr_int_extrapolate(pose->prev_abs_pose.abs_pitch, pose->abs_pose.abs_pitch, ext);
-  result->abs_roll = ltr_int_extrapolate(pose->prev_abs_pose.abs_roll, pose->abs_pose.abs_roll, ext);
-  result->abs_tx = ltr_int_extrapolate(pose->prev_abs_pose.abs_tx, pose->abs_pose.abs_tx, ext);
-  result->abs_ty = ltr_int_extrapolate(pose->prev_abs_pose.abs_ty, pose->abs_pose.abs_ty, ext);
-  result->abs_tz = ltr_int_extrapolate(pose->prev_abs_pose.abs_tz, pose->abs_pose.abs_tz, ext);
+  float res[HISTORY_CHANNELS];
+  if(ltr_int_predict(com, target, res) < 0){
+    return;
+  }
+  result->abs_pitch = res[6];
+  result->abs_yaw = res[7];
+  result->abs_roll = res[8];
+  result->abs_tx = res[9];
+  result->abs_ty = res[10];
+  result->abs_tz = res[11];
 }
 
 
@@ -162,14 +342,13 @@ int ltr_get_pose(float *heading,
   struct ltr_comm *com = mmm.data;
   if((!initialized) || (com == NULL)) return 0;
   struct ltr_comm tmp;
-  ltr_int_lockSemaphore(mmm.sem);
-  tmp = *com;
-  //printf("OTHER_SIDE: %g %g %g\n", tmp.pose.yaw, tmp.pose.pitch, tmp.pose.roll);
-  ltr_int_unlockSemaphore(mmm.sem);
+  if(!ltr_int_read_comm(com, &tmp)){
+    return 0;
+  }
   if(tmp.state >= LINUXTRACK_OK){
     uint32_t passed_counter = *counter;
-    linuxtrack_pose_t tmp_pose;
-    ltr_int_extrapolate_pose(&(tmp.full_pose), &tmp_pose);
+    linuxtrack_pose_t tmp_pose = tmp.full_pose.pose;
+    ltr_int_predict_pose(&tmp, ltr_int_get_ts_ns(), &tmp_pose);
     *heading = tmp_pose.yaw;
     *pitch = tmp_pose.pitch;
     *roll = tmp_pose.roll;
@@ -199,12 +378,13 @@ int ltr_get_pose_full(linuxtrack_pose_t *pose, float blobs[], int num_blobs, int
   struct ltr_comm *com = mmm.data;
   if((!initialized) || (com == NULL)) return 0;
   struct ltr_comm tmp;
-  ltr_int_lockSemaphore(mmm.sem);
-  tmp = *com;
-  ltr_int_unlockSemaphore(mmm.sem);
+  if(!ltr_int_read_comm(com, &tmp)){
+    return 0;
+  }
   if(tmp.state >= LINUXTRACK_OK){
     uint32_t prev_counter = pose->counter;
-    ltr_int_extrapolate_pose(&(tmp.full_pose), pose);
+    *pose = tmp.full_pose.pose;
+    ltr_int_predict_pose(&tmp, ltr_int_get_ts_ns(), pose);
     *blobs_read = (num_blobs < (int)tmp.full_pose.blobs) ? num_blobs : (int)tmp.full_pose.blobs;
     int i;
     for(i = 0; i < (*blobs_read) * BLOB_ELEMENTS; ++i){
@@ -222,6 +402,40 @@ int ltr_get_pose_full(linuxtrack_pose_t *pose, float blobs[], int num_blobs, int
   }
 }
 
+/*
+ * Pose predicted to target_ns (CLOCK_MONOTONIC, see ltr_get_time_ns);
+ *   age_ns receives target_ns minus the capture time of the newest
+ *   measurement (i.e. the whole capture->target latency compensated).
+ */
+int ltr_get_pose_at(int64_t target_ns, linuxtrack_pose_t *pose, int64_t *age_ns)
+{
+  struct ltr_comm *com = mmm.data;
+  if((!initialized) || (com == NULL)) return 0;
+  struct ltr_comm tmp;
+  if(!ltr_int_read_comm(com, &tmp)){
+    return 0;
+  }
+  if(tmp.state >= LINUXTRACK_OK){
+    uint32_t prev_counter = pose->counter;
+    *pose = tmp.full_pose.pose;
+    ltr_int_predict_pose(&tmp, target_ns, pose);
+    if(age_ns != NULL){
+      *age_ns = target_ns - tmp.full_pose.timestamp;
+    }
+    if(prev_counter != pose->counter){
+      return 1;//new data
+    }else{
+      return 0;
+    }
+  }else{
+    memset(pose, 0, sizeof(linuxtrack_pose_t));
+    if(age_ns != NULL){
+      *age_ns = -1;
+    }
+    return 0;
+  }
+}
+
 int ltr_get_abs_pose(float *heading,
                          float *pitch,
                          float *roll,
@@ -233,14 +447,13 @@ int ltr_get_abs_pose(float *heading,
   struct ltr_comm *com = mmm.data;
   if((!initialized) || (com == NULL)) return 0;
   struct ltr_comm tmp;
-  ltr_int_lockSemaphore(mmm.sem);
-  tmp = *com;
-  //printf("OTHER_SIDE: %g %g %g\n", tmp.pose.yaw, tmp.pose.pitch, tmp.pose.roll);
-  ltr_int_unlockSemaphore(mmm.sem);
+  if(!ltr_int_read_comm(com, &tmp)){
+    return 0;
+  }
   if(tmp.state >= LINUXTRACK_OK){
     uint32_t passed_counter = *counter;
-    linuxtrack_abs_pose_t tmp_pose;
-    ltr_int_extrapolate_abs_pose(&(tmp.full_pose), &tmp_pose);
+    linuxtrack_abs_pose_t tmp_pose = tmp.full_pose.abs_pose;
+    ltr_int_predict_abs_pose(&tmp, ltr_int_get_ts_ns(), &tmp_pose);
     *heading = tmp_pose.abs_yaw;
     *pitch = tmp_pose.abs_pitch;
     *roll = tmp_pose.abs_roll;
@@ -266,13 +479,22 @@ int ltr_get_abs_pose(float *heading,
 }
 
 
+//Wakes the slave up to process the command just posted
+static void ltr_int_doorbell(struct ltr_comm *com)
+{
+  __atomic_add_fetch(&(com->cmd_seq), 1, __ATOMIC_SEQ_CST);
+  ltr_int_seq_wake(&(com->cmd_seq), &(com->cmd_waiters));
+}
+
 linuxtrack_state_type ltr_suspend(void)
 {
   struct ltr_comm *com = mmm.data;
   if((!initialized) || (com == NULL)) return err_NOT_INITIALIZED;
   ltr_int_lockSemaphore(mmm.sem);
   com->cmd = PAUSE_CMD;
+  com->cmd_ts = ltr_int_get_ts_ns();
   ltr_int_unlockSemaphore(mmm.sem);
+  ltr_int_doorbell(com);
   return LINUXTRACK_OK;
 }
 
@@ -282,7 +504,9 @@ linuxtrack_state_type ltr_wakeup(void)
   if((!initialized) || (com == NULL)) return err_NOT_INITIALIZED;
   ltr_int_lockSemaphore(mmm.sem);
   com->cmd = RUN_CMD;
+  com->cmd_ts = ltr_int_get_ts_ns();
   ltr_int_unlockSemaphore(mmm.sem);
+  ltr_int_doorbell(com);
   return LINUXTRACK_OK;
 }
 
@@ -292,7 +516,13 @@ linuxtrack_state_type ltr_shutdown(void)
   if((!initialized) || (com == NULL)) return err_NOT_INITIALIZED;
   ltr_int_lockSemaphore(mmm.sem);
   com->cmd = STOP_CMD;
+  com->cmd_ts = ltr_int_get_ts_ns();
   ltr_int_unlockSemaphore(mmm.sem);
+  ltr_int_doorbell(com);
+  if(direct_stop != NULL){
+    direct_stop();
+    direct_stop = NULL;
+  }
   initialized = false;
   ltr_int_unmap_file(&mmm);
   return LINUXTRACK_OK;
@@ -304,7 +534,9 @@ linuxtrack_state_type ltr_recenter(void)
   if((!initialized) || (com == NULL)) return err_NOT_INITIALIZED;
   ltr_int_lockSemaphore(mmm.sem);
   com->recenter = true;
+  com->cmd_ts = ltr_int_get_ts_ns();
   ltr_int_unlockSemaphore(mmm.sem);
+  ltr_int_doorbell(com);
   return LINUXTRACK_OK;
 }
 
@@ -314,7 +546,9 @@ linuxtrack_state_type ltr_notification_on(void)
   if((!initialized) || (com == NULL)) return err_NOT_INITIALIZED;
   ltr_int_lockSemaphore(mmm.sem);
   com->notify = true;
+  com->cmd_ts = ltr_int_get_ts_ns();
   ltr_int_unlockSemaphore(mmm.sem);
+  ltr_int_doorbell(com);
   return LINUXTRACK_OK;
 }
 
@@ -329,24 +563,35 @@ linuxtrack_state_type ltr_request_frames(void)
   if((!initialized) || (com == NULL)) return err_NOT_INITIALIZED;
   ltr_int_lockSemaphore(mmm.sem);
   com->cmd = FRAMES_CMD;
+  com->cmd_ts = ltr_int_get_ts_ns();
   ltr_int_unlockSemaphore(mmm.sem);
+  ltr_int_doorbell(com);
   return LINUXTRACK_OK;
 }
 
+//Returned when the segment can't be read consistently
+static linuxtrack_state_type last_state = STOPPED;
+
 linuxtrack_state_type ltr_get_tracking_state(void)
 {
-  linuxtrack_state_type state = STOPPED;
   struct ltr_comm *com = mmm.data;
   if((!initialized) || (com == NULL)){
     return err_NOT_INITIALIZED;
   }
-  if(com->preparing_start){
-    return INITIALIZING;
+  uint32_t start;
+  int retries = 0;
+  while(1){
+    if(ltr_int_seqlock_read_begin(&(com->data_seq), &start)){
+      linuxtrack_state_type state = com->preparing_start ? INITIALIZING : com->state;
+      if(ltr_int_seqlock_read_end(&(com->data_seq), start)){
+        last_state = state;
+        return state;
+      }
+    }
+    if(ltr_int_seq_stuck(++retries)){
+      return last_state;
+    }
   }
-  ltr_int_lockSemaphore(mmm.sem);
-  state = com->state;
-  ltr_int_unlockSemaphore(mmm.sem);
-  return state;
 }
 
 void ltr_log_message(const char *format, ...)
@@ -397,60 +642,139 @@ const char *ltr_explain(linuxtrack_state_type status)
 }
 
 static struct mmap_s mmap;
+static uint32_t frames_seen = 0;
+static int64_t frames_seen_ts = 0;
+//Without new frames for this long the ring is looked up again
+static const int64_t frames_stale_ns = 1000000000LL;
+static ltr_frame_req_t preview_req = {.scale = 1, .margin = FRAME_RING_NO_CROP, .period_us = 0};
+
+// Selects the preview ltr_get_frame returns: frames downsampled by scale
+//   (1 = full resolution), cropped to the blobs plus crop_margin pixels
+//   (negative for the whole frame) and at most max_fps of them (0 = all).
+//   When more clients ask, the least reduced preview is produced.
+linuxtrack_state_type ltr_set_preview(int scale, int crop_margin, int max_fps)
+{
+  preview_req.scale = (scale > 1) ? scale : 1;
+  preview_req.margin = (crop_margin < 0) ? FRAME_RING_NO_CROP : (uint32_t)crop_margin;
+  preview_req.period_us = (max_fps > 0) ? 1000000 / max_fps : 0;
+  return LINUXTRACK_OK;
+}
 
 int ltr_get_frame(int *req_width, int *req_height, size_t buf_size, uint8_t *buffer)
 {
   struct ltr_comm *com = mmm.data;
   if((!initialized) || (com == NULL)) return 0;
   struct ltr_comm tmp;
-  ltr_int_lockSemaphore(mmm.sem);
-  tmp = *com;
-  ltr_int_unlockSemaphore(mmm.sem);
-  if(tmp.state < LINUXTRACK_OK){
+  if((!ltr_int_read_comm(com, &tmp)) || (tmp.state < LINUXTRACK_OK)){
     return 0;
   }
-  uint32_t p_w = tmp.full_pose.pose.resolution_x;
-  uint32_t p_h = tmp.full_pose.pose.resolution_y;
-
-  if(p_w * p_h > mmap.size){
+  int64_t now = ltr_int_get_ts_ns();
+  struct ltr_frame_ring *ring = (struct ltr_frame_ring *)mmap.data;
+  //The master replaces the ring when the frame grows or when it restarts
+  if((ring != NULL) && ((__atomic_load_n(&(ring->size), __ATOMIC_ACQUIRE) > mmap.size) ||
+                        (now - frames_seen_ts > frames_stale_ns))){
     ltr_int_unmap_file(&mmap);
-    int data_size = FRAME_BUFFERS * p_w * p_h + (3 * sizeof(uint32_t));
-    char *fname = ltr_int_get_default_file_name("frames.dat");
-    if(!ltr_int_mmap_file(fname, data_size, &mmap)){
-      free(fname);
+    ring = NULL;
+  }
+  if(ring == NULL){
+    char *fname = ltr_int_frame_ring_name();
+    bool res = ltr_int_mmap_existing_file(fname, &mmap);
+    free(fname);
+    if(!res){
+      mmap.data = NULL;
       return 0;
     }
-    free(fname);
+    ring = (struct ltr_frame_ring *)mmap.data;
+    frames_seen_ts = now;
   }
-  if(mmap.data == NULL){
-    return 0;
+  ltr_int_frame_ring_touch(ring, now);
+  ltr_int_frame_ring_request(ring, &preview_req);
+  uint32_t published = __atomic_load_n(&(ring->published), __ATOMIC_ACQUIRE);
+  if(published != frames_seen){
+    frames_seen = published;
+    frames_seen_ts = now;
   }
-  uint32_t *data = (uint32_t*)mmap.data;
 
-  *req_width = data[1];
-  *req_height = data[2];
-  unsigned int flag = data[0];
-  uint32_t frame_size = (*req_width) * (*req_height);
-  if((p_w * p_h) < frame_size){ //Size had to change, mmap not big enough
-    return 0;
+  ltr_frame_view_t view;
+  int i;
+  for(i = 0; i < 3; ++i){
+    if(!ltr_int_frame_ring_view(ring, mmap.size, &view)){
+      continue;
+    }
+    *req_width = view.width;
+    *req_height = view.height;
+    uint32_t frame_size = view.width * view.height;
+    if(buf_size < frame_size){
+      return 0;
+    }
+    memcpy(buffer, view.data, frame_size);
+    if(ltr_int_frame_ring_view_valid(ring, &view)){
+      return 1;
+    }
   }
-  if(buf_size < frame_size){
-    return 0;
+  return 0;
+}
+
+//pose_seq seen when the last ltr_wait returned
+static uint32_t wait_seq = 0;
+//How often a long ltr_wait checks the slave is still there
+static const int c_SLAVE_CHECK_MS = 500;
+
+//The slave holds the write end of the notify pipe; it hangs up when the slave is gone
+static bool ltr_int_slave_gone(void)
+{
+  bool hup = false;
+  if(notify_pipe >= 0){
+    ltr_int_pipe_poll(notify_pipe, 0, &hup);
   }
-  uint8_t *buf = ((uint8_t*)mmap.data) + (3 * sizeof(uint32_t)) + flag * frame_size;
-  memcpy(buffer, buf, frame_size);
-  return 1;
+  return hup;
 }
 
+// Blocks until a pose newer than the one seen by the previous call arrives;
+//   negative timeout waits forever.
+// Return value
+//   0 - timed out
+//   1 - new pose available
+//  -1 - not initialized or the slave is gone
 int ltr_wait(int timeout)
 {
-  bool hup = false;
-  int res = ltr_int_pipe_poll(notify_pipe, timeout, &hup);
-  if(res > 0){
+  struct ltr_comm *com = mmm.data;
+  if((!initialized) || (com == NULL)){
+    return -1;
+  }
+  int64_t deadline = ltr_int_get_ts_ns() + (int64_t)timeout * 1000000;
+  int res;
+  while(1){
+    int slice = c_SLAVE_CHECK_MS;
+    if(timeout >= 0){
+      int64_t left = (deadline - ltr_int_get_ts_ns()) / 1000000;
+      if(left < slice){
+        slice = (left > 0) ? (int)left : 0;
+      }
+    }
+    res = ltr_int_seq_wait(&(com->pose_seq), &(com->pose_waiters), wait_seq, slice);
+    if(res != 0){
+      break;
+    }
+    if(ltr_int_slave_gone()){
+      return -1;
+    }
+    if((timeout >= 0) && (ltr_int_get_ts_ns() >= deadline)){
+      break;
+    }
+  }
+  wait_seq = __atomic_load_n(&(com->pose_seq), __ATOMIC_ACQUIRE);
+  if((res > 0) && (notify_pipe >= 0)){
+    //The slave still writes a byte per pose when notification is on; drain
+    //  them so the pipe doesn't fill up (and stay readable for ever)
     uint8_t tmp[1024];
-    ssize_t read_res = -1;
-    while((read_res = read(notify_pipe, &tmp, sizeof(tmp))) > 0);
+    while(read(notify_pipe, &tmp, sizeof(tmp)) > 0);
   }
   return res;
 }
 
+int64_t ltr_get_time_ns(void)
+{
+  return ltr_int_get_ts_ns();
+}
+
@@ -26,10 +26,24 @@ typedef struct{
   linuxtrack_abs_pose_t abs_pose;
   uint32_t blobs;
   float blob_list[BLOB_ELEMENTS * MAX_BLOBS];
-  int timestamp;
-  int prev_timestamp;
+  //CLOCK_MONOTONIC ns; explicitly aligned so that 32 and 64bit
+  //  processes agree on the layout of the shared struct ltr_comm
+  int64_t timestamp __attribute__((aligned(8)));
+  int64_t prev_timestamp __attribute__((aligned(8)));
 }linuxtrack_full_pose_t;
 
+//Pose history kept in the shared segment for the client side predictor
+#define POSE_HISTORY 8
+//pitch, yaw, roll, tx, ty, tz followed by abs_pitch ... abs_tz
+#define HISTORY_CHANNELS 12
+
+typedef struct{
+  int64_t timestamp __attribute__((aligned(8)));
+  float val[HISTORY_CHANNELS];
+} ltr_pose_sample_t;
+
+//cmd, recenter and notify are guarded by the file lock; the rest is written
+//  by the slave only and guarded by the data_seq seqlock (see pose_ring.h)
 struct ltr_comm{
   uint8_t cmd;
   uint8_t recenter;
@@ -38,6 +52,18 @@ struct ltr_comm{
   linuxtrack_full_pose_t full_pose;
   uint8_t dead_man_button;
   uint8_t preparing_start;
+  uint32_t history_count; //total samples written; newest at (count - 1) % POSE_HISTORY
+  ltr_pose_sample_t history[POSE_HISTORY];
+  //Incremented by the slave with every pose; clients can block on it
+  //  in ltr_wait (futex), they are woken only when somebody waits.
+  uint32_t pose_seq;
+  uint32_t pose_waiters;
+  uint32_t data_seq;
+  //Doorbell - client bumps cmd_seq after posting a command, the slave
+  //  blocks on it; cmd_ts (guarded by the file lock) stamps the request.
+  uint32_t cmd_seq;
+  uint32_t cmd_waiters;
+  int64_t cmd_ts __attribute__((aligned(8)));
 };
 
 #ifdef __cplusplus
@@ -7,89 +7,218 @@
 #include "cal.h"
 #include "tracking.h"
 #include "ltlib_int.h"
+#include "frame_ring.h"
 
 static pthread_t cal_thread;
 static ltr_new_frame_callback_t ltr_new_frame_cbk = NULL;
 static void *ltr_new_frame_cbk_param = NULL;
 
-static bool publish_frames = true;
-static int active_frame = 0;
-static unsigned int current_w = 0;
-static unsigned int current_h = 0;
 static struct mmap_s mmap;
-static int data_size = 0;
-static int extra_data = 3 * sizeof(uint32_t);
+static int writing_slot = 0;           //ring slot the driver draws into
+static uint8_t *writing_buf = NULL;    //bitmap handed to the driver, NULL if none of ours
+static bool writing_staged = false;    //writing_buf is the staging buffer, not a ring slot
+static uint8_t *staging = NULL;        //full frame for previews that need rendering
+static size_t staging_size = 0;
+static int64_t frames_requested_ts = 0;
+static int64_t last_frame_ts = 0;
+static int64_t last_publish_ts = 0;
+//Publishing stops when no reader showed up for this long
+static const int64_t frames_idle_ns = 3000000000LL;
 
-static int inc_frame_index(int current)
+static const ltr_frame_req_t full_preview = {.scale = 1, .margin = FRAME_RING_NO_CROP, .period_us = 0};
+static ltr_frame_req_t preview_window;  //what the readers asked for in the last window
+static int64_t preview_window_ts = 0;
+
+//The preview to produce: the last window's requests, plus any richer one since
+static ltr_frame_req_t current_preview(struct ltr_frame_ring *ring, int64_t now)
 {
-  return (current + 1) % FRAME_BUFFERS;
+  if(now - preview_window_ts >= frames_idle_ns){
+    //Readers repeat their request on every fetch, so the window can start over
+    ltr_int_frame_ring_collect(ring, true, &preview_window);
+    preview_window_ts = now;
+  }
+  ltr_frame_req_t mode = preview_window;
+  ltr_frame_req_t req;
+  if(ltr_int_frame_ring_collect(ring, false, &req)){
+    ltr_int_frame_req_merge(&mode, &req);
+  }
+  if(mode.scale == UINT32_MAX){
+    //Nobody said what they want (e.g. only asked for frames)
+    mode = full_preview;
+  }
+  return mode;
 }
 
-static void publish_frame(struct frame_type *frame)
+static bool preview_is_full(const ltr_frame_req_t *mode)
 {
-//   if(frame->bitmap == NULL){
-//     printf("No bitmap to copy!\n");
-//
-//     return;
-//   }
-  if((frame->width != current_w) || (frame->height != current_h)){
-    active_frame = 0;
-    if((frame->width * frame->height) > (current_w * current_h)){
-      ltr_int_unmap_file(&mmap);
-      data_size = FRAME_BUFFERS * frame->width * frame->height + extra_data;
-      char *fname = ltr_int_get_default_file_name("frames.dat");
-      if(!ltr_int_mmap_file(fname, data_size, &mmap)){
-        free(fname);
-        return;
+  return (mode->scale <= 1) && (mode->margin == FRAME_RING_NO_CROP);
+}
+
+static int64_t clamp(int64_t val, int64_t min, int64_t max)
+{
+  return (val < min) ? min : ((val > max) ? max : val);
+}
+
+/*
+ * Crops the frame to the blobs plus margin (when asked to and there are
+ *   blobs) and downsamples it keeping the brightest pixel of each cell,
+ *   so that small blobs don't disappear.
+ */
+static void render_preview(const struct frame_type *frame, const uint8_t *src,
+                           const ltr_frame_req_t *mode, uint8_t *dst, ltr_frame_hdr_t *hdr)
+{
+  int64_t w = frame->width;
+  int64_t h = frame->height;
+  int64_t x0 = 0, y0 = 0, x1 = w, y1 = h;
+  unsigned int i;
+  if((mode->margin != FRAME_RING_NO_CROP) && (frame->bloblist.num_blobs > 0)){
+    x0 = w; y0 = h; x1 = 0; y1 = 0;
+    for(i = 0; i < frame->bloblist.num_blobs; ++i){
+      //blob coordinates have the origin in the center, y going up
+      int64_t bx = (int64_t)(frame->bloblist.blobs[i].x + w / 2.0f);
+      int64_t by = (int64_t)(h / 2.0f - frame->bloblist.blobs[i].y);
+      x0 = (bx < x0) ? bx : x0;
+      x1 = (bx + 1 > x1) ? bx + 1 : x1;
+      y0 = (by < y0) ? by : y0;
+      y1 = (by + 1 > y1) ? by + 1 : y1;
+    }
+    x0 = clamp(x0 - (int64_t)mode->margin, 0, w - 1);
+    y0 = clamp(y0 - (int64_t)mode->margin, 0, h - 1);
+    x1 = clamp(x1 + (int64_t)mode->margin, x0 + 1, w);
+    y1 = clamp(y1 + (int64_t)mode->margin, y0 + 1, h);
+  }
+  int64_t s = (mode->scale > 0) ? mode->scale : 1;
+  int64_t dw = (x1 - x0 + s - 1) / s;
+  int64_t dh = (y1 - y0 + s - 1) / s;
+  int64_t dx, dy, x, y;
+  for(dy = 0; dy < dh; ++dy){
+    int64_t ys = y0 + dy * s;
+    int64_t ye = (ys + s < y1) ? ys + s : y1;
+    uint8_t *out = dst + dy * dw;
+    if(s == 1){
+      memcpy(out, src + ys * w + x0, dw);
+      continue;
+    }
+    for(dx = 0; dx < dw; ++dx){
+      int64_t xs = x0 + dx * s;
+      int64_t xe = (xs + s < x1) ? xs + s : x1;
+      uint8_t val = 0;
+      for(y = ys; y < ye; ++y){
+        const uint8_t *row = src + y * w;
+        for(x = xs; x < xe; ++x){
+          val = (row[x] > val) ? row[x] : val;
+        }
       }
-      free(fname);
+      out[dx] = val;
+    }
+  }
+  hdr->width = dw;
+  hdr->height = dh;
+  hdr->x = x0;
+  hdr->y = y0;
+  hdr->scale = s;
+}
+
+//Publishes a frame (drawn by the driver or supplied by someone else) to the next slot
+static void publish_to_ring(struct ltr_frame_ring *ring, struct frame_type *frame,
+                            const uint8_t *src, const ltr_frame_req_t *mode, int64_t ts)
+{
+  ltr_frame_hdr_t hdr = {.counter = frame->counter, .width = frame->width,
+                         .height = frame->height, .scale = 1, .ts_ns = ts};
+  int slot = (__atomic_load_n(&(ring->latest), __ATOMIC_RELAXED) + 1) % FRAME_RING_SLOTS;
+  uint8_t *dst = ltr_int_frame_ring_acquire(ring, slot);
+  if(preview_is_full(mode)){
+    memcpy(dst, src, frame->width * frame->height);
+  }else{
+    render_preview(frame, src, mode, dst, &hdr);
+  }
+  ltr_int_frame_ring_commit(ring, slot, &hdr);
+}
+
+static void publish_frame(struct frame_type *frame)
+{
+  uint32_t frame_size = frame->width * frame->height;
+  if((mmap.data == NULL) || (frame_size > ((struct ltr_frame_ring *)mmap.data)->slot_size)){
+    //The driver must not keep drawing into the old mapping
+    if((writing_buf != NULL) && !writing_staged && (frame->bitmap == writing_buf)){
+      frame->bitmap = NULL;
+      writing_buf = NULL;
+    }
+    if(!ltr_int_frame_ring_setup(&mmap, frame_size)){
+      return;
+    }
+  }
+  struct ltr_frame_ring *ring = (struct ltr_frame_ring *)mmap.data;
+  bool bitmap_ours = (writing_buf != NULL) && (frame->bitmap == writing_buf);
+  int64_t now = ltr_int_get_ts_ns();
+  int64_t ts = (frame->ts_ns != 0) ? frame->ts_ns : now;
+  int64_t frame_period = ts - last_frame_ts;
+  last_frame_ts = ts;
+
+  if(!ltr_int_frame_ring_readers_active(ring, now, frames_idle_ns) &&
+     (now - frames_requested_ts >= frames_idle_ns)){
+    //Nobody is watching; spare the driver drawing the frame at all
+    if(bitmap_ours){
+      frame->bitmap = NULL;
     }
-    current_w = frame->width;
-    current_h = frame->height;
-    *(uint8_t*)mmap.data = 0;
-  }
-  uint32_t *data = (uint32_t*)mmap.data;
-  uint32_t *flag = data;
-  uint32_t *w = data + 1;
-  uint32_t *h = data + 2;
-  uint8_t *buf_base = ((uint8_t*)mmap.data) + extra_data;
-  int frame_size = frame->width * frame->height;
-  //advance the flag to point to the current buffer
-  int current_index = inc_frame_index(*flag);
-  uint8_t *current_buf = buf_base + (current_index) * frame_size;
-
-  *w = frame->width;
-  *h = frame->height;
-
-  if(frame->bitmap == current_buf){
-    int next_index = inc_frame_index(current_index);
-    frame->bitmap = buf_base + next_index * frame_size;
-    *flag = current_index;
-    memset(frame->bitmap, 0, frame->width * frame->height);
-  }else if(frame->bitmap == NULL){
-    *flag = 0;
-    memset(buf_base, 0, frame->width * frame->height);
-    frame->bitmap = buf_base + frame_size;
-    memset(frame->bitmap, 0, frame->width * frame->height);
+    return;
+  }
+
+  ltr_frame_req_t mode = current_preview(ring, now);
+  //Rate limited previews leave out frames; be lenient by half a frame
+  int64_t min_spacing = (int64_t)mode.period_us * 1000 - frame_period / 2;
+  if(ts - last_publish_ts >= min_spacing){
+    if(bitmap_ours && !writing_staged){
+      ltr_frame_hdr_t hdr = {.counter = frame->counter, .width = frame->width,
+                             .height = frame->height, .scale = 1, .ts_ns = ts};
+      ltr_int_frame_ring_commit(ring, writing_slot, &hdr);
+      last_publish_ts = ts;
+    }else if(frame->bitmap != NULL){
+      //staged by us or supplied by someone else
+      publish_to_ring(ring, frame, frame->bitmap, &mode, ts);
+      last_publish_ts = ts;
+    }
+  }
+  if((frame->bitmap != NULL) && !bitmap_ours){
+    //someone else supplies the frames
+    writing_buf = NULL;
+    return;
+  }
+  if(ts + frame_period - last_publish_ts < min_spacing){
+    //The next frame won't be published either, don't make the driver draw it
+    frame->bitmap = NULL;
+    return;
+  }
+  if(preview_is_full(&mode)){
+    //Hand the driver the slot after the newest frame
+    writing_slot = (__atomic_load_n(&(ring->latest), __ATOMIC_RELAXED) + 1) % FRAME_RING_SLOTS;
+    writing_buf = ltr_int_frame_ring_acquire(ring, writing_slot);
+    writing_staged = false;
   }else{
-    //someone else has supplied the frame
-    memcpy(current_buf, frame->bitmap, current_w * current_h);
-    *flag = current_index;
+    if(staging_size < frame_size){
+      free(staging);
+      staging = (uint8_t *)malloc(frame_size);
+      staging_size = (staging != NULL) ? frame_size : 0;
+    }
+    writing_buf = staging;
+    writing_staged = true;
   }
+  if(writing_buf != NULL){
+    memset(writing_buf, 0, frame_size);
+  }
+  frame->bitmap = writing_buf;
 }
 
 void ltr_int_publish_frames_cmd(void){
   ltr_int_log_message("Received request to publish frames\n");
-  publish_frames = true;
+  frames_requested_ts = ltr_int_get_ts_ns();
 }
 
 static int frame_callback(struct camera_control_block *ccb, struct frame_type *frame)
 {
   (void)ccb;
   ltr_int_update_pose(frame);
-  if(publish_frames){
-    publish_frame(frame);
-  }
+  publish_frame(frame);
   if(ltr_new_frame_cbk != NULL){
     ltr_new_frame_cbk(frame, ltr_new_frame_cbk_param);
   }
@@ -32,6 +32,9 @@ void ltr_int_publish_frames_cmd(void);
 linuxtrack_state_type ltr_notification_on(void);
 int ltr_get_notify_pipe(void);
 int ltr_wait(int timeout);
+int64_t ltr_get_time_ns(void);
+int ltr_get_pose_at(int64_t target_ns, linuxtrack_pose_t *pose, int64_t *age_ns);
+linuxtrack_state_type ltr_set_preview(int scale, int crop_margin, int max_fps);
 
 #ifdef __cplusplus
 }
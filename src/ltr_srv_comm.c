@@ -11,26 +11,166 @@
 #include <errno.h>
 #include <poll.h>
 #include <string.h>
+#include <stddef.h>
 
 #include "ltr_srv_comm.h"
+#include "ltr_srv_master.h"
 #include "ipc_utils.h"
 
+#include "utils.h"
+
 //==============Protocol dependent part==================
 
+//Peer protocol versions, indexed by socket (0 means not known => legacy)
+#define MAX_PEERS 1024
+static uint8_t peer_proto[MAX_PEERS];
+
+typedef struct{
+  uint64_t msgs;
+  uint64_t bytes;
+} comm_stat_t;
+
+//Last entry collects unknown commands
+static comm_stat_t tx_stats[CMD_COUNT + 1];
+static comm_stat_t rx_stats[CMD_COUNT + 1];
+
+static const char *cmd_names[CMD_COUNT + 1] = {"NOP", "NEW_SOCKET", "PAUSE", "WAKEUP", "RECENTER",
+                                               "POSE", "PARAM", "FRAMES", "unknown"};
+
+static void account(comm_stat_t *stats, uint32_t cmd, size_t bytes)
+{
+  if(cmd > CMD_COUNT){
+    cmd = CMD_COUNT;
+  }
+  __atomic_add_fetch(&(stats[cmd].msgs), 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&(stats[cmd].bytes), bytes, __ATOMIC_RELAXED);
+}
+
+void ltr_int_set_peer_proto(int socket, int version)
+{
+  if((socket >= 0) && (socket < MAX_PEERS)){
+    __atomic_store_n(&(peer_proto[socket]), (uint8_t)version, __ATOMIC_RELAXED);
+  }
+}
+
+int ltr_int_get_peer_proto(int socket)
+{
+  if((socket >= 0) && (socket < MAX_PEERS)){
+    int version = __atomic_load_n(&(peer_proto[socket]), __ATOMIC_RELAXED);
+    if(version > LTR_PROTO_LEGACY){
+      return version;
+    }
+  }
+  return LTR_PROTO_LEGACY;
+}
+
+void ltr_int_log_comm_stats(const char *who)
+{
+  int i;
+  for(i = 0; i <= CMD_COUNT; ++i){
+    if((tx_stats[i].msgs == 0) && (rx_stats[i].msgs == 0)){
+      continue;
+    }
+    ltr_int_log_message("%s: %-10s sent %llu msgs (%llu bytes), received %llu msgs (%llu bytes)\n",
+      who, cmd_names[i],
+      (unsigned long long)tx_stats[i].msgs, (unsigned long long)tx_stats[i].bytes,
+      (unsigned long long)rx_stats[i].msgs, (unsigned long long)rx_stats[i].bytes);
+  }
+}
+
+//The legacy layout must not change, old peers read it byte by byte
+typedef char legacy_msg_size_check[(sizeof(ltr_legacy_msg_t) == 508) ? 1 : -1];
+
+static int send_legacy(int socket, ltr_legacy_msg_t *msg)
+{
+  int res = ltr_int_socket_send(socket, msg, sizeof(ltr_legacy_msg_t));
+  if(res == 0){
+    account(tx_stats, msg->cmd, sizeof(ltr_legacy_msg_t));
+  }
+  return res;
+}
+
+static void pose_to_legacy(const linuxtrack_full_pose_t *pose, ltr_legacy_pose_t *legacy)
+{
+  legacy->prev_pose = pose->prev_pose;
+  legacy->pose = pose->pose;
+  legacy->prev_abs_pose = pose->prev_abs_pose;
+  legacy->abs_pose = pose->abs_pose;
+  legacy->blobs = pose->blobs;
+  memcpy(legacy->blob_list, pose->blob_list, sizeof(legacy->blob_list));
+  //Same wrapping us scale ltr_int_get_ts() used to produce
+  legacy->timestamp = (int32_t)((pose->timestamp / 1000) % (1024LL * 1000000));
+  legacy->prev_timestamp = (int32_t)((pose->prev_timestamp / 1000) % (1024LL * 1000000));
+}
+
+//Old timestamps can't be mapped onto our clock; the time of arrival is close enough
+static void pose_from_legacy(const ltr_legacy_pose_t *legacy, linuxtrack_full_pose_t *pose)
+{
+  pose->prev_pose = legacy->prev_pose;
+  pose->pose = legacy->pose;
+  pose->prev_abs_pose = legacy->prev_abs_pose;
+  pose->abs_pose = legacy->abs_pose;
+  pose->blobs = legacy->blobs;
+  memcpy(pose->blob_list, legacy->blob_list, sizeof(pose->blob_list));
+  pose->timestamp = ltr_int_get_ts_ns();
+  pose->prev_timestamp = pose->timestamp -
+    (int64_t)ltr_int_ts_diff(legacy->prev_timestamp, legacy->timestamp) * 1000;
+}
+
+static int send_compact(int socket, uint32_t cmd, uint32_t data, const void *payload, size_t len)
+{
+  uint64_t buf[(sizeof(ltr_wire_hdr_t) + sizeof(message_t)) / sizeof(uint64_t) + 1];
+  ltr_wire_hdr_t *hdr = (ltr_wire_hdr_t *)buf;
+  if(len > sizeof(message_t)){
+    return -EINVAL;
+  }
+  hdr->magic = LTR_WIRE_MAGIC;
+  hdr->version = LTR_PROTO_VERSION;
+  hdr->cmd = (uint8_t)cmd;
+  hdr->len = len;
+  hdr->data = data;
+  if(len > 0){
+    memcpy((uint8_t *)buf + sizeof(ltr_wire_hdr_t), payload, len);
+  }
+  int res = ltr_int_socket_send(socket, buf, sizeof(ltr_wire_hdr_t) + len);
+  if(res == 0){
+    account(tx_stats, cmd, sizeof(ltr_wire_hdr_t) + len);
+  }
+  return res;
+}
+
+static bool compact(int socket)
+{
+  return ltr_int_get_peer_proto(socket) >= LTR_PROTO_VERSION;
+}
+
 int ltr_int_send_message(int socket, uint32_t cmd, uint32_t data)
 {
-  message_t msg;
-  memset(&msg, 0, sizeof(message_t));
+  if(compact(socket)){
+    return send_compact(socket, cmd, data, NULL, 0);
+  }
+  ltr_legacy_msg_t msg;
+  memset(&msg, 0, sizeof(ltr_legacy_msg_t));
   msg.cmd = cmd;
   msg.data = data;
   msg.str[0] = '\0';
-  return ltr_int_socket_send(socket, &msg, sizeof(message_t));
+  return send_legacy(socket, &msg);
 }
 
 int ltr_int_send_message_w_str(int socket, uint32_t cmd, uint32_t data, char *str)
 {
-  message_t msg;
-  memset(&msg, 0, sizeof(message_t));
+  if(compact(socket)){
+    size_t len = 0;
+    char tmp[500];
+    if(str != NULL){
+      len = strnlen(str, sizeof(tmp) - 1);
+      memcpy(tmp, str, len);
+    }
+    tmp[len] = '\0';
+    return send_compact(socket, cmd, data, tmp, len + 1);
+  }
+  ltr_legacy_msg_t msg;
+  memset(&msg, 0, sizeof(ltr_legacy_msg_t));
   msg.cmd = cmd;
   msg.data = data;
   if(str != NULL){
@@ -41,28 +181,219 @@ int ltr_int_send_message_w_str(int socket, uint32_t cmd, uint32_t data, char *st
     msg.str[0] = '\0';
   }
   //printf("Sending string %s\n", msg.str);
-  return ltr_int_socket_send(socket, &msg, sizeof(message_t));
+  return send_legacy(socket, &msg);
+}
+
+int ltr_int_send_pose(int socket, const linuxtrack_full_pose_t *data, bool with_blobs)
+{
+  if(!compact(socket)){
+    ltr_legacy_msg_t msg;
+    memset(&msg, 0, sizeof(ltr_legacy_msg_t));
+    msg.cmd = CMD_POSE;
+    msg.data = 0;
+    pose_to_legacy(data, &msg.pose);
+    return send_legacy(socket, &msg);
+  }
+  uint64_t buf[(sizeof(ltr_wire_pose_t) + sizeof(data->blob_list)) / sizeof(uint64_t) + 1];
+  ltr_wire_pose_t *rec = (ltr_wire_pose_t *)buf;
+  size_t len = sizeof(ltr_wire_pose_t);
+  uint32_t flags = 0;
+  memset(rec, 0, sizeof(ltr_wire_pose_t));
+  rec->timestamp = data->timestamp;
+  rec->pose = data->pose;
+  rec->abs_pose = data->abs_pose;
+  rec->blobs = data->blobs;
+  if(with_blobs && (data->blobs > 0)){
+    uint32_t blobs = (data->blobs < MAX_BLOBS) ? data->blobs : MAX_BLOBS;
+    size_t blob_len = blobs * BLOB_ELEMENTS * sizeof(float);
+    memcpy((uint8_t *)buf + sizeof(ltr_wire_pose_t), data->blob_list, blob_len);
+    len += blob_len;
+    flags |= LTR_POSE_BLOBS;
+  }
+  return send_compact(socket, CMD_POSE, flags, buf, len);
 }
 
 int ltr_int_send_data(int socket, const linuxtrack_full_pose_t *data)
 {
-  message_t msg;
-  memset(&msg, 0, sizeof(message_t));
-  msg.cmd = CMD_POSE;
-  msg.data = 0;
-  msg.pose = *data;
-  return ltr_int_socket_send(socket, &msg, sizeof(message_t));
+  return ltr_int_send_pose(socket, data, true);
 }
 
 int ltr_int_send_param_update(int socket, uint32_t axis, uint32_t param, float value)
 {
-  message_t msg;
+  param_t p;
+  memset(&p, 0, sizeof(param_t));
+  p.axis_id = axis;
+  p.param_id = param;
+  p.flt_val = value;
+  if(compact(socket)){
+    return send_compact(socket, CMD_PARAM, 0, &p, sizeof(param_t));
+  }
+  ltr_legacy_msg_t msg;
+  memset(&msg, 0, sizeof(ltr_legacy_msg_t));
   msg.cmd = CMD_PARAM;
   msg.data = 0;
-  msg.param.axis_id = axis;
-  msg.param.param_id = param;
-  msg.param.flt_val = value;
-  return ltr_int_socket_send(socket, &msg, sizeof(message_t));
+  msg.param = p;
+  return send_legacy(socket, &msg);
+}
+
+// Reads exactly size bytes; the writer sends each message in a single write,
+//   so the rest of a started message is expected to arrive promptly.
+// Return value
+//   >0 - bytes read
+//    0 - connection closed
+//   <0 - -errno (-EWOULDBLOCK when there is nothing to read)
+static ssize_t read_exact(int socket, void *buf, size_t size)
+{
+  size_t total = 0;
+  while(total < size){
+    ssize_t res = read(socket, (uint8_t *)buf + total, size - total);
+    if(res > 0){
+      total += res;
+    }else if(res == 0){
+      return (total == 0) ? 0 : -EPROTO;
+    }else if(errno == EINTR){
+      continue;
+    }else if((errno == EAGAIN) || (errno == EWOULDBLOCK)){
+      if(total == 0){
+        return -EWOULDBLOCK;
+      }
+      struct pollfd pfd = {.fd = socket, .events = POLLIN, .revents = 0};
+      if(poll(&pfd, 1, 100) <= 0){
+        return -EPROTO;
+      }
+    }else{
+      int err = errno;
+      ltr_int_my_perror("read@recv_message");
+      return -err;
+    }
+  }
+  return total;
+}
+
+// Receives one message in either format, decoding it into msg.
+// Return value same as read_exact (number of bytes consumed on success).
+ssize_t ltr_int_recv_message(int socket, message_t *msg)
+{
+  ltr_wire_hdr_t hdr;
+  ssize_t res = read_exact(socket, &hdr, sizeof(ltr_wire_hdr_t));
+  if(res <= 0){
+    return res;
+  }
+  if(hdr.magic != LTR_WIRE_MAGIC){
+    //Legacy message, the header bytes are the start of ltr_legacy_msg_t
+    ltr_legacy_msg_t legacy;
+    memcpy(&legacy, &hdr, sizeof(ltr_wire_hdr_t));
+    res = read_exact(socket, (uint8_t *)&legacy + sizeof(ltr_wire_hdr_t),
+                     sizeof(ltr_legacy_msg_t) - sizeof(ltr_wire_hdr_t));
+    if(res <= 0){
+      return (res == 0) ? -EPROTO : res;
+    }
+    account(rx_stats, legacy.cmd, sizeof(ltr_legacy_msg_t));
+    msg->cmd = legacy.cmd;
+    msg->data = legacy.data;
+    if(legacy.cmd == CMD_POSE){
+      pose_from_legacy(&legacy.pose, &(msg->pose));
+    }else{
+      memcpy(msg->str, legacy.str, sizeof(msg->str));
+    }
+    return sizeof(ltr_legacy_msg_t);
+  }
+
+  uint64_t payload[sizeof(message_t) / sizeof(uint64_t) + 1];
+  if(hdr.len > sizeof(payload)){
+    ltr_int_log_message("Message too long (%u bytes)!\n", hdr.len);
+    return -EPROTO;
+  }
+  if(hdr.len > 0){
+    res = read_exact(socket, payload, hdr.len);
+    if(res <= 0){
+      return (res == 0) ? -EPROTO : res;
+    }
+  }
+  account(rx_stats, hdr.cmd, sizeof(ltr_wire_hdr_t) + hdr.len);
+  ltr_int_set_peer_proto(socket, hdr.version);
+
+  memset(msg, 0, offsetof(message_t, str));
+  msg->cmd = hdr.cmd;
+  msg->data = hdr.data;
+  switch(hdr.cmd){
+    case CMD_NEW_SOCKET:{
+        size_t len = (hdr.len < sizeof(msg->str)) ? hdr.len : sizeof(msg->str) - 1;
+        memcpy(msg->str, payload, len);
+        msg->str[len] = '\0';
+      }
+      break;
+    case CMD_POSE:{
+        ltr_wire_pose_t rec;
+        if(hdr.len < sizeof(ltr_wire_pose_t)){
+          return -EPROTO;
+        }
+        memcpy(&rec, payload, sizeof(ltr_wire_pose_t));
+        memset(&(msg->pose), 0, sizeof(linuxtrack_full_pose_t));
+        msg->pose.timestamp = rec.timestamp;
+        msg->pose.pose = rec.pose;
+        msg->pose.abs_pose = rec.abs_pose;
+        msg->pose.blobs = rec.blobs;
+        if(hdr.data & LTR_POSE_BLOBS){
+          size_t blob_len = hdr.len - sizeof(ltr_wire_pose_t);
+          if(blob_len > sizeof(msg->pose.blob_list)){
+            blob_len = sizeof(msg->pose.blob_list);
+          }
+          memcpy(msg->pose.blob_list, (uint8_t *)payload + sizeof(ltr_wire_pose_t), blob_len);
+        }
+      }
+      break;
+    case CMD_PARAM:
+      if(hdr.len < sizeof(param_t)){
+        return -EPROTO;
+      }
+      memcpy(&(msg->param), payload, sizeof(param_t));
+      break;
+    default:
+      msg->str[0] = '\0';
+      break;
+  }
+  return sizeof(ltr_wire_hdr_t) + hdr.len;
+}
+
+//Lock held by the gui while it acts as the master
+static semaphore_p pfSem = NULL;
+
+bool ltr_int_gui_lock(bool do_lock)
+{
+  static const char *lockName = "ltr_server.lock";
+
+  if(pfSem == NULL){
+    //just check...
+    switch(ltr_int_server_running_already(lockName, false, &pfSem, do_lock)){
+      case 0:
+        return true;
+        break;
+      case 1:
+        ltr_int_log_message("Gui server running!");
+        return false;
+        break;
+      default:
+        ltr_int_log_message("Error locking gui server lock!");
+        return false;
+        break;
+    }
+  }else{
+    if(do_lock){
+      return ltr_int_tryLockSemaphore(pfSem);
+    }else{
+      return ltr_int_testLockSemaphore(pfSem);
+    }
+  }
+}
+
+void ltr_int_gui_lock_clean()
+{
+  if(pfSem != NULL){
+    ltr_int_unlockSemaphore(pfSem);
+    ltr_int_closeSemaphore(pfSem);
+    pfSem= NULL;
+  }
 }
 
 const char *ltr_int_master_socket_name()
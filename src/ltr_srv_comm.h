@@ -16,6 +16,7 @@ typedef struct{
   };
 } param_t;
 
+//Decoded message, as handed to the receiver (never sent as is)
 typedef struct{
   uint32_t cmd;
   uint32_t data;
@@ -26,8 +27,73 @@ typedef struct{
   };
 } message_t;
 
+//Pose in the layout of the version 1 protocol; frozen, as old peers
+//  expect exactly this (int timestamps in us, see ltr_int_get_ts).
+typedef struct{
+  linuxtrack_pose_t prev_pose;
+  linuxtrack_pose_t pose;
+  linuxtrack_abs_pose_t prev_abs_pose;
+  linuxtrack_abs_pose_t abs_pose;
+  uint32_t blobs;
+  float blob_list[BLOB_ELEMENTS * MAX_BLOBS];
+  int32_t timestamp;
+  int32_t prev_timestamp;
+} ltr_legacy_pose_t;
+
+//Version 1 message, 508 bytes on the wire
+typedef struct{
+  uint32_t cmd;
+  uint32_t data;
+  union{
+    char str[500];
+    ltr_legacy_pose_t pose;
+    param_t param;
+  };
+} ltr_legacy_msg_t;
+
 enum cmds {CMD_NOP, CMD_NEW_SOCKET, CMD_PAUSE, CMD_WAKEUP, CMD_RECENTER, CMD_POSE, CMD_PARAM,
-           CMD_FRAMES};
+           CMD_FRAMES, CMD_COUNT};
+
+/*
+ * Wire protocol
+ *
+ * Version 1 (legacy) sends the whole ltr_legacy_msg_t (508 bytes) for every command.
+ *
+ * Version 2 sends a small header followed by len bytes of per-command payload:
+ *   CMD_NEW_SOCKET - profile name, including the terminating zero
+ *   CMD_POSE       - ltr_wire_pose_t, followed by blobs * BLOB_ELEMENTS floats
+ *                    when LTR_POSE_BLOBS is set in data
+ *   CMD_PARAM      - param_t
+ *   others         - no payload
+ *
+ * The magic can't clash with a legacy cmd, so the receiver tells the formats
+ *   apart by the first bytes. A connection starts as version 1; the slave
+ *   announces the version it speaks in the data field of its (legacy)
+ *   CMD_NEW_SOCKET and a version 2 master answers with a compact CMD_NOP.
+ *   Receiving a compact message switches the replies to that peer to compact
+ *   too, so old and new slaves/masters can be mixed freely.
+ */
+#define LTR_WIRE_MAGIC 0x4C54
+#define LTR_PROTO_LEGACY 1
+#define LTR_PROTO_VERSION 2
+
+//data flags of the CMD_POSE
+#define LTR_POSE_BLOBS 1
+
+typedef struct{
+  uint16_t magic;
+  uint8_t version;
+  uint8_t cmd;
+  uint32_t len;
+  uint32_t data;
+} ltr_wire_hdr_t;
+
+typedef struct{
+  int64_t timestamp __attribute__((aligned(8)));
+  linuxtrack_pose_t pose;
+  linuxtrack_abs_pose_t abs_pose;
+  uint32_t blobs;
+} ltr_wire_pose_t;
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,7 +102,12 @@ extern "C" {
 int ltr_int_send_message(int socket, uint32_t cmd, uint32_t data);
 int ltr_int_send_message_w_str(int socket, uint32_t cmd, uint32_t data, char *str);
 int ltr_int_send_data(int socket, const linuxtrack_full_pose_t *data);
+int ltr_int_send_pose(int socket, const linuxtrack_full_pose_t *data, bool with_blobs);
 int ltr_int_send_param_update(int socket, uint32_t axis, uint32_t param, float value);
+ssize_t ltr_int_recv_message(int socket, message_t *msg);
+void ltr_int_set_peer_proto(int socket, int version);
+int ltr_int_get_peer_proto(int socket);
+void ltr_int_log_comm_stats(const char *who);
 const char *ltr_int_master_socket_name();
 const char *ltr_int_slave_socket_name();
 int ltr_int_max_slave_sockets();
@@ -6,7 +6,8 @@
 #include "linuxtrack.h"
 #include <time.h>
 #include <sys/time.h>
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
@@ -16,14 +17,28 @@
 #include <utils.h>
 #include <axis.h>
 #include <pref.h>
+#include <pose_ring.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
 #include <map>
+#include <set>
 #include <string>
 
-static std::multimap<std::string, int> slaves;
-static semaphore_p pfSem = NULL;
+//Per connection state; the epoll events point directly to it
+struct ltr_client{
+  int fd;
+  bool slave;    //registered via CMD_NEW_SOCKET
+  bool legacy;   //doesn't read the pose ring, needs the poses through the socket
+  std::string profile;
+};
+
+typedef std::set<ltr_client*> client_set_t;
+
+//All guarded by send_mx
+static std::map<std::string, client_set_t> profiles; //profile -> its slaves
+static client_set_t slaves;
+static client_set_t legacy_slaves;
 
 static linuxtrack_full_pose_t current_pose;
 
@@ -31,63 +46,30 @@ static ltr_new_frame_callback_t new_frame_hook = NULL;
 static ltr_status_update_callback_t status_update_hook = NULL;
 static ltr_new_slave_callback_t new_slave_hook = NULL;
 
+static struct mmap_s ring_mmap;
+static struct ltr_pose_ring *ring = NULL;
+
 static bool save_prefs = true;
 static bool no_slaves = false;
 static pthread_mutex_t send_mx = PTHREAD_MUTEX_INITIALIZER;
 
 
-bool ltr_int_gui_lock(bool do_lock)
-{
-  static const char *lockName = "ltr_server.lock";
-
-  if(pfSem == NULL){
-    //just check...
-    switch(ltr_int_server_running_already(lockName, false, &pfSem, do_lock)){
-      case 0:
-        return true;
-        break;
-      case 1:
-        ltr_int_log_message("Gui server running!");
-        return false;
-        break;
-      default:
-        ltr_int_log_message("Error locking gui server lock!");
-        return false;
-        break;
-    }
-  }else{
-    if(do_lock){
-      return ltr_int_tryLockSemaphore(pfSem);
-    }else{
-      return ltr_int_testLockSemaphore(pfSem);
-    }
-  }
-}
-
-void ltr_int_gui_lock_clean()
-{
-  if(pfSem != NULL){
-    ltr_int_unlockSemaphore(pfSem);
-    ltr_int_closeSemaphore(pfSem);
-    pfSem= NULL;
-  }
-}
-
 void ltr_int_change(const char *profile, int axis, int elem, float val)
 {
   pthread_mutex_lock(&send_mx);
-  std::pair<std::multimap<std::string, int>::iterator, std::multimap<std::string, int>::iterator> range;
-  std::multimap<std::string, int>::iterator i;
+  client_set_t::iterator i;
   if(profile != NULL){
     //Finds all slaves belonging to the specific profile
-    range = slaves.equal_range(profile);
-    for(i = range.first; i != range.second; ++i){
-      ltr_int_send_param_update(i->second, axis, elem, val);
+    std::map<std::string, client_set_t>::iterator p = profiles.find(profile);
+    if(p != profiles.end()){
+      for(i = p->second.begin(); i != p->second.end(); ++i){
+        ltr_int_send_param_update((*i)->fd, axis, elem, val);
+      }
     }
   }else{
     //Broadcast to all slaves
     for(i = slaves.begin(); i != slaves.end(); ++i){
-      ltr_int_send_param_update(i->second, axis, elem, val);
+      ltr_int_send_param_update((*i)->fd, axis, elem, val);
     }
   }
   pthread_mutex_unlock(&send_mx);
@@ -105,28 +87,22 @@ void ltr_int_set_callback_hooks(ltr_new_frame_callback_t nfh, ltr_status_update_
   new_slave_hook = nsh;
 }
 
+//Poses go to the shared pose ring (one write regardless of the number
+//  of slaves); sockets carry just the control traffic. Only legacy slaves,
+//  that don't know about the ring, still get the poses through the socket.
+//  Both the tracking thread and the heartbeat publish; send_mx keeps the
+//  ring single writer.
 bool ltr_int_broadcast_pose(linuxtrack_full_pose_t &pose)
 {
   pthread_mutex_lock(&send_mx);
-  std::multimap<std::string, int>::iterator i;
-  int res;
-  bool checkSlaves = false;
-  //Send updated pose to all clients
-  //printf("Master: %g  %g  %g\n", pose.pose.raw_pitch, pose.pose.raw_yaw, pose.pose.raw_roll);
-  for(i = slaves.begin(); i != slaves.end();){
-    res = ltr_int_send_data(i->second, &pose);
-    if(res == -EPIPE){
-      ltr_int_log_message("Slave @socket %d left!\n", i->second);
-      close(i->second);
-      i->second = -1;
-      slaves.erase(i++);
-      checkSlaves = true;
-    }else{
-      ++i;
-    }
+  if(ring == NULL){
+    pthread_mutex_unlock(&send_mx);
+    return false;
   }
-  if(checkSlaves && (slaves.size() == 0)){
-    no_slaves = true;
+  ltr_int_pose_ring_publish(ring, &pose);
+  client_set_t::iterator i;
+  for(i = legacy_slaves.begin(); i != legacy_slaves.end(); ++i){
+    ltr_int_send_data((*i)->fd, &pose);
   }
   pthread_mutex_unlock(&send_mx);
   return true;
@@ -158,12 +134,28 @@ static void ltr_int_state_changed(void *param)
   ltr_int_broadcast_pose(current_pose);
 }
 
-bool ltr_int_register_slave(int socket, message_t &msg)
+static bool ltr_int_register_slave(ltr_client *client, message_t &msg)
 {
   ltr_int_log_message("Trying to register slave!\n");
   pthread_mutex_lock(&send_mx);
-  slaves.insert(std::pair<std::string, int>(msg.str, socket));
-  ltr_int_log_message("Slave with profile '%s' @socket %d registered!\n", msg.str, socket);
+  if(client->slave){
+    ltr_int_log_message("Slave @socket %d already registered!\n", client->fd);
+    pthread_mutex_unlock(&send_mx);
+    return false;
+  }
+  //Slave announces the protocol it speaks, confirm we do too
+  client->legacy = (msg.data < LTR_PROTO_VERSION);
+  if(!client->legacy){
+    ltr_int_set_peer_proto(client->fd, LTR_PROTO_VERSION);
+    ltr_int_send_message(client->fd, CMD_NOP, LTR_PROTO_VERSION);
+  }else{
+    legacy_slaves.insert(client);
+  }
+  client->slave = true;
+  client->profile = msg.str;
+  profiles[client->profile].insert(client);
+  slaves.insert(client);
+  ltr_int_log_message("Slave with profile '%s' @socket %d registered!\n", msg.str, client->fd);
   pthread_mutex_unlock(&send_mx);
 
   //Make sure the new section is created if needed...
@@ -215,180 +207,214 @@ size_t ltr_int_request_shutdown()
 
 
 
-struct pollfd *descs = NULL;
-size_t max_len = 0;
-size_t current_len = 0;
-nfds_t numfd = 0;
+//Housekeeping period of the main loop
+static const int c_TICK_MS = 1000;
+//When paused, slaves get a fresh (paused) pose every so many ticks
+static const int c_HEARTBEAT_TICKS = 10;
+
+//Tags of the non-client descriptors in the epoll set
+static int listen_tag;
+static int timer_tag;
+
+//All the connections, owned by the main loop
+static client_set_t clients;
 
-bool add_poll_desc(int fd){
+static bool epoll_add(int epfd, int fd, void *ptr)
+{
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = ptr;
+  if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0){
+    ltr_int_my_perror("epoll_ctl");
+    return false;
+  }
+  return true;
+}
+
+static void ltr_int_add_client(int epfd, int fd)
+{
   ltr_int_log_message("Adding fd %d\n", fd);
-  if(current_len >= max_len){
-    if(max_len > 0){
-      max_len *= 2;
-      descs = (struct pollfd*)realloc(descs, max_len * sizeof(struct pollfd));
-      if(descs){
-        memset(descs + current_len, 0,
-               (max_len - current_len) * sizeof(struct pollfd));//???
-      }
-    }else{
-      max_len = 1;
-      descs = (struct pollfd*)malloc(max_len * sizeof(struct pollfd));
-      if(descs){
-        memset(descs, 0, max_len * sizeof(struct pollfd));
+  ltr_client *client = new ltr_client;
+  client->fd = fd;
+  client->slave = false;
+  client->legacy = true;
+  ltr_int_set_peer_proto(fd, LTR_PROTO_LEGACY);
+  if(!epoll_add(epfd, fd, client)){
+    close(fd);
+    delete client;
+    return;
+  }
+  clients.insert(client);
+}
+
+static void ltr_int_remove_client(int epfd, ltr_client *client)
+{
+  ltr_int_log_message("Removing fd %d\n", client->fd);
+  epoll_ctl(epfd, EPOLL_CTL_DEL, client->fd, NULL);
+  pthread_mutex_lock(&send_mx);
+  if(client->slave){
+    ltr_int_log_message("Slave @socket %d left!\n", client->fd);
+    std::map<std::string, client_set_t>::iterator p = profiles.find(client->profile);
+    if(p != profiles.end()){
+      p->second.erase(client);
+      if(p->second.empty()){
+        profiles.erase(p);
       }
     }
-    if(descs == NULL){
-      ltr_int_my_perror("m/re-alloc");
-      ltr_int_log_message("Can't alloc enough memory for the poll!\n");
-      exit(1);
+    slaves.erase(client);
+    legacy_slaves.erase(client);
+    if(slaves.empty()){
+      no_slaves = true;
     }
   }
-  descs[current_len].fd = fd;
-  descs[current_len].events = POLLIN;
-  descs[current_len].revents = 0;
-  ++current_len;
-  return true;
+  pthread_mutex_unlock(&send_mx);
+  clients.erase(client);
+  ltr_int_set_peer_proto(client->fd, LTR_PROTO_LEGACY);
+  close(client->fd);
+  delete client;
 }
 
-void print_descs(void)
+static void ltr_int_accept_clients(int epfd, int socket)
 {
-  nfds_t i;
-  for(i = 0; i < current_len; ++i){
-    ltr_int_log_message("%ld: fd=%d, ev=%d, rev=%d\n", (long int)i, 
-      descs[i].fd, descs[i].events, descs[i].revents);
+  struct sockaddr_un address;
+  socklen_t address_len = sizeof(address);
+  int new_fd;
+  while(1){
+    new_fd = accept(socket, (struct sockaddr*)&address, &address_len);
+    if(new_fd < 0){
+      if(errno != EWOULDBLOCK){
+        ltr_int_my_perror("accept");
+      }
+      //No more connection requests
+      break;
+    }
+    ltr_int_add_client(epfd, new_fd);
   }
 }
 
-bool remove_poll_desc(){
-  nfds_t i;
-  //ltr_int_log_message("Watched descriptors before garbage collection.\n");
-  //print_descs();
-  for(i = 0; i < current_len; ++i){
-    if(descs[i].revents & POLLHUP){
-      ltr_int_log_message("Removing hanged fd %d\n", descs[i].fd);
-      if(i < (current_len - 1)){
-        descs[i] = descs[current_len - 1];
-      }else{
-        //last fd, just decrement current_len
-        // Intentionaly empty
+static void ltr_int_client_event(int epfd, ltr_client *client, uint32_t events)
+{
+  if(events & EPOLLIN){
+    message_t msg;
+    msg.cmd = CMD_NOP;
+    ssize_t x = ltr_int_recv_message(client->fd, &msg);
+    if(x < 0){
+      if(x != -EWOULDBLOCK){
+        ltr_int_log_message("Unexpected error %d reading from fd %d.\n", x, client->fd);
+        ltr_int_remove_client(epfd, client);
+        return;
+      }
+    }else if(x == 0){
+      //EOF - the other side is gone
+      ltr_int_log_message("Connection closed at fd %d\n", client->fd);
+      ltr_int_remove_client(epfd, client);
+      return;
+    }else{
+      //ltr_int_log_message("Received a message from slave (%d)!!!\n", msg.cmd);
+      switch(msg.cmd){
+        case CMD_PAUSE:
+          ltr_int_suspend_cmd();
+          break;
+        case CMD_WAKEUP:
+          ltr_int_wakeup_cmd();
+          break;
+        case CMD_RECENTER:
+          ltr_int_recenter_cmd();
+          break;
+        case CMD_NEW_SOCKET:
+          ltr_int_register_slave(client, msg);
+          break;
+        case CMD_FRAMES:
+          ltr_int_publish_frames_cmd();
+          break;
       }
-      --current_len;
     }
   }
-  //ltr_int_log_message("Watched descriptors after garbage collection.\n");
-  //print_descs();
-  return true;
+  if(events & (EPOLLHUP | EPOLLERR)){
+    ltr_int_log_message("Hangup at fd %d\n", client->fd);
+    ltr_int_remove_client(epfd, client);
+  }
 }
 
+static void ltr_int_heartbeat(int timer, int *ticks)
+{
+  uint64_t expirations = 0;
+  if(read(timer, &expirations, sizeof(expirations)) != sizeof(expirations)){
+    return;
+  }
+  if(ltr_int_get_tracking_state() != PAUSED){
+    *ticks = 0;
+    return;
+  }
+  *ticks += expirations;
+  if(*ticks >= c_HEARTBEAT_TICKS){
+    linuxtrack_full_pose_t dummy;
+    memset(&dummy, 0, sizeof(dummy));
+    dummy.pose.status = PAUSED;
+    dummy.timestamp = ltr_int_get_ts_ns();
+    ltr_int_broadcast_pose(dummy);
+    *ticks = 0;
+  }
+}
 
 int ltr_int_master_main_loop(int socket)
 {
-  int res;
-  int new_fd;
-  bool close_conn;
+  const int max_events = 16;
+  struct epoll_event events[max_events];
   int heartbeat = 0;
-  nfds_t i;
+  int res;
+  int i;
   no_slaves = false;
 
-  struct sockaddr_un address;
-  socklen_t address_len = sizeof(address);
-  add_poll_desc(socket);
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(epfd < 0){
+    ltr_int_my_perror("epoll_create1");
+    return -1;
+  }
+  //Wakes the loop periodically to check for the shutdown and send heartbeats
+  int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if(timer < 0){
+    ltr_int_my_perror("timerfd_create");
+    close(epfd);
+    return -1;
+  }
+  struct itimerspec tick;
+  tick.it_interval.tv_sec = c_TICK_MS / 1000;
+  tick.it_interval.tv_nsec = (c_TICK_MS % 1000) * 1000000;
+  tick.it_value = tick.it_interval;
+  timerfd_settime(timer, 0, &tick, NULL);
+  epoll_add(epfd, socket, &listen_tag);
+  epoll_add(epfd, timer, &timer_tag);
+
   while(1){
     if(gui_shutdown_request || (!ltr_int_gui_lock(false)) ||
        no_slaves || (ltr_int_get_tracking_state() < LINUXTRACK_OK)){
       break;
     }
-
-    close_conn = false;
-    for(i = 0; i < current_len; ++i){
-      descs[i].revents = 0;
-    }
-    res = poll(descs, current_len, 2000);
+    res = epoll_wait(epfd, events, max_events, -1);
     if(res < 0){
-      ltr_int_my_perror("poll");
-      continue;
-    }else if(res == 0){
-      if(ltr_int_get_tracking_state() == PAUSED){
-        ++heartbeat;
-        if(heartbeat > 5){
-          linuxtrack_full_pose_t dummy;
-          dummy.pose.pitch = 0.0; dummy.pose.yaw = 0.0; dummy.pose.roll = 0.0;
-          dummy.pose.tx = 0.0; dummy.pose.ty = 0.0; dummy.pose.tz = 0.0;
-          dummy.pose.counter = 0; dummy.pose.status = PAUSED; dummy.blobs = 0;
-          ltr_int_broadcast_pose(dummy);
-          heartbeat = 0;
-        }
-      }else{
-        heartbeat = 0;
+      if(errno != EINTR){
+        ltr_int_my_perror("epoll_wait");
       }
       continue;
     }
-    for(i = 0; i < current_len; ++i){
-      if(descs[i].revents == 0){
-        continue;
-      }
-      if(descs[i].revents){
-        if(descs[i].revents & POLLIN){
-          if(descs[i].fd == socket){
-            do{
-              new_fd = accept(socket, (struct sockaddr*)&address, &address_len);
-              if(new_fd < 0){
-                if(errno != EWOULDBLOCK){
-                  ltr_int_my_perror("accept");
-                }
-                //No more connection requests
-                break;
-              }else{
-                add_poll_desc(new_fd);
-              }
-            }while(new_fd >= 0);
-          }else{
-            message_t msg;
-            msg.cmd = CMD_NOP;
-            ssize_t x = ltr_int_socket_receive(descs[i].fd, &msg, sizeof(message_t));
-            //ltr_int_log_message("Read %d bytes from fd %d.\n", (int)x, descs[i].fd);
-            if(x < 0){
-              if(x != -EWOULDBLOCK){
-                ltr_int_log_message("Unexpected error %d reading from fd %d.\n", x, descs[i].fd);
-                close_conn = true;
-                descs[i].fd = -1;
-              }
-            }else if(x == 0){
-              //close_conn = true;
-              //descs[i].fd = -1;
-            }else{
-              //ltr_int_log_message("Received a message from slave (%d)!!!\n", msg.cmd);
-              switch(msg.cmd){
-                case CMD_PAUSE:
-                  ltr_int_suspend_cmd();
-                  break;
-                case CMD_WAKEUP:
-                  ltr_int_wakeup_cmd();
-                  break;
-                case CMD_RECENTER:
-                  ltr_int_recenter_cmd();
-                  break;
-                case CMD_NEW_SOCKET:
-                  //ltr_int_log_message("Cmd to register new slave...\n");
-                  ltr_int_register_slave(descs[i].fd, msg);
-                  break;
-                case CMD_FRAMES:
-                  ltr_int_publish_frames_cmd();
-                  break;
-              }
-            }
-          }
-        }
-        if(descs[i].revents & POLLHUP){
-          ltr_int_log_message("Hangup at fd %d\n", descs[i].fd);
-          close_conn = true;
-        }
+    for(i = 0; i < res; ++i){
+      void *ptr = events[i].data.ptr;
+      if(ptr == &listen_tag){
+        ltr_int_accept_clients(epfd, socket);
+      }else if(ptr == &timer_tag){
+        ltr_int_heartbeat(timer, &heartbeat);
+      }else{
+        ltr_int_client_event(epfd, (ltr_client *)ptr, events[i].events);
       }
     }
-    if(close_conn){
-      remove_poll_desc();
-    }
   }
+  while(!clients.empty()){
+    ltr_int_remove_client(epfd, *(clients.begin()));
+  }
+  close(timer);
+  close(epfd);
   return 0;
 }
 
@@ -446,8 +472,17 @@ bool ltr_int_master(bool standalone)
     return true;
   }
   ltr_int_log_message("Starting as master!\n");
+  if(!ltr_int_pose_ring_create(&ring_mmap)){
+    ltr_int_log_message("Closing socket %d\n", socket);
+    close(socket);
+    unlink(ltr_int_master_socket_name());
+    return false;
+  }
+  ring = (struct ltr_pose_ring *)ring_mmap.data;
   if(ltr_int_init() != 0){
     ltr_int_log_message("Could not initialize tracking!\n");
+    ring = NULL;
+    ltr_int_pose_ring_close(&ring_mmap);
     ltr_int_log_message("Closing socket %d\n", socket);
     close(socket);
     unlink(ltr_int_master_socket_name());
@@ -458,6 +493,7 @@ bool ltr_int_master(bool standalone)
 
   ltr_int_master_main_loop(socket);
 
+  ltr_int_log_comm_stats("Master");
   ltr_int_log_message("Shutting down tracking!\n");
   ltr_int_shutdown();
   ltr_int_log_message("Master closing socket %d\n", socket);
@@ -470,6 +506,10 @@ bool ltr_int_master(bool standalone)
     ltr_int_log_message("Tracker not stopped yet, waiting for the stop...\n");
     sleep(1);
   }
+  pthread_mutex_lock(&send_mx);
+  ring = NULL;
+  pthread_mutex_unlock(&send_mx);
+  ltr_int_pose_ring_close(&ring_mmap);
   ltr_int_gui_lock_clean();
   if(standalone){
     ltr_int_free_prefs();
@@ -7,16 +7,19 @@
 #include <fcntl.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <errno.h>
 #include <ipc_utils.h>
 #include <ltlib.h>
 #include <utils.h>
 #include <tracking.h>
 #include <pref.h>
 #include <pref_global.h>
+#include <pose_ring.h>
 
 static struct mmap_s mmm;
 static int master_uplink = -1;
 static pthread_t reader_tid;
+static pthread_t pose_tid;
 static char *profile_name = NULL;
 static ltr_axes_t axes;
 static bool master_works = false;
@@ -24,11 +27,18 @@ static const int master_retries = 3;
 static pid_t ppid = 0;
 static int notify_pipe = -1;
 static bool notify = false;
+//Running as a thread inside of the client (see ltr_int_slave_direct_start)
+static bool direct = false;
+static pthread_t direct_tid;
 
 typedef enum {MR_OK, MR_FAIL, MR_OFTEN} mr_res_t;
 
 static bool parent_alive()
 {
+  if(direct){
+    //We live inside the client, it stops us explicitly
+    return true;
+  }
   //Check whether parent lives
   //  (if not, we got orphaned and got adopted by init)
   return (getppid() == ppid);
@@ -65,10 +75,13 @@ static bool start_master()
 
     char *args[] = {"srv", NULL};
     args[0] = ltr_int_get_app_path("/ltr_server1");
-    ltr_int_fork_child(args, &is_child);
-    int status;
+    if(!ltr_int_fork_child(args, &is_child) && is_child){
+      //Don't run the client's atexit handlers nor flush its stdio buffers
+      _exit(1);
+    }
     //Disable the wait when not daemonizing master!!!
-    wait(&status);
+    //  (waits just for our child, we might live in a client with its own children)
+    ltr_int_wait_child_exit(50);
     //At this point master is either running or exited (depending on the state of socket)
     free(args[0]);
   }
@@ -90,7 +103,10 @@ static bool open_master_comms(int *l_master_uplink)
 
   ltr_int_log_message("Master comms opened => u -> %d\n", *l_master_uplink);
 
-  if(ltr_int_send_message_w_str(*l_master_uplink, CMD_NEW_SOCKET, 0, profile_name) != 0){
+  //Registration goes in the legacy format, announcing the protocol we speak;
+  //  master confirms by switching to the compact one
+  ltr_int_set_peer_proto(*l_master_uplink, LTR_PROTO_LEGACY);
+  if(ltr_int_send_message_w_str(*l_master_uplink, CMD_NEW_SOCKET, LTR_PROTO_VERSION, profile_name) != 0){
     ltr_int_log_message("Master uplink doesn't seem to be working!\n");
     return false;
   }
@@ -124,13 +140,69 @@ static bool ltr_int_try_start_master(int *l_master_uplink)
 
 static linuxtrack_pose_t prev_filtered_pose;
 
-static bool ltr_int_process_message(int l_master_uplink)
+static void ltr_int_add_history(struct ltr_comm *com, const linuxtrack_full_pose_t *pose)
+{
+  ltr_pose_sample_t *sample = &(com->history[com->history_count % POSE_HISTORY]);
+  sample->timestamp = pose->timestamp;
+  sample->val[0] = pose->pose.pitch;
+  sample->val[1] = pose->pose.yaw;
+  sample->val[2] = pose->pose.roll;
+  sample->val[3] = pose->pose.tx;
+  sample->val[4] = pose->pose.ty;
+  sample->val[5] = pose->pose.tz;
+  sample->val[6] = pose->abs_pose.abs_pitch;
+  sample->val[7] = pose->abs_pose.abs_yaw;
+  sample->val[8] = pose->abs_pose.abs_roll;
+  sample->val[9] = pose->abs_pose.abs_tx;
+  sample->val[10] = pose->abs_pose.abs_ty;
+  sample->val[11] = pose->abs_pose.abs_tz;
+  ++(com->history_count);
+}
+
+//Poses normally come from the pose thread only, but legacy master sends them
+//  through the socket; keep the writer of the shared segment single anyway.
+static pthread_mutex_t pose_mx = PTHREAD_MUTEX_INITIALIZER;
+
+static void ltr_int_process_pose(linuxtrack_full_pose_t *pose)
 {
-  message_t msg;
   struct ltr_comm *com;
   linuxtrack_pose_t unfiltered;
-  ssize_t bytesRead = ltr_int_socket_receive(l_master_uplink, &msg, sizeof(message_t));
-  if(bytesRead < 0){
+  pthread_mutex_lock(&pose_mx);
+  ltr_int_postprocess_axes(axes, &(pose->pose), &unfiltered, pose->timestamp);
+
+  com = mmm.data;
+  //Readers don't lock, they retry when data_seq changed under their hands
+  ltr_int_seqlock_write_begin(&(com->data_seq));
+  if(pose->pose.status == RUNNING){
+    com->full_pose = *pose;
+    com->full_pose.prev_pose = prev_filtered_pose;
+    prev_filtered_pose = pose->pose;
+    ltr_int_add_history(com, pose);
+  }else{
+    com->history_count = 0;
+  }
+  com->state = pose->pose.status;
+  com->preparing_start = false;
+  ltr_int_seqlock_write_end(&(com->data_seq));
+  __atomic_add_fetch(&(com->pose_seq), 1, __ATOMIC_SEQ_CST);
+  ltr_int_seq_wake(&(com->pose_seq), &(com->pose_waiters));
+  pthread_mutex_unlock(&pose_mx);
+  //The pipe is kept for clients polling linuxtrack_get_notify_pipe()
+  if(notify && (notify_pipe > 0)){
+    uint8_t tmp = 0;
+    if(write(notify_pipe, &tmp, 1) < 0){
+      //Don't report, it would overfill logs
+    }
+  }
+}
+
+static bool ltr_int_process_message(int l_master_uplink)
+{
+  message_t msg;
+  ssize_t bytesRead = ltr_int_recv_message(l_master_uplink, &msg);
+  if(bytesRead == -EWOULDBLOCK){
+    return true;
+  }else if(bytesRead < 0){
     ltr_int_log_message("Slave reader problem!\n");
     ltr_int_my_perror("socket_receive");
     return false;
@@ -142,31 +214,8 @@ static bool ltr_int_process_message(int l_master_uplink)
     case CMD_NOP:
       break;
     case CMD_POSE:
-      //printf("Have new pose!\n");
-      //printf(">>>>%f %f %f\n", msg.pose.raw_yaw, msg.pose.raw_pitch, msg.pose.raw_tz);
-      ltr_int_postprocess_axes(axes, &(msg.pose.pose), &unfiltered);
-      //printf(">>>>%f %f %f\n", msg.pose.yaw, msg.pose.pitch, msg.pose.tz);
-      //printf("Raw center: %f  %f  %f\n", msg.pose.pose.raw_tx, msg.pose.pose.raw_ty, msg.pose.pose.raw_tz);
-      //printf("Raw angles: %f  %f  %f\n", msg.pose.pose.raw_pitch, msg.pose.pose.raw_yaw, msg.pose.pose.raw_roll);
-
-      com = mmm.data;
-      ltr_int_lockSemaphore(mmm.sem);
-      //printf("STATUS: %d\n", msg.pose.status);
-      if(msg.pose.pose.status == RUNNING){
-        //printf("PASSING TO SHM: %f %f %f\n", msg.pose.yaw, msg.pose.pitch, msg.pose.tz);
-        com->full_pose = msg.pose;
-        com->full_pose.prev_pose = prev_filtered_pose;
-        prev_filtered_pose = msg.pose.pose;
-      }
-      com->state = msg.pose.pose.status;
-      com->preparing_start = false;
-      ltr_int_unlockSemaphore(mmm.sem);
-      if(notify && (notify_pipe > 0)){
-        uint8_t tmp = 0;
-        if(write(notify_pipe, &tmp, 1) < 0){
-          //Don't report, it would overfill logs
-        }
-      }
+      //Poses normally come through the pose ring, kept for compatibility
+      ltr_int_process_pose(&(msg.pose));
       break;
     case CMD_PARAM:
       //printf("Changing %s of %s to %f!!!\n", ltr_int_axis_param_get_desc(msg.param.param_id),
@@ -185,6 +234,9 @@ static bool ltr_int_process_message(int l_master_uplink)
           case MISC_FOCAL_LENGTH:
             ltr_int_set_focal_length(msg.param.flt_val);
             break;
+          case MISC_FILTER_TYPE:
+            ltr_int_set_filter_type(axes, (ltr_filter_type_t)msg.param.flt_val);
+            break;
           default:
             ltr_int_log_message("Wrong misc param: %d\n", msg.param.param_id);
             return false;
@@ -260,20 +312,74 @@ static void *ltr_int_slave_reader_thread(void *param)
 }
 
 
+//Picks the poses from the master's pose ring
+static void *ltr_int_slave_pose_thread(void *param)
+{
+  (void) param;
+  struct mmap_s ring_mmap;
+  struct ltr_pose_ring *ring = NULL;
+  linuxtrack_full_pose_t pose;
+  uint32_t last_seq = 0;
+  uint32_t seq;
+  while(!quit_flag && parent_alive()){
+    if(ring == NULL){
+      if(!ltr_int_pose_ring_attach(&ring_mmap)){
+        //Master is not up yet
+        usleep(100000);
+        continue;
+      }
+      ring = (struct ltr_pose_ring *)ring_mmap.data;
+      last_seq = ltr_int_pose_ring_seq(ring);
+    }
+    if(ltr_int_pose_ring_wait(ring, last_seq, 1000) == 0){
+      //A restarted master normally reuses the ring, but the file might be gone
+      if(!ltr_int_pose_ring_current(&ring_mmap)){
+        ltr_int_log_message("Pose ring replaced, reattaching.\n");
+        ltr_int_pose_ring_close(&ring_mmap);
+        ring = NULL;
+      }
+      continue;
+    }
+    //Any change of seq means new data (it goes back to 0 when master restarts)
+    if(ltr_int_pose_ring_read(ring, &seq, &pose)){
+      last_seq = seq;
+      ltr_int_process_pose(&pose);
+    }else{
+      last_seq = ltr_int_pose_ring_seq(ring);
+    }
+  }
+  if(ring != NULL){
+    ltr_int_pose_ring_close(&ring_mmap);
+  }
+  return NULL;
+}
+
+//Logs how long the client's request took to reach the master
+static void ltr_int_log_cmd_latency(const char *what, int64_t cmd_ts)
+{
+  if(cmd_ts > 0){
+    ltr_int_log_message("%s delivered to master %lld us after the request\n", what,
+                        (long long)((ltr_int_get_ts_ns() - cmd_ts) / 1000));
+  }
+}
+
 static void ltr_int_slave_main_loop()
 {
   //Prepare to process client requests
   struct ltr_comm *com = mmm.data;
   ltr_cmd cmd = NOP_CMD;
   bool recenter = false;
+  int64_t cmd_ts = 0;
+  uint32_t cmd_seq = __atomic_load_n(&(com->cmd_seq), __ATOMIC_ACQUIRE);
   while(!quit_flag){
     if((com->cmd != NOP_CMD) || com->recenter || com->notify){
       ltr_int_lockSemaphore(mmm.sem);
       cmd = (ltr_cmd)com->cmd;
       com->cmd = NOP_CMD;
-      recenter = com->recenter;
+      recenter = recenter || com->recenter;
       notify = com->notify;
       com->recenter = false;
+      cmd_ts = com->cmd_ts;
       ltr_int_unlockSemaphore(mmm.sem);
     }
     int res = 0;
@@ -299,6 +405,8 @@ static void ltr_int_slave_main_loop()
       }
       if(res < 0){
         usleep(100000);
+      }else if((cmd != NOP_CMD) && (cmd != STOP_CMD)){
+        ltr_int_log_cmd_latency("Command", cmd_ts);
       }
       if(!parent_alive()){
         //printf("Parent %lu died! (3)\n", (unsigned long)ppid);
@@ -311,35 +419,26 @@ static void ltr_int_slave_main_loop()
       if(ltr_int_send_message(master_uplink, CMD_RECENTER, 0) >= 0){
         //clear request only on successfull transmission
         recenter = false;
+        ltr_int_log_cmd_latency("Recenter", cmd_ts);
       }
     }
     if(!parent_alive()){
       //printf("Parent %lu died! (3)\n", (unsigned long)ppid);
       break;
     }
-    usleep(100000);
+    if(quit_flag){
+      break;
+    }
+    //Sleep until the client rings; the timeout keeps the parent check
+    //  and the retry of a failed recenter going
+    ltr_int_seq_wait(&(com->cmd_seq), &(com->cmd_waiters), cmd_seq, 100);
+    cmd_seq = __atomic_load_n(&(com->cmd_seq), __ATOMIC_ACQUIRE);
   }
 }
 
-//main slave function
-
-bool ltr_int_slave(const char *c_profile, const char *c_com_file, const char *ppid_str,
-                   const char *close_pipe_str, const char *notify_pipe_str)
+static bool ltr_int_slave_init(const char *c_profile, const char *c_com_file)
 {
-  unsigned long tmp_ppid;
   profile_name = ltr_int_my_strdup(c_profile);
-  sscanf(ppid_str, "%lu", &tmp_ppid);
-  int tmp_pipe = -1;
-  sscanf(close_pipe_str, "%d", &tmp_pipe);
-  if(tmp_pipe > 0){
-    close(tmp_pipe);
-  }
-  sscanf(notify_pipe_str, "%d", &notify_pipe);
-  if(notify_pipe > 0){
-    fcntl(notify_pipe, F_SETFL, fcntl(notify_pipe, F_GETFL) | O_NONBLOCK);
-  }
-  //printf("Going to monitor parent %lu!\n", tmp_ppid);
-  ppid = (pid_t)tmp_ppid;
   if(!ltr_int_read_prefs(NULL, false)){
     ltr_int_log_message("Couldn't load preferences!\n");
     return false;
@@ -349,24 +448,113 @@ bool ltr_int_slave(const char *c_profile, const char *c_com_file, const char *pp
   char *com_file = ltr_int_my_strdup(c_com_file);
   if(!ltr_int_mmap_file(com_file, sizeof(struct ltr_comm), &mmm)){
     ltr_int_log_message("Couldn't mmap file!!!\n");
+    free(com_file);
     return false;
   }
   free(com_file);
+  return true;
+}
 
+static void ltr_int_slave_run()
+{
   quit_flag = false;
   if(pthread_create(&reader_tid, NULL, ltr_int_slave_reader_thread, NULL) == 0){
+    bool have_pose_thread =
+      (pthread_create(&pose_tid, NULL, ltr_int_slave_pose_thread, NULL) == 0);
     ltr_int_slave_main_loop();
     pthread_join(reader_tid, NULL);
+    if(have_pose_thread){
+      pthread_join(pose_tid, NULL);
+    }
   }
+  ltr_int_log_comm_stats("Slave");
   close_master_comms(&master_uplink);
   ltr_int_unmap_file(&mmm);
   //finish prefs
   ltr_int_close_axes(&axes);
   ltr_int_free_prefs();
   free(profile_name);
+  profile_name = NULL;
   ltr_int_gui_lock_clean();
   close(notify_pipe);
+  notify_pipe = -1;
+}
+
+//main slave function
+
+bool ltr_int_slave(const char *c_profile, const char *c_com_file, const char *ppid_str,
+                   const char *close_pipe_str, const char *notify_pipe_str)
+{
+  unsigned long tmp_ppid;
+  sscanf(ppid_str, "%lu", &tmp_ppid);
+  int tmp_pipe = -1;
+  sscanf(close_pipe_str, "%d", &tmp_pipe);
+  if(tmp_pipe > 0){
+    close(tmp_pipe);
+  }
+  sscanf(notify_pipe_str, "%d", &notify_pipe);
+  if(notify_pipe > 0){
+    fcntl(notify_pipe, F_SETFL, fcntl(notify_pipe, F_GETFL) | O_NONBLOCK);
+  }
+  //printf("Going to monitor parent %lu!\n", tmp_ppid);
+  ppid = (pid_t)tmp_ppid;
+  if(!ltr_int_slave_init(c_profile, c_com_file)){
+    return false;
+  }
+  ltr_int_slave_run();
   return true;
 }
 
+static void *ltr_int_slave_direct_thread(void *param)
+{
+  (void) param;
+  ltr_int_slave_run();
+  return NULL;
+}
 
+/*
+ * Direct mode - the slave runs as threads of the client process (loaded
+ *   together with libltr by liblinuxtrack), so the poses go straight from
+ *   the master's pose ring through the axes postprocessing to the client's
+ *   segment, without another process in between.
+ */
+bool ltr_int_slave_direct_start(const char *c_profile, const char *c_com_file, int notify_fd)
+{
+  if(direct){
+    ltr_int_log_message("Direct slave already running!\n");
+    return false;
+  }
+  ppid = getppid();
+  notify_pipe = notify_fd;
+  if(notify_pipe > 0){
+    fcntl(notify_pipe, F_SETFL, fcntl(notify_pipe, F_GETFL) | O_NONBLOCK);
+  }
+  if(!ltr_int_slave_init(c_profile, c_com_file)){
+    notify_pipe = -1;
+    return false;
+  }
+  direct = true;
+  quit_flag = false;
+  if(pthread_create(&direct_tid, NULL, ltr_int_slave_direct_thread, NULL) != 0){
+    ltr_int_log_message("Couldn't start direct slave!\n");
+    direct = false;
+    ltr_int_unmap_file(&mmm);
+    ltr_int_close_axes(&axes);
+    ltr_int_free_prefs();
+    notify_pipe = -1;
+    return false;
+  }
+  ltr_int_log_message("Running in direct mode (profile '%s')\n", c_profile);
+  return true;
+}
+
+//Client's STOP_CMD makes the slave quit; this just waits for it
+void ltr_int_slave_direct_stop()
+{
+  if(!direct){
+    return;
+  }
+  quit_flag = true;
+  pthread_join(direct_tid, NULL);
+  direct = false;
+}
@@ -9,6 +9,8 @@ extern "C" {
 
 bool ltr_int_slave(const char *c_profile, const char *c_com_file, const char *ppid_str,
                    const char *close_pipe_str, const char *notify_pipe_str);
+bool ltr_int_slave_direct_start(const char *c_profile, const char *c_com_file, int notify_fd);
+void ltr_int_slave_direct_stop();
 
 #ifdef __cplusplus
 }
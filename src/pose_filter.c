@@ -0,0 +1,158 @@
+#include <math.h>
+#include <string.h>
+#include <strings.h>
+#include "pose_filter.h"
+#include "math_utils.h"
+
+//Used when there is no usable previous timestamp (first frame, duplicate ts)
+static const float c_DEFAULT_DT = 1.0f / 120.0f;
+//Longer gaps mean tracking was lost; don't let stale velocity run away
+static const float c_MAX_DT = 0.25f;
+//Cutoff used by One-Euro to smooth the derivative
+static const float c_EURO_D_CUTOFF = 1.0f;
+
+static const char *filter_names[] = {"Nonlinear", "Kalman", "OneEuro"};
+
+static float get_dt(const ltr_filter_state_t *state, int64_t ts)
+{
+  float dt = (ts - state->ts) / 1e9f;
+  if(dt <= 0.0f){
+    return c_DEFAULT_DT;
+  }
+  if(dt > c_MAX_DT){
+    return c_MAX_DT;
+  }
+  return dt;
+}
+
+static void init_state(ltr_filter_state_t *state, float x, int64_t ts)
+{
+  state->valid = true;
+  state->ts = ts;
+  state->x = x;
+  state->v = 0.0f;
+  state->p[0][0] = state->p[1][1] = 1.0f;
+  state->p[0][1] = state->p[1][0] = 0.0f;
+}
+
+void ltr_int_filter_reset(ltr_filter_state_t *state)
+{
+  memset(state, 0, sizeof(ltr_filter_state_t));
+  state->valid = false;
+}
+
+float ltr_int_filter_nonlin(ltr_filter_state_t *state, float x, int64_t ts, float ff)
+{
+  if(!state->valid){
+    init_state(state, 0.0f, ts);
+  }
+  float y = ltr_int_nonlinfilt(x, state->x, ff);
+  state->x = y;
+  state->ts = ts;
+  return y;
+}
+
+/*
+ * Constant velocity model, state (x, v), white noise acceleration
+ *   with spectral density q; r is the measurement noise variance.
+ */
+float ltr_int_filter_kalman(ltr_filter_state_t *state, float x, int64_t ts, float q, float r)
+{
+  if(!ltr_int_is_finite(x)){
+    return state->x;
+  }
+  if(!state->valid){
+    init_state(state, x, ts);
+    state->p[0][0] = r;
+    state->p[1][1] = q;
+    return x;
+  }
+  float dt = get_dt(state, ts);
+  float (*p)[2] = state->p;
+
+  //predict
+  float x_p = state->x + state->v * dt;
+  float p00 = p[0][0] + dt * (p[0][1] + p[1][0]) + dt * dt * p[1][1] + q * dt * dt * dt / 3.0f;
+  float p01 = p[0][1] + dt * p[1][1] + q * dt * dt / 2.0f;
+  float p10 = p[1][0] + dt * p[1][1] + q * dt * dt / 2.0f;
+  float p11 = p[1][1] + q * dt;
+
+  //update
+  float s = p00 + r;
+  if(s < 1e-12f){
+    s = 1e-12f;
+  }
+  float k0 = p00 / s;
+  float k1 = p10 / s;
+  float innov = x - x_p;
+  float new_x = x_p + k0 * innov;
+  float new_v = state->v + k1 * innov;
+  if(!ltr_int_is_finite(new_x) || !ltr_int_is_finite(new_v)){
+    init_state(state, x, ts);
+    return x;
+  }
+  state->x = new_x;
+  state->v = new_v;
+  p[0][0] = (1.0f - k0) * p00;
+  p[0][1] = (1.0f - k0) * p01;
+  p[1][0] = p10 - k1 * p00;
+  p[1][1] = p11 - k1 * p01;
+  state->ts = ts;
+  return state->x;
+}
+
+static float euro_alpha(float cutoff, float dt)
+{
+  float tau = 1.0f / (2.0f * M_PI * cutoff);
+  return 1.0f / (1.0f + tau / dt);
+}
+
+/*
+ * One-Euro filter (Casiez et al.) - lowpass with a cutoff that rises
+ *   with speed; min_cutoff [Hz] sets the smoothing at rest, beta how fast
+ *   the cutoff opens up when moving.
+ */
+float ltr_int_filter_one_euro(ltr_filter_state_t *state, float x, int64_t ts,
+                              float min_cutoff, float beta)
+{
+  if(!ltr_int_is_finite(x)){
+    return state->x;
+  }
+  if(!state->valid){
+    init_state(state, x, ts);
+    return x;
+  }
+  float dt = get_dt(state, ts);
+  float dx = (x - state->x) / dt;
+  state->v += euro_alpha(c_EURO_D_CUTOFF, dt) * (dx - state->v);
+  float cutoff = min_cutoff + beta * fabsf(state->v);
+  state->x += euro_alpha(cutoff, dt) * (x - state->x);
+  state->ts = ts;
+  return state->x;
+}
+
+ltr_filter_type_t ltr_int_filter_type_from_str(const char *str)
+{
+  if(str != NULL){
+    if(strcasecmp(str, filter_names[LTR_FILTER_KALMAN]) == 0){
+      return LTR_FILTER_KALMAN;
+    }
+    if(strcasecmp(str, filter_names[LTR_FILTER_ONE_EURO]) == 0){
+      return LTR_FILTER_ONE_EURO;
+    }
+  }
+  return LTR_FILTER_NONLINEAR;
+}
+
+const char *ltr_int_filter_type_to_str(ltr_filter_type_t type)
+{
+  switch(type){
+    case LTR_FILTER_KALMAN:
+    case LTR_FILTER_ONE_EURO:
+      return filter_names[type];
+      break;
+    default:
+      return filter_names[LTR_FILTER_NONLINEAR];
+      break;
+  }
+}
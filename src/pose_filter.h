@@ -0,0 +1,45 @@
+#ifndef POSE_FILTER__H
+#define POSE_FILTER__H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Per-axis smoothing filters.
+ *   LTR_FILTER_NONLINEAR - the classic ltr_int_nonlinfilt (default)
+ *   LTR_FILTER_KALMAN    - constant velocity Kalman filter
+ *   LTR_FILTER_ONE_EURO  - One-Euro filter (speed adaptive lowpass)
+ *
+ * Kalman and One-Euro use real frame timestamps (ns, see ltr_int_get_ts_ns),
+ *   so their behaviour doesn't depend on the camera framerate.
+ * Extrapolation to the client's render time is done on the client side
+ *   (see ltr_int_predict in ltlib.c), not here.
+ */
+typedef enum {LTR_FILTER_NONLINEAR, LTR_FILTER_KALMAN, LTR_FILTER_ONE_EURO} ltr_filter_type_t;
+
+typedef struct{
+  bool valid;
+  int64_t ts;     //timestamp of the last sample
+  float x;        //filtered value
+  float v;        //filtered velocity (units per second, Kalman/One-Euro)
+  float p[2][2];  //Kalman error covariance
+} ltr_filter_state_t;
+
+void ltr_int_filter_reset(ltr_filter_state_t *state);
+float ltr_int_filter_nonlin(ltr_filter_state_t *state, float x, int64_t ts, float ff);
+float ltr_int_filter_kalman(ltr_filter_state_t *state, float x, int64_t ts, float q, float r);
+float ltr_int_filter_one_euro(ltr_filter_state_t *state, float x, int64_t ts,
+                              float min_cutoff, float beta);
+
+ltr_filter_type_t ltr_int_filter_type_from_str(const char *str);
+const char *ltr_int_filter_type_to_str(ltr_filter_type_t type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+  #include <linux/futex.h>
+  #include <sys/syscall.h>
+#endif
+
+#include "pose_ring.h"
+#include "utils.h"
+
+const char *ltr_int_pose_ring_name()
+{
+  static const char ring_file[] = "/tmp/ltr_pose_ring";
+  return ring_file;
+}
+
+//Master side - (re)initializes the ring; the file is reused rather than
+//  unlinked, so that slaves surviving a master restart keep a valid mapping.
+bool ltr_int_pose_ring_create(struct mmap_s *m)
+{
+  if(!ltr_int_mmap_file(ltr_int_pose_ring_name(), sizeof(struct ltr_pose_ring), m)){
+    ltr_int_log_message("Couldn't create pose ring!\n");
+    return false;
+  }
+  //Forget the name, so that closing the ring leaves the file in place
+  free(m->fname);
+  m->fname = NULL;
+  struct ltr_pose_ring *ring = (struct ltr_pose_ring *)m->data;
+  ring->magic = POSE_RING_MAGIC;
+  ring->version = POSE_RING_VERSION;
+  //Changing seq lets the readers notice the restart
+  __atomic_store_n(&(ring->seq), 0, __ATOMIC_SEQ_CST);
+  ltr_int_seq_wake(&(ring->seq), &(ring->waiters));
+  return true;
+}
+
+//Reader side - maps the ring the master created; fails quietly when there is none yet
+bool ltr_int_pose_ring_attach(struct mmap_s *m)
+{
+  if(!ltr_int_mmap_existing_file(ltr_int_pose_ring_name(), m)){
+    return false;
+  }
+  if(m->size < sizeof(struct ltr_pose_ring)){
+    ltr_int_log_message("Pose ring too small (%lu)!\n", (unsigned long)m->size);
+    ltr_int_unmap_file(m);
+    return false;
+  }
+  struct ltr_pose_ring *ring = (struct ltr_pose_ring *)m->data;
+  if((ring->magic != POSE_RING_MAGIC) || (ring->version != POSE_RING_VERSION)){
+    ltr_int_log_message("Pose ring version mismatch (%08X/%d)!\n", ring->magic, ring->version);
+    ltr_int_unmap_file(m);
+    return false;
+  }
+  return true;
+}
+
+//False when the ring file got removed or replaced since attaching
+bool ltr_int_pose_ring_current(const struct mmap_s *m)
+{
+  return ltr_int_mmap_is_current(ltr_int_pose_ring_name(), m);
+}
+
+void ltr_int_pose_ring_close(struct mmap_s *m)
+{
+  if(m->data != NULL){
+    ltr_int_unmap_file(m);
+    m->data = NULL;
+  }
+}
+
+void ltr_int_pose_ring_publish(struct ltr_pose_ring *ring, const linuxtrack_full_pose_t *pose)
+{
+  uint32_t seq = __atomic_load_n(&(ring->seq), __ATOMIC_RELAXED);
+  ltr_pose_slot_t *slot = &(ring->slots[seq % POSE_RING_SLOTS]);
+  ltr_int_seqlock_write_begin(&(slot->seq));
+  slot->pose = *pose;
+  ltr_int_seqlock_write_end(&(slot->seq));
+  __atomic_store_n(&(ring->seq), seq + 1, __ATOMIC_SEQ_CST);
+  ltr_int_seq_wake(&(ring->seq), &(ring->waiters));
+}
+
+uint32_t ltr_int_pose_ring_seq(const struct ltr_pose_ring *ring)
+{
+  return __atomic_load_n(&(ring->seq), __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Reads the newest pose; seq receives its sequence number.
+ *   Returns false if there is nothing published yet, or the writer kept
+ *   overwriting the slot (shouldn't happen with sane framerates).
+ */
+bool ltr_int_pose_ring_read(const struct ltr_pose_ring *ring, uint32_t *seq, linuxtrack_full_pose_t *pose)
+{
+  int retries;
+  for(retries = 0; retries < 4; ++retries){
+    uint32_t ring_seq = ltr_int_pose_ring_seq(ring);
+    if(ring_seq == 0){
+      return false;
+    }
+    const ltr_pose_slot_t *slot = &(ring->slots[(ring_seq - 1) % POSE_RING_SLOTS]);
+    uint32_t start;
+    if(!ltr_int_seqlock_read_begin(&(slot->seq), &start)){
+      continue;
+    }
+    *pose = slot->pose;
+    if(ltr_int_seqlock_read_end(&(slot->seq), start)){
+      *seq = ring_seq;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Return value
+//   0 - timed out
+//   1 - seq differs from last_seq
+int ltr_int_pose_ring_wait(struct ltr_pose_ring *ring, uint32_t last_seq, int timeout)
+{
+  return ltr_int_seq_wait(&(ring->seq), &(ring->waiters), last_seq, timeout);
+}
+
+// Blocks until *seq differs from last_seq, or timeout (ms) expires;
+//   negative timeout waits forever.
+// Return value
+//   0 - timed out
+//   1 - seq changed
+int ltr_int_seq_wait(uint32_t *seq, uint32_t *waiters, uint32_t last_seq, int timeout)
+{
+  if(__atomic_load_n(seq, __ATOMIC_ACQUIRE) != last_seq){
+    return 1;
+  }
+  //Absolute deadline, so that signals don't extend the wait
+  int64_t deadline = ltr_int_get_ts_ns() + (int64_t)timeout * 1000000;
+#ifdef __linux__
+  __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+  while(__atomic_load_n(seq, __ATOMIC_SEQ_CST) == last_seq){
+    struct timespec ts;
+    struct timespec *tsp = NULL;
+    if(timeout >= 0){
+      int64_t left = deadline - ltr_int_get_ts_ns();
+      if(left <= 0){
+        break;
+      }
+      ts.tv_sec = left / 1000000000;
+      ts.tv_nsec = left % 1000000000;
+      tsp = &ts;
+    }
+    //shared mapping - can't use the private futex ops
+    if(syscall(SYS_futex, seq, FUTEX_WAIT, last_seq, tsp, NULL, 0) < 0){
+      if(errno == ETIMEDOUT){
+        break;
+      }
+      if((errno != EINTR) && (errno != EAGAIN)){
+        ltr_int_my_perror("futex");
+        break;
+      }
+    }
+  }
+  __atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+#else
+  (void) waiters;
+  while((__atomic_load_n(seq, __ATOMIC_ACQUIRE) == last_seq) &&
+        ((timeout < 0) || (ltr_int_get_ts_ns() < deadline))){
+    ltr_int_usleep(1000);
+  }
+#endif
+  return (__atomic_load_n(seq, __ATOMIC_ACQUIRE) != last_seq) ? 1 : 0;
+}
+
+// Wakes everybody blocked in ltr_int_seq_wait; no syscall when nobody waits.
+void ltr_int_seq_wake(uint32_t *seq, uint32_t *waiters)
+{
+#ifdef __linux__
+  if(__atomic_load_n(waiters, __ATOMIC_SEQ_CST) > 0){
+    syscall(SYS_futex, seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+  }
+#else
+  (void) seq;
+  (void) waiters;
+#endif
+}
@@ -0,0 +1,89 @@
+#ifndef POSE_RING__H
+#define POSE_RING__H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ltlib.h"
+#include "ipc_utils.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Shared memory ring the master publishes poses into; slaves (and
+ *   clients attached directly) read it without any copying through
+ *   sockets. Single writer, any number of readers.
+ *
+ * seq counts the published poses, the newest pose lives in slot
+ *   (seq - 1) % POSE_RING_SLOTS. Each slot is guarded by its own
+ *   sequence counter (odd while being written), so readers never see
+ *   a torn pose. Readers can block on seq (futex), the writer wakes
+ *   them only when somebody actually waits.
+ */
+#define POSE_RING_SLOTS 16
+#define POSE_RING_MAGIC 0x4C545250 //"LTRP"
+#define POSE_RING_VERSION 1
+
+typedef struct{
+  uint32_t seq;
+  uint32_t pad;
+  linuxtrack_full_pose_t pose;
+} ltr_pose_slot_t;
+
+struct ltr_pose_ring{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t seq;
+  uint32_t waiters;
+  ltr_pose_slot_t slots[POSE_RING_SLOTS];
+};
+
+const char *ltr_int_pose_ring_name();
+bool ltr_int_pose_ring_create(struct mmap_s *m);
+bool ltr_int_pose_ring_attach(struct mmap_s *m);
+bool ltr_int_pose_ring_current(const struct mmap_s *m);
+void ltr_int_pose_ring_close(struct mmap_s *m);
+
+void ltr_int_pose_ring_publish(struct ltr_pose_ring *ring, const linuxtrack_full_pose_t *pose);
+uint32_t ltr_int_pose_ring_seq(const struct ltr_pose_ring *ring);
+bool ltr_int_pose_ring_read(const struct ltr_pose_ring *ring, uint32_t *seq, linuxtrack_full_pose_t *pose);
+int ltr_int_pose_ring_wait(struct ltr_pose_ring *ring, uint32_t last_seq, int timeout);
+
+//Single writer seqlock over shared data; the counter is odd while writing
+static inline void ltr_int_seqlock_write_begin(uint32_t *seq)
+{
+  uint32_t s = __atomic_load_n(seq, __ATOMIC_RELAXED);
+  __atomic_store_n(seq, s + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void ltr_int_seqlock_write_end(uint32_t *seq)
+{
+  uint32_t s = __atomic_load_n(seq, __ATOMIC_RELAXED);
+  __atomic_store_n(seq, s + 1, __ATOMIC_RELEASE);
+}
+
+//Returns false when a write is in progress
+static inline bool ltr_int_seqlock_read_begin(const uint32_t *seq, uint32_t *start)
+{
+  *start = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+  return (*start & 1) == 0;
+}
+
+//Returns true if the data read since read_begin are consistent
+static inline bool ltr_int_seqlock_read_end(const uint32_t *seq, uint32_t start)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(seq, __ATOMIC_RELAXED) == start;
+}
+
+//Generic helpers to block on / wake a shared 32bit counter
+int ltr_int_seq_wait(uint32_t *seq, uint32_t *waiters, uint32_t last_seq, int timeout);
+void ltr_int_seq_wake(uint32_t *seq, uint32_t *waiters);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
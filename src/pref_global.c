@@ -158,6 +158,14 @@ void ltr_int_set_tr_align(bool state)
 bool ltr_int_get_device(struct camera_control_block *ccb)
 {
   bool dev_ok = false;
+  //A frame recording played back in place of the device of the profile
+  const char *replay = getenv("LINUXTRACK_FRAME_REPLAY");
+  if((replay != NULL) && (replay[0] != '\0')){
+    ltr_int_log_message("Device Type: Replay of '%s'\n", replay);
+    ccb->device.category = frame_replay;
+    ccb->device.device_id = ltr_int_my_strdup(replay);
+    return true;
+  }
   char *dev_section = ltr_int_get_device_section();
   if(dev_section == NULL){
     return false;
@@ -216,6 +224,11 @@ bool ltr_int_get_device(struct camera_control_block *ccb)
       ccb->device.category = mac_ps3eye_ft;
       dev_ok = true;
     }
+    if(strcasecmp(dev_type, "Replay") == 0){
+      ltr_int_log_message("Device Type: Replay\n");
+      ccb->device.category = frame_replay;
+      dev_ok = true;
+    }
     if(dev_ok == false){
       ltr_int_log_message("Wrong device type found: '%s'\n", dev_type);
       ltr_int_log_message(" Valid options are: 'Tir4', 'Tir', 'Tir_openusb', 'Webcam', 'Wiimote'.\n");
@@ -20,6 +20,10 @@ prepare_device_fun *ltr_int_prepare_device = NULL;
 send_data_fun *ltr_int_send_data = NULL;
 receive_data_fun *ltr_int_receive_data = NULL;
 finish_usb_fun *ltr_int_finish_usb = NULL;
+stream_start_fun *ltr_int_stream_start = NULL;
+stream_read_fun *ltr_int_stream_read = NULL;
+stream_release_fun *ltr_int_stream_release = NULL;
+stream_stop_fun *ltr_int_stream_stop = NULL;
 
 static lib_fun_def_t functions[] = {
   {(char *)"ltr_int_init_usb", (void*) &ltr_int_init_usb},
@@ -30,6 +34,13 @@ static lib_fun_def_t functions[] = {
   {(char *)"ltr_int_finish_usb", (void*) &ltr_int_finish_usb},
   {NULL, NULL}
 };
+static lib_fun_def_t optional_functions[] = {
+  {(char *)"ltr_int_stream_start", (void*) &ltr_int_stream_start},
+  {(char *)"ltr_int_stream_read", (void*) &ltr_int_stream_read},
+  {(char *)"ltr_int_stream_release", (void*) &ltr_int_stream_release},
+  {(char *)"ltr_int_stream_stop", (void*) &ltr_int_stream_stop},
+  {NULL, NULL}
+};
 static void *libhandle = NULL;
 
 
@@ -990,26 +1001,51 @@ int min(int a, int b)
   return (a < b) ? a : b;
 }
 
+//Frames are assembled straight into a ring of slots holding the thresholded
+//  luma plane; the stripes of each row are extracted as soon as the row is
+//  complete, so nothing is left to do over the whole frame when it ends.
+#define FRAME_SLOTS 2
+
 static int frame_max = -1;
-static uint8_t *frame1 = NULL;
+static uint8_t *slots[FRAME_SLOTS] = {NULL};
+static int slot = 0;
+static int ready_slot = -1;
 static int pos = 0;
+static int rows_done = 0;
 static int frame_counter = 0;
+static unsigned int threshold = 128;
 
 static void frame_add(int packet_type, uint8_t *data, int len)
 {
-  if((frame1 == NULL) || (frame_max != width * height * 2)){
-    if(frame1 != NULL){
-      free(frame1);
-    }
+  int i;
+  if((slots[0] == NULL) || (frame_max != width * height * 2)){
     frame_max = width * height * 2;
-    frame1 = (uint8_t*)malloc(frame_max);
+    for(i = 0; i < FRAME_SLOTS; ++i){
+      free(slots[i]);
+      slots[i] = (uint8_t*)malloc(width * height);
+    }
+    slot = 0;
+    ready_slot = -1;
   }
   if((packet_type == DISCARD_PACKET) || (packet_type == FIRST_PACKET)){
     pos = 0;
+    rows_done = 0;
+#ifndef OPENCV
+    ltr_int_discard_stripes();
+    threshold = ltr_int_wc_get_threshold();
+#else
+    threshold = 0;
+#endif
   }
   if(packet_type == DISCARD_PACKET){
+    last_packet_type = DISCARD_PACKET;
+    return;
+  }
+  //The start of this frame was lost, wait for the next one
+  if((last_packet_type == DISCARD_PACKET) && (packet_type != FIRST_PACKET)){
     return;
   }
+  last_packet_type = packet_type;
   if((data != NULL) && (len > 0)){
     if(pos + len > frame_max){
       ltr_int_log_message("Frame way too long (%d is max, requested %d)!\n",
@@ -1017,23 +1053,41 @@ static void frame_add(int packet_type, uint8_t *data, int len)
       pos = 0;
       return;
     }
-    memcpy(frame1 + pos, data, len);
+    //YUYV, the luma is in the even bytes; with pos odd, data[1] is the
+    //  luma of the next pixel
+    uint8_t *dest = slots[slot] + ((pos + 1) >> 1);
+    for(i = (pos & 1); i < len; i += 2){
+      *(dest++) = (data[i] > threshold) ? data[i] : 0;
+    }
     pos += len;
+#ifndef OPENCV
+    int rows = pos / (width * 2);
+    if(rows > rows_done){
+      image_t img = {.bitmap = slots[slot], .w = width, .h = height, .ratio = 1.0f};
+      ltr_int_rows_to_stripes(&img, rows_done, rows);
+      rows_done = rows;
+    }
+#endif
   }
   if(packet_type == LAST_PACKET){
-    //process_packet
+    ready_slot = slot;
+    slot = (slot + 1) % FRAME_SLOTS;
     ++frame_counter;
   }
   return;
 }
 
 
-static void sd_pkt_scan(uint8_t *data, int len)
+//Scans whole payloads and stops right after the one completing a frame;
+//  returns the number of bytes consumed.
+static int sd_pkt_scan(uint8_t *data, int len)
 {
   uint32_t this_pts;
   uint16_t this_fid;
   int remaining_len = len;
   int payload_len;
+  int start_counter = frame_counter;
+  uint8_t *start = data;
 
   payload_len = 2048;
   do {
@@ -1068,7 +1122,10 @@ static void sd_pkt_scan(uint8_t *data, int len)
     // If PTS or FID has changed, start a new frame.
     if (this_pts != last_pts || this_fid != last_fid) {
       if(last_packet_type == INTER_PACKET){
+        // End the frame in progress, but leave this payload for the next
+        //   call, so the stripes of the finished frame survive until read
         frame_add(LAST_PACKET, NULL, 0);
+        return data - start;
       }
       last_pts = this_pts;
       last_fid = this_fid;
@@ -1096,29 +1153,63 @@ discard:
 scan_next:
     remaining_len -= len;
     data += len;
-  } while (remaining_len > 0);
+  } while ((remaining_len > 0) && (frame_counter == start_counter));
+  return data - start;
 }
 
-static unsigned int threshold = 128;
+static int w, h;
+
+//Bulk transfers kept queued on the video endpoint when the usb library can
+//  stream; each one holds a whole number of 2048 byte payloads.
+#define STREAM_TRANSFERS 8
+#define TRANSFER_SIZE (16 * 2048)
+
+static uint8_t buffer[TRANSFER_SIZE];
+static uint8_t *transfer = NULL;
+static size_t transfer_size = 0;
+static size_t transfer_ptr = 0;
+static int64_t transfer_ts = 0;
+static bool streaming = false;
+static bool stream_failed = false;
 
-static void get_bw_image(const unsigned char *source_buf, unsigned char *dest_buf, unsigned int bytes_used)
+static bool next_transfer(void)
 {
-  unsigned int cntr, cntr1;
-  #ifdef OPENCV
-    threshold = 0;
-  #else
-    threshold = ltr_int_wc_get_threshold();
-  #endif
-  for(cntr = cntr1 = 0; cntr < bytes_used; cntr += 2, ++cntr1){
-    if(source_buf[cntr] > threshold){
-      dest_buf[cntr1] = source_buf[cntr];
-    }else{
-      dest_buf[cntr1] = 0;
+  transfer_ptr = 0;
+  transfer_size = 0;
+  if((ltr_int_stream_start != NULL) && !streaming && !stream_failed){
+    streaming = ltr_int_stream_start(0x81, TRANSFER_SIZE, STREAM_TRANSFERS);
+    if(!streaming){
+      ltr_int_log_message("Couldn't start streaming, falling back to synchronous reads.\n");
+      stream_failed = true;
     }
   }
+  if(streaming){
+    return ltr_int_stream_read(&transfer, &transfer_size, &transfer_ts, 500);
+  }
+  //bulk transfer, ep 81
+  transfer = buffer;
+  bool res = ltr_int_receive_data(0x81, buffer, sizeof(buffer), &transfer_size, 500);
+  transfer_ts = ltr_int_get_ts_ns();
+  return res;
 }
 
-static int w, h;
+//Must be called before the camera is stopped (pause, close...)
+static void stop_stream(void)
+{
+  if(streaming){
+    ltr_int_stream_stop();
+    streaming = false;
+  }
+  stream_failed = false;
+  transfer = NULL;
+  transfer_ptr = 0;
+  transfer_size = 0;
+  last_packet_type = DISCARD_PACKET;
+  last_pts = 0;
+  if(slots[0] != NULL){
+    frame_add(DISCARD_PACKET, NULL, 0);
+  }
+}
 
 int ltr_int_tracker_resume(void)
 {
@@ -1139,6 +1230,7 @@ int ltr_int_tracker_init(struct camera_control_block *ccb)
     ltr_int_log_message("Problem loading library %s!\n", libname);
     return -1;
   }
+  ltr_int_load_optional(libhandle, optional_functions);
 
   usb_err = 0;
   if(!ltr_int_init_usb()){
@@ -1175,6 +1267,7 @@ int ltr_int_tracker_init(struct camera_control_block *ccb)
 
  failed:
   ltr_int_finish_usb(-1);
+  ltr_int_unload_optional(optional_functions);
   ltr_int_unload_library(libhandle, functions);
   libhandle = NULL;
   return -1;
@@ -1182,12 +1275,14 @@ int ltr_int_tracker_init(struct camera_control_block *ccb)
 
 int ltr_int_tracker_close(void)
 {
+  stop_stream();
   sd_stopN();
 #ifdef OPENCV
   ltr_int_stop_face_detect();
 #endif
   ltr_int_cleanup_after_processing();
   ltr_int_finish_usb(-1);
+  ltr_int_unload_optional(optional_functions);
   ltr_int_unload_library(libhandle, functions);
   libhandle = NULL;
   return 0;
@@ -1195,14 +1290,14 @@ int ltr_int_tracker_close(void)
 
 int ltr_int_tracker_pause(void)
 {
+  stop_stream();
   sd_stopN();
   return 0;
 }
 
 
-static uint8_t buffer[16384];
+
 static int current_frame = 0;
-static unsigned char *frame = NULL;
 
 
 int ltr_int_tracker_get_frame(struct camera_control_block *ccb, struct frame_type *f,
@@ -1214,45 +1309,39 @@ int ltr_int_tracker_get_frame(struct camera_control_block *ccb, struct frame_typ
   f->height = h;
   ltr_int_refresh_ctrls();
 
-  //bulk transfer, ep 81
-  size_t got = 0;
-  if(!ltr_int_receive_data(0x81, buffer, sizeof(buffer), &got, 500)){
-    return -1;
-  }
-  sd_pkt_scan(buffer, got);
-  if(frame_counter != current_frame){
-    //printf("Have new frame!\n");
-    current_frame = frame_counter;
-
-    if(frame == NULL){
-      frame = (unsigned char *)malloc(w * h);
-    }
-    const unsigned char *source_buf = frame1;
-
-    FILE *fr = fopen("/tmp/frame.bin", "w");
-    if(fr){
-      fwrite(source_buf, 2 * w * h, 1, fr);
-      fclose(fr);
+  //Payloads are consumed until a frame completes; a transfer can hold the end
+  //  of one frame and the start of the next, the rest is kept for the next call.
+  while(frame_counter == current_frame){
+    if(transfer_ptr >= transfer_size){
+      if(!next_transfer()){
+        return -1;
+      }
+      if(transfer_size == 0){
+        return 0;
+      }
     }
+    transfer_ptr += sd_pkt_scan(transfer + transfer_ptr, transfer_size - transfer_ptr);
+  }
+  current_frame = frame_counter;
+  f->ts_ns = transfer_ts;
 
-    unsigned char *dest_buf = (f->bitmap != NULL) ? f->bitmap : frame;
-    get_bw_image(source_buf, dest_buf, 2 * w * h);
-
-    image_t img;
-    img.bitmap = dest_buf;
-    img.w = f->width;
-    img.h = f->height;
-    img.ratio = 1.0f;
+  image_t img;
+  img.bitmap = slots[ready_slot];
+  img.w = f->width;
+  img.h = f->height;
+  img.ratio = 1.0f;
 
 #ifndef OPENCV
-    ltr_int_to_stripes(&img);
-    ltr_int_stripes_to_blobs(MAX_BLOBS, &(f->bloblist), ltr_int_wc_get_min_blob(),
-                    ltr_int_wc_get_max_blob(), &img);
+  //The stripes are already there, only the blobs remain
+  ltr_int_stripes_to_blobs(MAX_BLOBS, &(f->bloblist), ltr_int_wc_get_min_blob(),
+                  ltr_int_wc_get_max_blob(), &img);
 #else
-    ltr_int_face_detect(&img, &(f->bloblist));
+  ltr_int_face_detect(&img, &(f->bloblist));
 #endif
-     *frame_acquired = true;
+  if(f->bitmap != NULL){
+    memcpy(f->bitmap, img.bitmap, w * h);
   }
+  *frame_acquired = true;
   return 0;
 }
 
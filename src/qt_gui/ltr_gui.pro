@@ -51,7 +51,7 @@ SOURCES += main.cpp ltr_gui.cpp ltr_show.cpp ltr_dev_help.cpp \
            log_view.cpp ltr_state.cpp scp_form.cpp guardian.cpp \
            scurve.cpp scview.cpp wiimote_prefs.cpp \
            tracker.cpp ../ltr_srv_master.cpp  device_setup.cpp \
-           ../ltr_srv_slave.c ../ltr_srv_comm.c plugin_install.cpp profile_setup.cpp \
+           plugin_install.cpp profile_setup.cpp \
            profile_selector.cpp xplugin.cpp wine_warn.cpp progress.cpp \
            extractor.cpp ../game_data.c hashing.cpp downloading.cpp wine_launcher.cpp \
            macps3eye_prefs.cpp macwebcam_info.cpp macps3eyeft_prefs.cpp \
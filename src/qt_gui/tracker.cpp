@@ -119,7 +119,7 @@ void Tracker::signalNewPose(linuxtrack_full_pose_t *full_pose)
   static linuxtrack_pose_t processed;
   static linuxtrack_pose_t unfiltered;
   processed = full_pose->pose;
-  ltr_int_postprocess_axes(axes, &processed, &unfiltered);
+  ltr_int_postprocess_axes(axes, &processed, &unfiltered, full_pose->timestamp);
   //std::cout<<"TRACKER: "<<pose->pitch<<" "<<unfiltered.pitch<<" "<<processed.pitch<<"\n";
   emit newPose(full_pose, &unfiltered, &processed);
 }
@@ -140,6 +140,7 @@ void Tracker::signalNewSlave(const char *name)
   ltr_int_change(NULL, MISC, MISC_ALTER, ltr_int_use_alter()?1.0:0.0);
   ltr_int_change(NULL, MISC, MISC_ALIGN, ltr_int_do_tr_align()?1.0:0.0);
   ltr_int_change(NULL, MISC, MISC_FOCAL_LENGTH, ltr_int_get_focal_length());
+  ltr_int_change(name, MISC, MISC_FILTER_TYPE, ltr_int_get_filter_type(tmp_axes));
   ltr_int_close_axes(&tmp_axes);
 }
 
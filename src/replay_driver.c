@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "cal.h"
+#include "utils.h"
+#include "runloop.h"
+#include "frame_recorder.h"
+
+/*
+ * Plays a frame recording (see frame_recorder.h) back in place of a camera,
+ *   paced by the recorded timestamps and looped at its end, so the tracker
+ *   and its clients can run without any hardware attached.
+ * The recording is named by Capture-device-id of a "Replay" device, or by
+ *   LINUXTRACK_FRAME_REPLAY (which overrides the device of the profile).
+ */
+
+//Longer gaps (e.g. the recording was paused) are skipped
+#define MAX_GAP_NS 1000000000LL
+
+static FILE *rec_file = NULL;
+static long first_rec_pos = 0;
+static int64_t rec_ts = 0;      //recorded time of the previous frame
+static int64_t play_ts = 0;     //when the previous frame was played, 0 to restart the pacing
+
+int ltr_int_tracker_init(struct camera_control_block *ccb)
+{
+  const char *fname = ccb->device.device_id;
+  rec_file = fopen(fname, "rb");
+  if(rec_file == NULL){
+    ltr_int_my_perror("fopen");
+    ltr_int_log_message("Can't open frame recording '%s'!\n", fname);
+    return -1;
+  }
+  frame_rec_hdr_t hdr;
+  if(!ltr_int_frame_rec_read_hdr(rec_file, &hdr)){
+    fclose(rec_file);
+    rec_file = NULL;
+    return -1;
+  }
+  first_rec_pos = ftell(rec_file);
+  play_ts = 0;
+  ltr_int_log_message("Replaying frames from '%s'.\n", fname);
+  return 0;
+}
+
+int ltr_int_tracker_get_frame(struct camera_control_block *ccb,
+                   struct frame_type *f, bool *frame_acquired)
+{
+  (void) ccb;
+  *frame_acquired = false;
+  frame_rec_t rec;
+  //A bitmap is there only when the runloop lends one for a frame recording
+  size_t bitmap_size = (f->bitmap != NULL) ? f->width * f->height : 0;
+  if(!ltr_int_frame_rec_read(rec_file, &rec, f->bloblist.blobs, f->bitmap, bitmap_size)){
+    //End of the recording, start over
+    if((fseek(rec_file, first_rec_pos, SEEK_SET) != 0) ||
+       !ltr_int_frame_rec_read(rec_file, &rec, f->bloblist.blobs, f->bitmap, bitmap_size)){
+      ltr_int_log_message("Frame recording is empty or damaged!\n");
+      return -1;
+    }
+    play_ts = 0;
+  }
+  int64_t now = ltr_int_get_ts_ns();
+  if(play_ts == 0){
+    play_ts = now;
+  }else{
+    int64_t gap = rec.ts_ns - rec_ts;
+    play_ts += ((gap > 0) && (gap < MAX_GAP_NS)) ? gap : 0;
+    if(play_ts > now){
+      ltr_int_usleep((play_ts - now) / 1000);
+    }
+  }
+  rec_ts = rec.ts_ns;
+  f->bloblist.num_blobs = rec.num_blobs;
+  f->width = rec.width;
+  f->height = rec.height;
+  f->ts_ns = play_ts;
+  *frame_acquired = true;
+  return 0;
+}
+
+int ltr_int_tracker_pause()
+{
+  return 0;
+}
+
+int ltr_int_tracker_resume()
+{
+  //Don't try to catch up with the time spent paused
+  play_ts = 0;
+  return 0;
+}
+
+int ltr_int_tracker_close()
+{
+  if(rec_file != NULL){
+    fclose(rec_file);
+    rec_file = NULL;
+  }
+  return 0;
+}
@@ -1,16 +1,42 @@
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <assert.h>
 #include "cal.h"
 #include "utils.h"
 #include "runloop.h"
 #include "pref_global.h"
+#include "frame_recorder.h"
 
 static pthread_cond_t state_cv = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t state_mx = PTHREAD_MUTEX_INITIALIZER;
 static bool change_flag = false;
 static struct frame_type frame;
 static bool frame_acquired = false;
+static unsigned char *rec_bitmap = NULL;
+static size_t rec_bitmap_size = 0;
+
+//When the frames are recorded with bitmaps and nobody else hands the driver
+//  a bitmap, it gets one of ours to draw into
+static void lend_rec_bitmap(void)
+{
+  if(!ltr_int_frame_rec_wants_bitmap() || ((frame.bitmap != NULL) && (frame.bitmap != rec_bitmap))){
+    return;
+  }
+  size_t size = frame.width * frame.height;
+  if(size == 0){
+    //The size is known only after the first frame
+    return;
+  }
+  if(rec_bitmap_size < size){
+    free(rec_bitmap);
+    rec_bitmap = (unsigned char *)ltr_int_my_malloc(size);
+    rec_bitmap_size = size;
+  }
+  memset(rec_bitmap, 0, size);
+  frame.bitmap = rec_bitmap;
+}
 
 int ltr_int_rl_run(struct camera_control_block *ccb, frame_callback_fun cbk)
 {
@@ -37,6 +63,7 @@ int ltr_int_rl_run(struct camera_control_block *ccb, frame_callback_fun cbk)
   }
 
   frame.bitmap = NULL;
+  ltr_int_frame_rec_open_env();
 
   ltr_int_cal_set_state(RUNNING);
   while(1){
@@ -55,6 +82,8 @@ int ltr_int_rl_run(struct camera_control_block *ccb, frame_callback_fun cbk)
             break;
           default:
             frame_acquired = false;
+            frame.ts_ns = 0;
+            lend_rec_bitmap();
             retval = ltr_int_tracker_get_frame(ccb, &frame, &frame_acquired);
             if(retval == -1){
               ltr_int_log_message("Error getting frame! (rv = %d)\n", retval);
@@ -63,7 +92,10 @@ int ltr_int_rl_run(struct camera_control_block *ccb, frame_callback_fun cbk)
             }else{
               if(frame_acquired){
                 frame.counter = ++counter;
-                frame.usec = ltr_int_get_ts();
+                if(frame.ts_ns == 0){
+                  frame.ts_ns = ltr_int_get_ts_ns();
+                }
+                ltr_int_frame_rec_add(&frame);
                 if((retval = cbk(ccb, &frame)) < 0){
                   ltr_int_log_message("Error processing frame! (rv = %d)\n", retval);
                   ltr_int_cal_set_state(err_PROCESSING_FRAME);
@@ -105,6 +137,13 @@ int ltr_int_rl_run(struct camera_control_block *ccb, frame_callback_fun cbk)
   }
 
   ltr_int_tracker_close();
+  ltr_int_frame_rec_close();
+  if(frame.bitmap == rec_bitmap){
+    frame.bitmap = NULL;
+  }
+  free(rec_bitmap);
+  rec_bitmap = NULL;
+  rec_bitmap_size = 0;
   ltr_int_frame_free(ccb, &frame);
   ltr_int_cal_set_state(STOPPED);
   return 0;
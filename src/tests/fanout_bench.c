@@ -0,0 +1,320 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <linuxtrack.h>
+#include <frame_recorder.h>
+#include <utils.h>
+
+/*
+ * Attaches 1, 2, 4 ... max_clients client processes to the tracker through
+ *   linuxtrack_init (so the master and the slaves are started the usual way)
+ *   and measures for each count:
+ *   - delivery latency: capture time of the pose to the client having it
+ *     (linuxtrack_wait + linuxtrack_get_pose_at),
+ *   - dropped updates: gaps in the pose counter seen by the clients,
+ *   - CPU used by the master and by the slaves.
+ *
+ * Runs headless: the master it starts plays a frame recording back instead
+ *   of using a camera (LINUXTRACK_FRAME_REPLAY, see replay_driver.c). With
+ *   -r, the given recording is used (see frame_replay); otherwise a synthetic
+ *   one is generated (three points moving at 120 fps). -d uses the device of
+ *   the profile instead. A master already running is reused as it is, so
+ *   stop it first. LINUXTRACK_DIRECT=1 measures the direct mode instead.
+ *
+ * Usage: fanout_bench [-r recording | -d] [max_clients(64)] [seconds_per_step(5)] [profile]
+ */
+
+#define MAX_CLIENTS 64
+#define MAX_SAMPLES 8192
+
+typedef struct{
+  int ready;
+  int failed;
+  int64_t poses;
+  int64_t dropped;
+  int64_t samples;
+  int64_t lat[MAX_SAMPLES];
+} client_res_t;
+
+typedef struct{
+  volatile int go;
+  volatile int stop;
+  client_res_t client[MAX_CLIENTS];
+} shared_t;
+
+static shared_t *shared;
+static const char *profile = NULL;
+
+static void client(int idx)
+{
+  client_res_t *res = &(shared->client[idx]);
+  linuxtrack_state_type state = linuxtrack_init(profile);
+  int i;
+  for(i = 0; (i < 100) && (state >= INITIALIZING) && (state != RUNNING); ++i){
+    ltr_int_usleep(100000);
+    state = linuxtrack_get_tracking_state();
+  }
+  if(state != RUNNING){
+    fprintf(stderr, "Client %d: %s\n", idx, linuxtrack_explain(state));
+    res->failed = 1;
+    __atomic_store_n(&(res->ready), 1, __ATOMIC_RELEASE);
+    linuxtrack_shutdown();
+    _exit(1);
+  }
+  __atomic_store_n(&(res->ready), 1, __ATOMIC_RELEASE);
+  while(!shared->go){
+    ltr_int_usleep(1000);
+  }
+  uint32_t last_counter = 0;
+  bool first = true;
+  linuxtrack_pose_t pose;
+  int64_t age;
+  while(!shared->stop){
+    if(linuxtrack_wait(100) <= 0){
+      continue;
+    }
+    linuxtrack_get_pose_at(linuxtrack_get_time_ns(), &pose, &age);
+    if(!first && (pose.counter == last_counter)){
+      continue;
+    }
+    if(!first && (pose.counter - last_counter > 1)){
+      res->dropped += pose.counter - last_counter - 1;
+    }
+    first = false;
+    last_counter = pose.counter;
+    ++res->poses;
+    if((age >= 0) && (res->samples < MAX_SAMPLES)){
+      res->lat[res->samples++] = age;
+    }
+  }
+  linuxtrack_shutdown();
+  _exit(0);
+}
+
+//Sums utime + stime (in clock ticks) of the ltr_server1 master and of its slaves
+static void server_cpu(int64_t *master, int64_t *slaves)
+{
+  *master = 0;
+  *slaves = 0;
+  DIR *proc = opendir("/proc");
+  if(proc == NULL){
+    return;
+  }
+  struct dirent *de;
+  char path[300];
+  char buf[1024];
+  while((de = readdir(proc)) != NULL){
+    if((de->d_name[0] < '0') || (de->d_name[0] > '9')){
+      continue;
+    }
+    snprintf(path, sizeof(path), "/proc/%s/cmdline", de->d_name);
+    FILE *f = fopen(path, "r");
+    if(f == NULL){
+      continue;
+    }
+    size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[len] = '\0';
+    const char *name = strrchr(buf, '/');
+    name = (name != NULL) ? name + 1 : buf;
+    if(strcmp(name, "ltr_server1") != 0){
+      continue;
+    }
+    bool is_master = (strlen(buf) + 1 >= len);
+    snprintf(path, sizeof(path), "/proc/%s/stat", de->d_name);
+    f = fopen(path, "r");
+    if(f == NULL){
+      continue;
+    }
+    len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[len] = '\0';
+    //Fields after the command name; utime and stime are 12th and 13th of them
+    char *p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if((p == NULL) ||
+       (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)){
+      continue;
+    }
+    if(is_master){
+      *master += utime + stime;
+    }else{
+      *slaves += utime + stime;
+    }
+  }
+  closedir(proc);
+}
+
+//Ten seconds of a three point model swaying in front of a 640x480 camera
+static char *synthetic_recording(void)
+{
+  char *fname = ltr_int_my_strdup("/tmp/fanout_bench.XXXXXX");
+  int fd = mkstemp(fname);
+  FILE *f = (fd >= 0) ? fdopen(fd, "wb") : NULL;
+  if(f == NULL){
+    perror(fname);
+    free(fname);
+    return NULL;
+  }
+  frame_rec_hdr_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  strncpy(hdr.magic, FRAME_REC_MAGIC, sizeof(hdr.magic));
+  hdr.version = FRAME_REC_VERSION;
+  bool ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1);
+  static const float model[3][2] = {{0.0f, 60.0f}, {-50.0f, -20.0f}, {50.0f, -20.0f}};
+  uint32_t i, b;
+  for(i = 0; ok && (i < 1200); ++i){
+    frame_rec_t rec = {.ts_ns = i * 1000000000LL / 120, .counter = i + 1, .width = 640,
+                       .height = 480, .num_blobs = 3, .bitmap_size = 0, .reserved = 0};
+    frame_rec_blob_t blobs[3];
+    float dx = 80.0f * sinf(i * 0.02f);
+    float dy = 40.0f * sinf(i * 0.013f);
+    for(b = 0; b < 3; ++b){
+      blobs[b].x = model[b][0] + dx;
+      blobs[b].y = model[b][1] + dy;
+      blobs[b].score = 100;
+    }
+    ok = (fwrite(&rec, sizeof(rec), 1, f) == 1) && (fwrite(blobs, sizeof(blobs), 1, f) == 1);
+  }
+  if((fclose(f) != 0) || !ok){
+    perror(fname);
+    unlink(fname);
+    free(fname);
+    return NULL;
+  }
+  return fname;
+}
+
+static int cmp(const void *a, const void *b)
+{
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void run(int n, int seconds)
+{
+  int i;
+  pid_t pids[MAX_CLIENTS];
+  memset(shared, 0, sizeof(shared_t));
+  for(i = 0; i < n; ++i){
+    pids[i] = fork();
+    if(pids[i] == 0){
+      client(i);
+    }
+  }
+  for(i = 0; i < n; ++i){
+    while(!__atomic_load_n(&(shared->client[i].ready), __ATOMIC_ACQUIRE)){
+      ltr_int_usleep(10000);
+    }
+  }
+  //Let the pose stream settle
+  ltr_int_usleep(500000);
+  int64_t master0, slaves0, master1, slaves1;
+  server_cpu(&master0, &slaves0);
+  int64_t start = ltr_int_get_ts_ns();
+  shared->go = 1;
+  sleep(seconds);
+  shared->stop = 1;
+  server_cpu(&master1, &slaves1);
+  double elapsed = (ltr_int_get_ts_ns() - start) / 1e9;
+  for(i = 0; i < n; ++i){
+    waitpid(pids[i], NULL, 0);
+  }
+
+  static int64_t lat[MAX_CLIENTS * MAX_SAMPLES];
+  int64_t samples = 0, poses = 0, dropped = 0;
+  int ok = 0;
+  for(i = 0; i < n; ++i){
+    client_res_t *res = &(shared->client[i]);
+    if(res->failed){
+      continue;
+    }
+    ++ok;
+    memcpy(lat + samples, res->lat, res->samples * sizeof(int64_t));
+    samples += res->samples;
+    poses += res->poses;
+    dropped += res->dropped;
+  }
+  if((ok == 0) || (samples == 0)){
+    printf("%3d clients: no poses received\n", n);
+    return;
+  }
+  qsort(lat, samples, sizeof(int64_t), cmp);
+  double tick = sysconf(_SC_CLK_TCK) * elapsed / 100.0;
+  printf("%3d %8.1f %8.1f %8.1f %8.1f %9.1f %7.2f %8.1f %8.1f\n", n,
+         poses / elapsed / ok,
+         lat[samples / 2] / 1e3, lat[samples * 9 / 10] / 1e3, lat[samples * 99 / 100] / 1e3,
+         lat[samples - 1] / 1e3,
+         100.0 * dropped / (poses + dropped),
+         (master1 - master0) / tick, (slaves1 - slaves0) / tick);
+  fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *recording = NULL;
+  bool use_device = false;
+  int opt;
+  while((opt = getopt(argc, argv, "r:d")) != -1){
+    switch(opt){
+      case 'r':
+        recording = optarg;
+        break;
+      case 'd':
+        use_device = true;
+        break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+  int args = argc - optind;
+  int max_clients = (args > 0) ? atoi(argv[optind]) : MAX_CLIENTS;
+  int seconds = (args > 1) ? atoi(argv[optind + 1]) : 5;
+  profile = (args > 2) ? argv[optind + 2] : NULL;
+  if((args < 0) || (args > 3) || (max_clients < 1) || (max_clients > MAX_CLIENTS) ||
+     (seconds < 1) || (use_device && (recording != NULL))){
+    fprintf(stderr, "Usage: %s [-r recording | -d] [max_clients(1-%d)] [seconds_per_step] [profile]\n",
+            argv[0], MAX_CLIENTS);
+    return 1;
+  }
+  char *synthetic = NULL;
+  if(!use_device){
+    if(recording == NULL){
+      if((synthetic = synthetic_recording()) == NULL){
+        return 1;
+      }
+      recording = synthetic;
+    }
+    //Inherited by the master the first client starts
+    setenv("LINUXTRACK_FRAME_REPLAY", recording, 1);
+  }
+  shared = (shared_t *)mmap(NULL, sizeof(shared_t), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(shared == MAP_FAILED){
+    perror("mmap");
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  printf("  N  poses/s   p50 us   p90 us   p99 us    max us  drop %%  master%%  slaves%%\n");
+  fflush(stdout);
+  int n;
+  for(n = 1; n < max_clients; n *= 2){
+    run(n, seconds);
+  }
+  run(max_clients, seconds);
+  if(synthetic != NULL){
+    unlink(synthetic);
+    free(synthetic);
+  }
+  return 0;
+}
@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <cal.h>
+#include <frame_recorder.h>
+#include <tracking.h>
+#include <pref.h>
+#include <utils.h>
+
+/*
+ * Replays a frame recording through the pose computation, without any
+ *   hardware attached.
+ *
+ * Recordings are made by running the tracker with LINUXTRACK_FRAME_RECORD
+ *   set to the file name (any driver); LINUXTRACK_FRAME_RECORD_BITMAPS=n
+ *   keeps the bitmap of every n-th frame (0 for none, 1 by default).
+ *
+ * Prints a summary (frames, dropped frames, rate); with -v, every frame is
+ *   printed (blobs and pose). With -p prefix, the recorded bitmaps are
+ *   written out as prefixNNNNNN.pgm.
+ *
+ * Usage: frame_replay [-v] [-p prefix] recording
+ */
+
+static bool write_pgm(const char *prefix, uint32_t counter, const unsigned char *bitmap,
+                      uint32_t w, uint32_t h)
+{
+  char name[1024];
+  snprintf(name, sizeof(name), "%s%06u.pgm", prefix, counter);
+  FILE *f = fopen(name, "wb");
+  if(f == NULL){
+    perror(name);
+    return false;
+  }
+  fprintf(f, "P5\n%u %u\n255\n", w, h);
+  bool res = (fwrite(bitmap, 1, w * h, f) == w * h);
+  fclose(f);
+  return res;
+}
+
+int main(int argc, char *argv[])
+{
+  bool verbose = false;
+  const char *prefix = NULL;
+  int opt;
+  while((opt = getopt(argc, argv, "vp:")) != -1){
+    switch(opt){
+      case 'v':
+        verbose = true;
+        break;
+      case 'p':
+        prefix = optarg;
+        break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+  if(optind != argc - 1){
+    fprintf(stderr, "Usage: %s [-v] [-p prefix] recording\n", argv[0]);
+    return 1;
+  }
+  FILE *f = fopen(argv[optind], "rb");
+  if(f == NULL){
+    perror(argv[optind]);
+    return 1;
+  }
+  frame_rec_hdr_t hdr;
+  if(!ltr_int_frame_rec_read_hdr(f, &hdr)){
+    fprintf(stderr, "%s is not a frame recording.\n", argv[optind]);
+    fclose(f);
+    return 1;
+  }
+  bool do_pose = true;
+  if(!ltr_int_read_prefs(NULL, false) || !ltr_int_init_tracking()){
+    fprintf(stderr, "Can't set up the pose computation, listing frames only.\n");
+    do_pose = false;
+  }
+
+  //Large enough for any of the supported cameras
+  size_t bitmap_size = 1280 * 1024;
+  unsigned char *bitmap = (unsigned char *)ltr_int_my_malloc(bitmap_size);
+  struct blob_type blobs[MAX_BLOBS];
+  struct frame_type frame = {
+    .bloblist = {.expected_blobs = 3, .blobs = blobs}
+  };
+  frame_rec_t rec;
+  uint64_t frames = 0, bitmaps = 0, poses = 0, gaps = 0;
+  int64_t first_ts = 0, last_ts = 0;
+  uint32_t last_counter = 0;
+  while(ltr_int_frame_rec_read(f, &rec, blobs, bitmap, bitmap_size)){
+    if(frames == 0){
+      first_ts = rec.ts_ns;
+    }else if(rec.counter - last_counter > 1){
+      gaps += rec.counter - last_counter - 1;
+    }
+    last_counter = rec.counter;
+    last_ts = rec.ts_ns;
+    ++frames;
+    frame.bloblist.num_blobs = rec.num_blobs;
+    frame.width = rec.width;
+    frame.height = rec.height;
+    frame.counter = rec.counter;
+    frame.ts_ns = rec.ts_ns;
+    frame.bitmap = NULL;
+    linuxtrack_full_pose_t full;
+    bool have_pose = false;
+    if(do_pose){
+      have_pose = (ltr_int_update_pose(&frame) == 0);
+      ltr_int_tracking_get_pose(&full);
+      if(have_pose){
+        ++poses;
+      }
+    }
+    if(rec.bitmap_size > 0){
+      ++bitmaps;
+      if(prefix != NULL){
+        write_pgm(prefix, rec.counter, bitmap, rec.width, rec.height);
+      }
+    }
+    if(verbose){
+      unsigned int b;
+      printf("%6u %10.3f %u", rec.counter, (rec.ts_ns - hdr.start_ns) / 1e6, rec.num_blobs);
+      for(b = 0; b < rec.num_blobs; ++b){
+        printf(" %.2f,%.2f,%d", blobs[b].x, blobs[b].y, blobs[b].score);
+      }
+      if(have_pose){
+        printf(" | %.3f %.3f %.3f %.2f %.2f %.2f", full.pose.raw_pitch, full.pose.raw_yaw,
+               full.pose.raw_roll, full.pose.raw_tx, full.pose.raw_ty, full.pose.raw_tz);
+      }
+      printf("\n");
+    }
+  }
+  fclose(f);
+  free(bitmap);
+
+  if(!verbose){
+    double span = (last_ts - first_ts) / 1e9;
+    printf("%s: %llu frames (%llu with bitmap, %llu not recorded) in %.2f s (%.1f fps)",
+           argv[optind], (unsigned long long)frames, (unsigned long long)bitmaps,
+           (unsigned long long)gaps, span, (span > 0) ? (frames + gaps - 1) / span : 0.0);
+    if(do_pose){
+      printf(", %llu poses", (unsigned long long)poses);
+    }
+    printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <pose_ring.h>
+#include <utils.h>
+
+/*
+ * Compares the new-pose notification through the notify pipe (one byte
+ *   written per pose, reader polls and drains) with the futex wait on
+ *   the shared pose counter.
+ *   Reports the wake-up latency (publish -> reader running) and the cost
+ *   of publishing when nobody waits.
+ */
+
+#define SAMPLES 2000
+#define PERIOD_US 1000
+
+static int pipe_fd[2];
+static uint32_t seq = 0;
+static uint32_t waiters = 0;
+static volatile int64_t publish_ts;
+static int64_t lat[SAMPLES];
+static int samples;
+static bool use_futex;
+static bool done;
+
+static void publish(void)
+{
+  publish_ts = ltr_int_get_ts_ns();
+  if(use_futex){
+    __atomic_add_fetch(&seq, 1, __ATOMIC_SEQ_CST);
+    ltr_int_seq_wake(&seq, &waiters);
+  }else{
+    uint8_t tmp = 0;
+    if(write(pipe_fd[1], &tmp, 1) < 0){
+      perror("write");
+    }
+  }
+}
+
+//Several publishes can land before the reader runs (one wake-up for all
+//  of them), so it counts the wake-ups it actually got until told to stop
+static void *reader(void *param)
+{
+  (void) param;
+  uint32_t last = 0;
+  while(!__atomic_load_n(&done, __ATOMIC_ACQUIRE)){
+    if(use_futex){
+      if(ltr_int_seq_wait(&seq, &waiters, last, 100) == 0){
+        continue;
+      }
+      last = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+    }else{
+      struct pollfd pfd = {.fd = pipe_fd[0], .events = POLLIN, .revents = 0};
+      if(poll(&pfd, 1, 100) <= 0){
+        continue;
+      }
+      uint8_t tmp[64];
+      while(read(pipe_fd[0], tmp, sizeof(tmp)) > 0);
+    }
+    int64_t latency = ltr_int_get_ts_ns() - publish_ts;
+    if(!__atomic_load_n(&done, __ATOMIC_ACQUIRE) && (samples < SAMPLES)){
+      lat[samples++] = latency;
+    }
+  }
+  return NULL;
+}
+
+static int cmp(const void *a, const void *b)
+{
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void run(bool futex)
+{
+  int i;
+  pthread_t tid;
+  use_futex = futex;
+  seq = 0;
+  samples = 0;
+  done = false;
+  pthread_create(&tid, NULL, reader, NULL);
+  usleep(10000);
+  for(i = 0; i < SAMPLES; ++i){
+    publish();
+    usleep(PERIOD_US);
+  }
+  __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+  //Wake the reader up in case it is waiting
+  publish();
+  pthread_join(tid, NULL);
+  if(samples == 0){
+    printf("%-6s no wake-ups\n", futex ? "futex" : "pipe");
+  }else{
+    qsort(lat, samples, sizeof(int64_t), cmp);
+    printf("%-6s wake-up latency: median %6.1f us, p99 %6.1f us, max %7.1f us (%d of %d wake-ups)\n",
+           futex ? "futex" : "pipe", lat[samples / 2] / 1e3, lat[samples * 99 / 100] / 1e3,
+           lat[samples - 1] / 1e3, samples, SAMPLES);
+  }
+
+  //Publishing with no reader around
+  const int n = 100000;
+  int64_t start = ltr_int_get_ts_ns();
+  for(i = 0; i < n; ++i){
+    publish();
+    if(!futex && ((i & 1023) == 0)){
+      uint8_t tmp[1024];
+      while(read(pipe_fd[0], tmp, sizeof(tmp)) > 0);
+    }
+  }
+  printf("%-6s publish without waiters: %6.1f ns\n", futex ? "futex" : "pipe",
+         (double)(ltr_int_get_ts_ns() - start) / n);
+}
+
+int main(int argc, char *argv[])
+{
+  (void) argc;
+  (void) argv;
+  if(pipe(pipe_fd) < 0){
+    perror("pipe");
+    return 1;
+  }
+  fcntl(pipe_fd[0], F_SETFL, fcntl(pipe_fd[0], F_GETFL) | O_NONBLOCK);
+  fcntl(pipe_fd[1], F_SETFL, fcntl(pipe_fd[1], F_GETFL) | O_NONBLOCK);
+  run(false);
+  run(true);
+  return 0;
+}
@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <cal.h>
+#include <usb_capture.h>
+#include <tir_hw.h>
+#include <tir_img.h>
+#include <image_process.h>
+#include <tracking.h>
+#include <pref.h>
+#include <tir_driver_prefs.h>
+#include <utils.h>
+
+/*
+ * Replays a binary USB capture of a TrackIR/SmartNav session through the
+ *   decoder, the blob extraction and the pose computation, without any
+ *   hardware attached.
+ *
+ * Captures are made by running the tracker with LINUXTRACK_USB_CAPTURE set
+ *   to the file name; the device type is stored in the capture.
+ *
+ * Without -v, the time spent in each stage is reported; -n repeats the
+ *   capture the given number of times, -t keeps repeating it for at least
+ *   the given number of seconds (for throughput measurements). With -v,
+ *   every frame is printed (blobs and pose), the output of two builds can
+ *   be diffed to catch regressions.
+ * The blob limits and the model come from the preferences, the same way
+ *   the tracker gets them; with -b, only the blobs are computed (with the
+ *   default limits).
+ *
+ * Usage: tir_replay [-v] [-b] [-n passes(1)] [-t seconds] capture
+ */
+
+typedef struct{
+  unsigned char *data;
+  size_t size;
+  int64_t ts_ns;
+} transfer_t;
+
+static transfer_t *transfers = NULL;
+static size_t num_transfers = 0;
+static size_t total_bytes = 0;
+
+static bool load_capture(const char *fname, usb_capture_hdr_t *hdr)
+{
+  FILE *f = fopen(fname, "rb");
+  if(f == NULL){
+    perror(fname);
+    return false;
+  }
+  if(!ltr_int_usb_capture_read_hdr(f, hdr)){
+    fprintf(stderr, "%s is not a USB capture.\n", fname);
+    fclose(f);
+    return false;
+  }
+  static unsigned char buf[TIR_PACKET_SIZE];
+  usb_capture_rec_t rec;
+  size_t allocated = 0;
+  while(ltr_int_usb_capture_read_rec(f, &rec, buf, sizeof(buf))){
+    //Only the data coming from the device matter for the decoder
+    if((rec.dir != USB_CAPTURE_IN) || (rec.size == 0)){
+      continue;
+    }
+    if(num_transfers == allocated){
+      allocated = (allocated == 0) ? 1024 : allocated * 2;
+      transfers = (transfer_t *)realloc(transfers, allocated * sizeof(transfer_t));
+    }
+    transfers[num_transfers].data = (unsigned char *)ltr_int_my_malloc(rec.size);
+    memcpy(transfers[num_transfers].data, buf, rec.size);
+    transfers[num_transfers].size = rec.size;
+    transfers[num_transfers].ts_ns = rec.ts_ns;
+    ++num_transfers;
+    total_bytes += rec.size;
+  }
+  fclose(f);
+  return num_transfers > 0;
+}
+
+int main(int argc, char *argv[])
+{
+  bool verbose = false;
+  bool do_pose = true;
+  int passes = 1;
+  int seconds = 0;
+  int opt;
+  while((opt = getopt(argc, argv, "vbn:t:")) != -1){
+    switch(opt){
+      case 'v':
+        verbose = true;
+        break;
+      case 'b':
+        do_pose = false;
+        break;
+      case 'n':
+        passes = atoi(optarg);
+        break;
+      case 't':
+        seconds = atoi(optarg);
+        break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+  if((optind != argc - 1) || (passes < 1) || (seconds < 0)){
+    fprintf(stderr, "Usage: %s [-v] [-b] [-n passes] [-t seconds] capture\n", argv[0]);
+    return 1;
+  }
+  usb_capture_hdr_t hdr;
+  if(!load_capture(argv[optind], &hdr)){
+    fprintf(stderr, "No data transfers in %s\n", argv[optind]);
+    return 1;
+  }
+  tir_info info;
+  if(!ltr_int_get_tir_info_for((dev_found)hdr.dev_type, &info)){
+    fprintf(stderr, "Unsupported device type %d in the capture.\n", hdr.dev_type);
+    return 1;
+  }
+  int min_blob = 4, max_blob = 1024;
+  if(do_pose){
+    if(!ltr_int_read_prefs(NULL, false) || !ltr_int_init_tracking()){
+      fprintf(stderr, "Can't set up the pose computation, computing blobs only.\n");
+      do_pose = false;
+    }else if(ltr_int_tir_init_prefs()){
+      min_blob = ltr_int_tir_get_min_blob();
+      max_blob = ltr_int_tir_get_max_blob();
+    }
+  }
+  ltr_int_tir_decoder_init(info.dev_type);
+  ltr_int_prepare_for_processing(info.width, info.height);
+
+  unsigned char *bitmap = (unsigned char *)ltr_int_my_malloc(info.width * info.height);
+  image_t img = {
+    .bitmap = bitmap,
+    .w = info.width,
+    .h = info.height,
+    .ratio = info.hf
+  };
+  struct blob_type blobs[MAX_BLOBS];
+  struct frame_type frame = {
+    .bloblist = {.expected_blobs = 3, .blobs = blobs},
+    .width = info.width,
+    .height = info.height,
+    .bitmap = bitmap
+  };
+
+  uint64_t frames = 0, poses = 0;
+  int64_t t_decode = 0, t_blobs = 0, t_pose = 0;
+  int64_t start = ltr_int_get_ts_ns();
+  int64_t end = start + (int64_t)seconds * 1000000000LL;
+  int pass;
+  for(pass = 0; (pass < passes) || (ltr_int_get_ts_ns() < end); ++pass){
+    size_t i;
+    for(i = 0; i < num_transfers; ++i){
+      size_t ptr = 0;
+      while(ptr < transfers[i].size){
+        int64_t t0 = ltr_int_get_ts_ns();
+        bool have_frame = ltr_int_tir_decode(&img, transfers[i].data, &ptr, transfers[i].size);
+        int64_t t1 = ltr_int_get_ts_ns();
+        t_decode += t1 - t0;
+        if(!have_frame){
+          break;
+        }
+        int res = ltr_int_stripes_to_blobs(MAX_BLOBS, &(frame.bloblist), min_blob, max_blob, &img);
+        int64_t t2 = ltr_int_get_ts_ns();
+        t_blobs += t2 - t1;
+        memset(bitmap, 0, info.width * info.height);
+        frame.counter = frames++;
+        frame.ts_ns = transfers[i].ts_ns;
+        linuxtrack_full_pose_t full;
+        bool have_pose = false;
+        if(do_pose && (res == 0)){
+          have_pose = (ltr_int_update_pose(&frame) == 0);
+          ltr_int_tracking_get_pose(&full);
+          t_pose += ltr_int_get_ts_ns() - t2;
+          if(have_pose){
+            ++poses;
+          }
+        }
+        if(verbose && (pass == 0)){
+          unsigned int b;
+          printf("%6llu %10.3f %u", (unsigned long long)frame.counter,
+                 (frame.ts_ns - hdr.start_ns) / 1e6, frame.bloblist.num_blobs);
+          for(b = 0; b < frame.bloblist.num_blobs; ++b){
+            printf(" %.2f,%.2f,%d", blobs[b].x, blobs[b].y, blobs[b].score);
+          }
+          if(have_pose){
+            printf(" | %.3f %.3f %.3f %.2f %.2f %.2f", full.pose.raw_pitch, full.pose.raw_yaw,
+                   full.pose.raw_roll, full.pose.raw_tx, full.pose.raw_ty, full.pose.raw_tz);
+          }
+          printf("\n");
+        }
+      }
+    }
+  }
+  double elapsed = (ltr_int_get_ts_ns() - start) / 1e9;
+  passes = pass;
+
+  if(!verbose){
+    double captured = (transfers[num_transfers - 1].ts_ns - transfers[0].ts_ns) / 1e9;
+    uint64_t per_pass = frames / passes;
+    printf("%s: %zu transfers, %zu bytes, %llu frames in %.2f s of capture (%.1f fps)\n",
+           argv[optind], num_transfers, total_bytes, (unsigned long long)per_pass, captured,
+           (captured > 0) ? per_pass / captured : 0.0);
+    if(frames > 0){
+      printf("%d passes in %.3f s: %.0f frames/s, %.1f MB/s\n", passes, elapsed,
+             frames / elapsed, (double)passes * total_bytes / elapsed / 1e6);
+      printf("per frame: decode %.2f us  blobs %.2f us", t_decode / 1e3 / frames,
+             t_blobs / 1e3 / frames);
+      if(do_pose){
+        printf("  pose %.2f us (%llu poses)", t_pose / 1e3 / frames, (unsigned long long)poses);
+      }
+      printf("\n");
+    }
+  }
+  ltr_int_cleanup_after_processing();
+  free(bitmap);
+  size_t i;
+  for(i = 0; i < num_transfers; ++i){
+    free(transfers[i].data);
+  }
+  free(transfers);
+  return 0;
+}
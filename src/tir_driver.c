@@ -21,6 +21,10 @@ prepare_device_fun *ltr_int_prepare_device = NULL;
 send_data_fun *ltr_int_send_data = NULL;
 receive_data_fun *ltr_int_receive_data = NULL;
 finish_usb_fun *ltr_int_finish_usb = NULL;
+stream_start_fun *ltr_int_stream_start = NULL;
+stream_read_fun *ltr_int_stream_read = NULL;
+stream_release_fun *ltr_int_stream_release = NULL;
+stream_stop_fun *ltr_int_stream_stop = NULL;
 
 static lib_fun_def_t functions[] = {
   {(char *)"ltr_int_init_usb", (void*) &ltr_int_init_usb},
@@ -31,6 +35,14 @@ static lib_fun_def_t functions[] = {
   {(char *)"ltr_int_finish_usb", (void*) &ltr_int_finish_usb},
   {NULL, NULL}
 };
+//Not provided by the older usb libraries
+static lib_fun_def_t optional_functions[] = {
+  {(char *)"ltr_int_stream_start", (void*) &ltr_int_stream_start},
+  {(char *)"ltr_int_stream_read", (void*) &ltr_int_stream_read},
+  {(char *)"ltr_int_stream_release", (void*) &ltr_int_stream_release},
+  {(char *)"ltr_int_stream_stop", (void*) &ltr_int_stream_stop},
+  {NULL, NULL}
+};
 static void *libhandle = NULL;
 
 void flag_pref_changed(void *flag_ptr)
@@ -39,10 +51,13 @@ void flag_pref_changed(void *flag_ptr)
 }
 
 static int last_threshold = -1;
+//Start of the initialization, reset once the first frame arrives
+static int64_t init_ts = 0;
 
 int ltr_int_tracker_init(struct camera_control_block *ccb)
 {
   ltr_int_log_message("Initializing the tracker.\n");
+  init_ts = ltr_int_get_ts_ns();
   assert(ccb != NULL);
   assert((ccb->device.category == tir) || (ccb->device.category == tir_open));
   last_threshold = -1;
@@ -57,6 +72,7 @@ int ltr_int_tracker_init(struct camera_control_block *ccb)
     ltr_int_log_message("Problem loading library %s!\n", libname);
     return -1;
   }
+  ltr_int_load_optional(libhandle, optional_functions);
   if(!ltr_int_tir_init_prefs()){
     ltr_int_log_message("Problem initializing TrackIr prefs!\n");
     return -1;
@@ -64,10 +80,12 @@ int ltr_int_tracker_init(struct camera_control_block *ccb)
 
   ltr_int_log_message("Lib loaded, prefs read...\n");
   if(ltr_int_open_tir(false, !ltr_int_is_model_active())){
+    ltr_int_log_message("Camera open in %.1f ms.\n", (ltr_int_get_ts_ns() - init_ts) / 1e6);
     tir_info info;
     ltr_int_get_tir_info(&info);
     ccb->pixel_width = info.width;
     ccb->pixel_height = info.height;
+    ltr_int_tir_decoder_init(info.dev_type);
     ltr_int_prepare_for_processing(ccb->pixel_width, ccb->pixel_height);
     return 0;
   }else{
@@ -107,14 +125,20 @@ int ltr_int_tracker_get_frame(struct camera_control_block *ccb, struct frame_typ
     last_threshold = tmp_thr;
     ltr_int_set_threshold_tir(tmp_thr);
   }
-  int res = ltr_int_read_blobs_tir(&(f->bloblist), ltr_int_tir_get_min_blob(), 
-				ltr_int_tir_get_max_blob(), &img, &info);
+  int res = ltr_int_read_blobs_tir(&(f->bloblist), ltr_int_tir_get_min_blob(),
+				ltr_int_tir_get_max_blob(), &img, &info, &(f->ts_ns));
+  if((init_ts != 0) && (res >= 0) && (f->ts_ns > init_ts)){
+    ltr_int_log_message("Cold start: first frame %.1f ms after init.\n",
+                        (ltr_int_get_ts_ns() - init_ts) / 1e6);
+    init_ts = 0;
+  }
   *frame_acquired = true;
   return res;
 }
 
 int ltr_int_tracker_pause()
 {
+  ltr_int_stop_stream_tir();
   return ltr_int_pause_tir() ? 0 : -1;
 }
 
@@ -125,8 +149,10 @@ int ltr_int_tracker_resume()
 
 int ltr_int_tracker_close()
 {
+  ltr_int_stop_stream_tir();
   int res = ltr_int_close_tir() ? 0 : -1;;
   ltr_int_cleanup_after_processing();
+  ltr_int_unload_optional(optional_functions);
   ltr_int_unload_library(libhandle, functions);
   libhandle = NULL;
   return res;
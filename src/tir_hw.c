@@ -96,6 +96,7 @@ typedef struct{
 unsigned char ltr_int_packet[TIR_PACKET_SIZE];
 static void switch_red(bool state);
 static void switch_green(bool state);
+static const char *firmware_file(dev_found dev);
 
 static bool ltr_int_open_sn4_pipe()
 {
@@ -313,9 +314,8 @@ static bool read_rom_data_tir()
 
 
 
-static bool load_firmware(firmware_t *fw)
+static bool inflate_firmware(const char *fw_path, firmware_t *fw)
 {
-  assert(fw != NULL);
   gzFile f;
   unsigned int tsize = FW_SIZE_INCREMENT;
   unsigned char *tbuf = ltr_int_my_malloc(tsize);
@@ -324,15 +324,12 @@ static bool load_firmware(firmware_t *fw)
   size_t *size = &(fw->size);
   *size = 0;
 
-  char *fw_path = ltr_int_find_firmware(device);
-  ltr_int_log_message("Loading firmware '%s'\n", fw_path);
   f = gzopen(fw_path, "rb");
   if(f == NULL){
     ltr_int_log_message("Couldn't open firmware (%s)!\n", fw_path);
-    free(fw_path);
+    free(tbuf);
     return false;
   }
-  free(fw_path);
 
   while(1){
     bytesRead = gzread(f, ptr, FW_SIZE_INCREMENT);
@@ -351,7 +348,6 @@ static bool load_firmware(firmware_t *fw)
   if(tbuf != NULL){
     fw->firmware = tbuf;
     cksum_firmware(fw);
-    ltr_int_log_message("Size: %d  Cksum: %04X\n", fw->size, fw->cksum);
     return true;
   }else{
     fw->firmware = NULL;
@@ -359,6 +355,129 @@ static bool load_firmware(firmware_t *fw)
   }
 }
 
+/*
+ * The inflated firmware and its checksum are cached in the config directory;
+ *   the cache is valid as long as the crc and size of the .fw.gz match.
+ */
+#define FW_CACHE_MAGIC "LTRFWC1"
+
+typedef struct{
+  char magic[8];
+  uint32_t src_crc;
+  uint32_t src_size;
+  uint32_t size;
+  uint32_t cksum;
+} fw_cache_hdr_t;
+
+static bool hash_file(const char *path, uint32_t *crc, uint32_t *size)
+{
+  FILE *f = fopen(path, "rb");
+  if(f == NULL){
+    return false;
+  }
+  unsigned char buf[16384];
+  size_t len;
+  uLong c = crc32(0L, Z_NULL, 0);
+  *size = 0;
+  while((len = fread(buf, 1, sizeof(buf), f)) > 0){
+    c = crc32(c, buf, len);
+    *size += len;
+  }
+  bool res = !ferror(f);
+  fclose(f);
+  *crc = c;
+  return res;
+}
+
+static bool read_fw_cache(const char *cache, uint32_t crc, uint32_t src_size, firmware_t *fw)
+{
+  FILE *f = fopen(cache, "rb");
+  if(f == NULL){
+    return false;
+  }
+  fw_cache_hdr_t hdr;
+  bool res = false;
+  if((fread(&hdr, sizeof(hdr), 1, f) == 1) &&
+     (strncmp(hdr.magic, FW_CACHE_MAGIC, sizeof(hdr.magic)) == 0) &&
+     (hdr.src_crc == crc) && (hdr.src_size == src_size)){
+    fw->firmware = ltr_int_my_malloc(hdr.size);
+    fw->size = hdr.size;
+    fw->cksum = hdr.cksum;
+    if(fread(fw->firmware, 1, hdr.size, f) == hdr.size){
+      res = true;
+    }else{
+      free(fw->firmware);
+      fw->firmware = NULL;
+    }
+  }
+  fclose(f);
+  return res;
+}
+
+static void write_fw_cache(const char *cache, uint32_t crc, uint32_t src_size, firmware_t *fw)
+{
+  fw_cache_hdr_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  strncpy(hdr.magic, FW_CACHE_MAGIC, sizeof(hdr.magic));
+  hdr.src_crc = crc;
+  hdr.src_size = src_size;
+  hdr.size = fw->size;
+  hdr.cksum = fw->cksum;
+  //Write aside and rename, so that nobody sees a partial cache
+  char *tmp = ltr_int_my_malloc(strlen(cache) + 5);
+  sprintf(tmp, "%s.tmp", cache);
+  FILE *f = fopen(tmp, "wb");
+  if(f != NULL){
+    bool ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1) &&
+              (fwrite(fw->firmware, 1, fw->size, f) == fw->size);
+    ok = (fclose(f) == 0) && ok;
+    if(!ok || (rename(tmp, cache) != 0)){
+      ltr_int_log_message("Couldn't write firmware cache '%s'!\n", cache);
+      unlink(tmp);
+    }
+  }
+  free(tmp);
+}
+
+static bool load_firmware(firmware_t *fw)
+{
+  assert(fw != NULL);
+  char *fw_path = ltr_int_find_firmware(device);
+  if(fw_path == NULL){
+    ltr_int_log_message("Couldn't find firmware!\n");
+    return false;
+  }
+  ltr_int_log_message("Loading firmware '%s'\n", fw_path);
+  int64_t start = ltr_int_get_ts_ns();
+  uint32_t crc = 0, src_size = 0;
+  bool hashed = hash_file(fw_path, &crc, &src_size);
+  char *cache = NULL;
+  if(hashed){
+    char cache_file[64];
+    snprintf(cache_file, sizeof(cache_file), "%s.cache", firmware_file(device));
+    cache = ltr_int_get_default_file_name(cache_file);
+  }
+  bool res;
+  const char *source;
+  if((cache != NULL) && read_fw_cache(cache, crc, src_size, fw)){
+    source = "cache";
+    res = true;
+  }else{
+    source = fw_path;
+    res = inflate_firmware(fw_path, fw);
+    if(res && (cache != NULL)){
+      write_fw_cache(cache, crc, src_size, fw);
+    }
+  }
+  if(res){
+    ltr_int_log_message("Size: %d  Cksum: %04X (from %s in %.2f ms)\n", fw->size, fw->cksum,
+                        source, (ltr_int_get_ts_ns() - start) / 1e6);
+  }
+  free(cache);
+  free(fw_path);
+  return res;
+}
+
 
 static bool upload_firmware(firmware_t *fw)
 {
@@ -876,6 +995,8 @@ static bool init_camera_tir4(bool force_fw_load, bool p_ir_on)
 
   if(force_fw_load | (!status.fw_loaded) | (status.fw_cksum != firmware.cksum)){
     upload_firmware(&firmware);
+  }else{
+    ltr_int_log_message("Firmware already loaded, skipping the upload.\n");
   }
 
   if(!read_status_tir(&status)){
@@ -919,7 +1040,6 @@ static bool init_camera_tir4(bool force_fw_load, bool p_ir_on)
 
 static bool init_camera_tir5(bool force_fw_load, bool p_ir_on)
 {
-  (void) force_fw_load;
   tir_status_t status;
   ir_on = p_ir_on;
 
@@ -929,13 +1049,17 @@ static bool init_camera_tir5(bool force_fw_load, bool p_ir_on)
   control_ir_led_tir(true);
   flush_fifo_tir();
   set_exposure(0x18F);
-  read_status_tir(&status);
+  bool have_status = read_status_tir(&status);
   firmware_t firmware;
   if(!load_firmware(&firmware)){
     ltr_int_log_message("Error loading firmware!\n");
     return false;
   }
-  upload_firmware(&firmware);
+  if(force_fw_load || !have_status || !status.fw_loaded || (status.fw_cksum != firmware.cksum)){
+    upload_firmware(&firmware);
+  }else{
+    ltr_int_log_message("Firmware already loaded, skipping the upload.\n");
+  }
   free(firmware.firmware);
   ltr_int_send_data(out_ep, unk_7,sizeof(unk_7));
   flush_fifo_tir();
@@ -1031,11 +1155,13 @@ static bool init_camera_sn4(bool force_fw_load, bool p_ir_on)
 
     }else if(status.cfg_flag != 2){
       ltr_int_log_message("SmatrNav4 configuration problem!\n");
+      free(firmware.firmware);
       return false;
     }
-
-    free(firmware.firmware);
+  }else{
+    ltr_int_log_message("Firmware already loaded, skipping the upload.\n");
   }
+  free(firmware.firmware);
   if(ltr_int_open_sn4_pipe()){
     ltr_int_log_message("SN4 fifo opened successfully!\n");
   }else{
@@ -1072,6 +1198,29 @@ bool init_camera_tir(bool force_fw_load, bool p_ir_on)
   return tir_iface->init_camera_tir(force_fw_load, p_ir_on);
 }
 
+static tir_interface *get_iface(dev_found device)
+{
+  switch(device){
+    case TIR2:
+      return &tir2;
+    case TIR3:
+      return &tir3;
+    case TIR4:
+      return &tir4;
+    case TIR5:
+    case TIR5V2:
+      return &tir5;
+    case TIR5V3:
+      return &tir5v3;
+    case SMARTNAV4:
+      return &smartnav4;
+    case SMARTNAV3:
+      return &smartnav3;
+    default:
+      return NULL;
+  }
+}
+
 bool ltr_int_open_tir(bool force_fw_load, bool switch_ir_on)
 {
   if(!ltr_int_init_usb()){
@@ -1102,34 +1251,12 @@ bool ltr_int_open_tir(bool force_fw_load, bool switch_ir_on)
     return false;
   }
   ltr_int_log_message("Device %d.\n", device);
-  switch(device){
-    case TIR2:
-      tir_iface = &tir2;
-      break;
-    case TIR3:
-      tir_iface = &tir3;
-      break;
-    case TIR4:
-      tir_iface = &tir4;
-      break;
-    case TIR5:
-    case TIR5V2:
-      tir_iface = &tir5;
-      break;
-    case TIR5V3:
-      ltr_int_log_message("Initializing TrackIR 5 revision 3.\n");
-      tir_iface = &tir5v3;
-      break;
-    case SMARTNAV4:
-      tir_iface = &smartnav4;
-      break;
-    case SMARTNAV3:
-      tir_iface = &smartnav3;
-      break;
-    default:
-      ltr_int_log_message("No device!\n");
-      return false;
-      break;
+  if(device == TIR5V3){
+    ltr_int_log_message("Initializing TrackIR 5 revision 3.\n");
+  }
+  if((tir_iface = get_iface(device)) == NULL){
+    ltr_int_log_message("No device!\n");
+    return false;
   }
   if(!init_camera_tir(force_fw_load, switch_ir_on)){
     return false;
@@ -1295,6 +1422,17 @@ void ltr_int_get_tir_info(tir_info *info)
   tir_iface->get_tir_info(info);
 }
 
+//Same as ltr_int_get_tir_info, for a device that isn't open (replays)
+bool ltr_int_get_tir_info_for(dev_found device, tir_info *info)
+{
+  tir_interface *iface = get_iface(device);
+  if(iface == NULL){
+    return false;
+  }
+  iface->get_tir_info(info);
+  return true;
+}
+
 static void switch_green(bool state)
 {
   if(state){
@@ -1333,41 +1471,36 @@ static void switch_ir(bool state)
 }
 */
 
-char *ltr_int_find_firmware(dev_found dev)
+static const char *firmware_file(dev_found dev)
 {
-  const char *fw_file;
   switch(dev){
     case TIR3:
     case TIR2:
     case SMARTNAV3:
     case TIR5V3:
       //no firmware needed
-      fw_file = NULL;
-      break;
+      return NULL;
     case TIR4:
-      fw_file = "tir4.fw.gz";
-      break;
+      return "tir4.fw.gz";
     case TIR5:
-      fw_file = "tir5.fw.gz";
-      break;
+      return "tir5.fw.gz";
     case TIR5V2:
-      fw_file = "tir5v2.fw.gz";
-      break;
+      return "tir5v2.fw.gz";
     case SMARTNAV4:
-      fw_file = "sn4.fw.gz";
-      break;
+      return "sn4.fw.gz";
     default:
       ltr_int_log_message("Unknown device!\n");
-      return false;
-      break;
+      return NULL;
   }
-  char *fw_path;
-  if(fw_file != NULL){
-    fw_path = ltr_int_get_resource_path("tir_firmware", fw_file);
-  }else{
-    fw_path = NULL;
+}
+
+char *ltr_int_find_firmware(dev_found dev)
+{
+  const char *fw_file = firmware_file(dev);
+  if(fw_file == NULL){
+    return NULL;
   }
-  return fw_path;
+  return ltr_int_get_resource_path("tir_firmware", fw_file);
 }
 
 static tir_interface tir2 = {
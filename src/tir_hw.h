@@ -23,6 +23,7 @@ typedef struct {
 }tir_info;
 
 void ltr_int_get_tir_info(tir_info *info);
+bool ltr_int_get_tir_info_for(dev_found device, tir_info *info);
 char *ltr_int_find_firmware(dev_found device);
 extern int ltr_int_data_in_ep; 
 
@@ -1,5 +1,6 @@
 #include "list.h"
 #include <stdio.h>
+#include <string.h>
 #include "usb_ifc.h"
 #include "tir_hw.h"
 #include "tir_img.h"
@@ -7,65 +8,168 @@
 #include "image_process.h"
 #include "sn4_com.h"
 #include <assert.h>
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+//Stripes of one packet are collected here and handed to the labeler at once
+#define MAX_BATCH_STRIPES 1024
+
+typedef struct tir_decoder tir_decoder_t;
+
+//Decodes the body of a packet; returns true when a frame is complete
+typedef bool (*packet_fun_t)(tir_decoder_t *dec, unsigned char data[], size_t *ptr,
+                             unsigned int pktsize, unsigned int limit);
+
+typedef enum {LEN_PREFIXED, TIR5_FRAMED, WHOLE_TRANSFER} framing_t;
+
+typedef struct{
+  bool valid;
+  framing_t framing;
+  packet_fun_t body;   //NULL for packets without stripes (status, device info)
+  bool resumable;      //body can stop in the middle of the packet at a frame boundary
+} packet_type_t;
+
+struct tir_decoder{
+  dev_found device;
+  packet_type_t types[256]; //indexed by the packet type byte
+  //Framing state; a packet can span several transfers
+  int type;
+  unsigned int limit;
+  unsigned int pktsize;
+  unsigned int current_line;
+  unsigned int pkt_no;
+  unsigned char prev_btns;
+  image_t *img;
+  size_t count;
+  stripe_t stripes[MAX_BATCH_STRIPES];
+};
+
+static tir_decoder_t decoder;
+
+static void flush_stripes(tir_decoder_t *dec)
+{
+  if(dec->count > 0){
+    ltr_int_add_stripes(dec->stripes, dec->count, dec->img);
+    dec->count = 0;
+  }
+}
 
-static unsigned int pkt_no = 0;
-static image_t *p_img = NULL;
-static unsigned int current_line = 0;
-static dev_found device = NOT_TIR;
+static inline stripe_t *new_stripe(tir_decoder_t *dec)
+{
+  if(dec->count >= MAX_BATCH_STRIPES){
+    flush_stripes(dec);
+  }
+  return &(dec->stripes[dec->count++]);
+}
 
-static bool process_stripe_tir2(unsigned char p_stripe[])
+static void decode_stripe_tir2(tir_decoder_t *dec, const unsigned char p_stripe[])
 {
-  stripe_t stripe;
-    stripe.vline = p_stripe[0];
-    stripe.hstart = p_stripe[1];
-    stripe.hstop = p_stripe[2];
-    stripe.sum = stripe.hstop - stripe.hstart + 1;
-    stripe.sum_x = (unsigned int)(stripe.sum * (stripe.sum - 1) / 2.0);
-    stripe.points = stripe.sum;
-    if(!ltr_int_add_stripe(&stripe, p_img)){
-      ltr_int_log_message("Couldn't add stripe!\n");
-    }
-  return true;
+  stripe_t *stripe = new_stripe(dec);
+  stripe->vline = p_stripe[0];
+  stripe->hstart = p_stripe[1];
+  stripe->hstop = p_stripe[2];
+  stripe->sum = stripe->hstop - stripe->hstart + 1;
+  stripe->sum_x = (unsigned int)(stripe->sum * (stripe->sum - 1) / 2.0);
+  stripe->points = stripe->sum;
+}
+
+static void decode_stripe_sn4(tir_decoder_t *dec, const unsigned char p_stripe[])
+{
+  stripe_t *stripe = new_stripe(dec);
+  unsigned char rest = p_stripe[3];
+  stripe->vline = p_stripe[0];
+  stripe->hstart = p_stripe[1];
+  stripe->hstop = p_stripe[2];
+  if(rest & 0x01)
+    stripe->hstop |= 0x100;
+  if(rest & 0x02)
+    stripe->hstart |= 0x100;
+  if(rest & 0x04)
+    stripe->vline |= 0x100;
+  if(rest & 0x08)
+    stripe->hstop |= 0x200;
+  if(rest & 0x10)
+    stripe->hstart |= 0x200;
+  if(rest & 0x20)
+    stripe->vline |= 0x200;
+  if(rest & 0x40)
+    stripe->hstop |= 0x400;
+  if(rest & 0x80)
+    stripe->hstart |= 0x400;
+  stripe->sum = stripe->hstop - stripe->hstart + 1;
+  stripe->sum_x = (unsigned int)(stripe->sum * (stripe->sum - 1) / 2.0);
+  stripe->points = stripe->sum;
 }
-static bool process_stripe_sn4(unsigned char p_stripe[])
+
+/*
+ * Scans a run of greyscale pixels terminated by zero, at most avail bytes;
+ *   returns false if there's no terminator (the outputs then cover all
+ *   avail bytes). Computes the sum and the
+ *   position weighted sum (first pixel has weight 1) in the same pass,
+ *   16 pixels at a time where SSE2 is available.
+ */
+static bool scan_run(const unsigned char p[], size_t avail, size_t *points,
+                     unsigned int *sum, unsigned int *sum_x)
 {
-  stripe_t stripe;
-  unsigned char rest;
-
-    stripe.vline = p_stripe[0];
-    stripe.hstart = p_stripe[1];
-    stripe.hstop = p_stripe[2];
-    rest = p_stripe[3];
-    if(rest & 0x01)
-      stripe.hstop |= 0x100;
-    if(rest & 0x02)
-      stripe.hstart |= 0x100;
-    if(rest & 0x04)
-      stripe.vline |= 0x100;
-    if(rest & 0x08)
-      stripe.hstop |= 0x200;
-    if(rest & 0x10)
-      stripe.hstart |= 0x200;
-    if(rest & 0x20)
-      stripe.vline |= 0x200;
-    if(rest & 0x40)
-      stripe.hstop |= 0x400;
-    if(rest & 0x80)
-      stripe.hstart |= 0x400;
-    stripe.sum = stripe.hstop - stripe.hstart + 1;
-    stripe.sum_x = (unsigned int)(stripe.sum * (stripe.sum - 1) / 2.0);
-    stripe.points = stripe.sum;
-    if(!ltr_int_add_stripe(&stripe, p_img)){
-      ltr_int_log_message("Couldn't add stripe!\n");
+  unsigned int s = 0, sx = 0;
+  size_t k = 0;
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i idx = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  const __m128i w_lo = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m128i w_hi = _mm_setr_epi16(8, 9, 10, 11, 12, 13, 14, 15);
+  for(; k + 16 <= avail; k += 16){
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + k));
+    unsigned int zeros = _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+    unsigned int len = 16;
+    if(zeros != 0){
+      //Mask out the terminator and whatever follows it
+      len = __builtin_ctz(zeros);
+      v = _mm_and_si128(v, _mm_cmplt_epi8(idx, _mm_set1_epi8(len)));
     }
-  return true;
+    __m128i sad = _mm_sad_epu8(v, zero);
+    unsigned int cs = _mm_cvtsi128_si32(sad) + _mm_cvtsi128_si32(_mm_srli_si128(sad, 8));
+    __m128i m = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(v, zero), w_lo),
+                              _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), w_hi));
+    m = _mm_add_epi32(m, _mm_srli_si128(m, 8));
+    m = _mm_add_epi32(m, _mm_srli_si128(m, 4));
+    sx += (k + 1) * cs + _mm_cvtsi128_si32(m);
+    s += cs;
+    if(zeros != 0){
+      *points = k + len;
+      *sum = s;
+      *sum_x = sx;
+      return true;
+    }
+  }
+#endif
+  for(; k < avail; ++k){
+    if(p[k] == 0){
+      *points = k;
+      *sum = s;
+      *sum_x = sx;
+      return true;
+    }
+    s += p[k];
+    sx += (k + 1) * p[k];
+  }
+  *points = avail;
+  *sum = s;
+  *sum_x = sx;
+  return false;
 }
 
-static bool process_stripe_sn4gr(unsigned char p_stripe[], size_t size)
+/*
+ * Greyscale stripes: hstart, vline, high bits, then the (already thresholded)
+ *   pixels of the run, terminated by zero.
+ * The camera doesn't always terminate the last run; the packet length
+ *   trailer right after the stripes (p_stripe[size], always present) starts
+ *   with a zero byte and serves as the terminator then.
+ */
+static bool decode_stripes_sn4gr(tir_decoder_t *dec, const unsigned char p_stripe[], size_t size)
 {
-  stripe_t stripe;
-  unsigned char rest;
-  size_t i, j;
+  size_t i;
   unsigned int last_vline = 0;
 
   if(size < 4){
@@ -74,139 +178,90 @@ static bool process_stripe_sn4gr(unsigned char p_stripe[], size_t size)
   i = 0;
 
   while(i < (size - 4)){
-    stripe.hstart = p_stripe[i];
-    stripe.vline = p_stripe[i + 1];
-    rest = p_stripe[i + 2];
-    if(rest & 0x01)
-      stripe.hstart |= 0x100;
-    if(rest & 0x02)
-      stripe.hstart |= 0x200;
-    if(rest & 0x04)
-      stripe.vline |= 0x100;
-    stripe.sum = stripe.sum_x = 0;
-    if(stripe.vline < last_vline){
-//      printf("%d x %d!!!!\n", stripe.vline, last_vline);
-//      for(i = 0; i < size; ++i){
-//        printf("%02X ", p_stripe[i]);
-//      }
+    unsigned char rest = p_stripe[i + 2];
+    unsigned int hstart = p_stripe[i] | ((rest & 0x03) << 8);
+    unsigned int vline = p_stripe[i + 1] | ((rest & 0x04) << 6);
+    if(vline < last_vline){
       break;
     }
-    last_vline = stripe.vline;
+    last_vline = vline;
     i += 3;
-    j = 1;
-    while((p_stripe[i] != 0)&&(i < size)){
-      stripe.sum += p_stripe[i];
-      stripe.sum_x += (j * p_stripe[i]);
-      ++i;
-      ++j;
-    }
-    stripe.points = j - 1;
-    stripe.hstop = stripe.hstart + stripe.points - 1;
-    if(p_stripe[i] == 0){
-      ++i;
-      //printf("%ld x (%d %d) y %d (%d points)\n", i, stripe.hstart,
-      //  stripe.hstop, stripe.vline, stripe.points);
-      if(!ltr_int_add_stripe(&stripe, p_img)){
-        ltr_int_log_message("Couldn't add stripe!\n");
-      }
-    }else{
+    size_t points;
+    unsigned int sum, sum_x;
+    if(!scan_run(&(p_stripe[i]), size - i, &points, &sum, &sum_x) && (p_stripe[size] != 0)){
       //reached the end of packet...
-      //printf(">> %02X <<(%ld %ld)\n", p_stripe[i], i, size);
       break;
     }
-
+    stripe_t *stripe = new_stripe(dec);
+    stripe->hstart = hstart;
+    stripe->vline = vline;
+    stripe->points = points;
+    stripe->hstop = hstart + points - 1;
+    stripe->sum = sum;
+    stripe->sum_x = sum_x;
+    i += points + 1;
   }
   return true;
 }
 
+static void decode_stripe_tir4(tir_decoder_t *dec, const unsigned char p_stripe[])
+{
+  stripe_t *stripe = new_stripe(dec);
+  unsigned char rest = p_stripe[3];
+  stripe->vline = p_stripe[0];
+  stripe->hstart = p_stripe[1];
+  stripe->hstop = p_stripe[2];
+  if(rest & 0x20)
+    stripe->vline |= 0x100;
+  if(rest & 0x80)
+    stripe->hstart |= 0x100;
+  if(rest & 0x40)
+    stripe->hstop |= 0x100;
+  if(rest & 0x10)
+    stripe->hstart |= 0x200;
+  if(rest & 0x08)
+    stripe->hstop |= 0x200;
+  stripe->sum = stripe->hstop - stripe->hstart + 1;
+  stripe->sum_x = (unsigned int)(stripe->sum * (stripe->sum - 1) / 2.0);
+  stripe->points = stripe->sum;
+}
 
-
-static bool process_stripe_tir4(unsigned char p_stripe[])
+static void decode_stripe_tir5(tir_decoder_t *dec, const unsigned char payload[])
 {
-  stripe_t stripe;
-  unsigned char rest;
-
-    stripe.vline = p_stripe[0];
-    stripe.hstart = p_stripe[1];
-    stripe.hstop = p_stripe[2];
-    rest = p_stripe[3];
-    if(rest & 0x20)
-      stripe.vline |= 0x100;
-    if(rest & 0x80)
-      stripe.hstart |= 0x100;
-    if(rest & 0x40)
-      stripe.hstop |= 0x100;
-    if(rest & 0x10)
-      stripe.hstart |= 0x200;
-    if(rest & 0x08)
-      stripe.hstop |= 0x200;
-//    assert(stripe.hstart >= 81);
-//    assert(stripe.hstop >= 81);
-//    assert(stripe.vline >= 12);
-//    stripe.hstart -= 81;
-//    stripe.vline -= 12;
-//    stripe.hstop -= 81;
-    stripe.sum = stripe.hstop - stripe.hstart + 1;
-    stripe.sum_x = (unsigned int)(stripe.sum * (stripe.sum - 1) / 2.0);
-    stripe.points = stripe.sum;
-    if(!ltr_int_add_stripe(&stripe, p_img)){
-      ltr_int_log_message("Couldn't add stripe!\n");
-    }
-//    ltr_int_log_message("Stripe: %d\t\t%d\t\t%d %d %d %d\n", stripe.hstart, stripe.hstop, stripe.vline, stripe.sum,
-//           stripe.sum_x, stripe.points);
-  return true;
+  stripe_t *stripe = new_stripe(dec);
+  stripe->hstart = (((unsigned int)payload[0]) << 2) |
+                   (((unsigned int)payload[1]) >> 6);
+  stripe->vline = ((((unsigned int)payload[1]) & 0x3F) << 3) |
+                  ((((unsigned int)payload[2]) & 0xE0) >> 5);
+  stripe->points = (((((unsigned int)payload[2]) & 0x1F) << 5) |
+                  (((unsigned int)payload[3]) >> 3));
+  stripe->hstop =  stripe->points + stripe->hstart - 1;
+  stripe->sum_x = (((unsigned int)payload[3]) & 7) << 17 |
+                  (((unsigned int)payload[4]) << 9) |
+                  ((unsigned int)payload[5]) << 1 |
+                  ((unsigned int)payload[6]) >>7;
+  stripe->sum = (((unsigned int)payload[6]) & 0x7F) << 8 |
+                 ((unsigned int)payload[7]);
 }
 
-static bool is_next_frame_tir(unsigned char p_stripe[])
+static bool is_next_frame_tir(tir_decoder_t *dec, const unsigned char p_stripe[])
 {
   unsigned int vline = p_stripe[0];
-  bool res;
   if(p_stripe[3] & 0x20)
     vline |= 0x100;
-  if(vline < current_line){
-    res = true;
-  }else{
-    res = false;
-  }
-  current_line = vline;
+  bool res = (vline < dec->current_line);
+  dec->current_line = vline;
   return res;
 }
 
-static bool is_next_frame_tir2(unsigned char p_stripe[])
+static bool is_next_frame_tir2(tir_decoder_t *dec, const unsigned char p_stripe[])
 {
   unsigned int vline = p_stripe[0];
-  bool res;
-  if(vline < current_line){
-    res = true;
-  }else{
-    res = false;
-  }
-  current_line = vline;
+  bool res = (vline < dec->current_line);
+  dec->current_line = vline;
   return res;
 }
 
-static bool process_stripe_tir5(unsigned char payload[])
-{
-  stripe_t stripe;
-    stripe.hstart = (((unsigned int)payload[0]) << 2) |
-                     (((unsigned int)payload[1]) >> 6);
-    stripe.vline = ((((unsigned int)payload[1]) & 0x3F) << 3) |
-                    ((((unsigned int)payload[2]) & 0xE0) >> 5);
-    stripe.points = (((((unsigned int)payload[2]) & 0x1F) << 5) |
-                    (((unsigned int)payload[3]) >> 3));
-    stripe.hstop =  stripe.points + stripe.hstart - 1;
-    stripe.sum_x = (((unsigned int)payload[3]) & 7) << 17 |
-                    (((unsigned int)payload[4]) << 9) |
-		    ((unsigned int)payload[5]) << 1 |
-		    ((unsigned int)payload[6]) >>7;
-    stripe.sum = (((unsigned int)payload[6]) & 0x7F) << 8 |
-                   ((unsigned int)payload[7]);
-    if(!ltr_int_add_stripe(&stripe, p_img)){
-      ltr_int_log_message("Couldn't add stripe!\n");
-    }
-  return true;
-}
-
 static bool check_paket_header_tir5(unsigned char data[])
 {
   if((data[0] ^ data[1] ^ data[2] ^ data[3]) != 0xAA){
@@ -232,8 +287,8 @@ static bool check_paket_header_sn4(unsigned char data[])
   }
 }
 
-
-static bool process_packet_tir5(unsigned char data[], size_t *ptr, unsigned int pktsize, int limit)
+static bool process_packet_tir5(tir_decoder_t *dec, unsigned char data[], size_t *ptr,
+                                unsigned int pktsize, unsigned int limit)
 {
   bool have_frame = false;
   unsigned int ps = 0;
@@ -250,32 +305,24 @@ static bool process_packet_tir5(unsigned char data[], size_t *ptr, unsigned int
     ps = (ps << 8) + data[limit - 1];
     if(ps != (pktsize - 8)){
       ltr_int_log_message("Bad packet size! %d x %d\n", ps, pktsize - 8);
-//      assert(0);
       return false;
     }
   }
 
   switch(type){
     case 0:
+      dec->pkt_no = data[*ptr];
+      *ptr += 4;
+      for(; ps >= 4; ps -= 4, *ptr += 4){
+        decode_stripe_tir4(dec, &(data[*ptr]));
+      }
+      have_frame = true;
+      break;
     case 5:
-      pkt_no = data[*ptr];
+      dec->pkt_no = data[*ptr];
       *ptr += 4;
-      while(1){
-	if(type == 0){
-          if(ps < 4){
-            break;
-          }
-	  process_stripe_tir4((unsigned char *)&(data[*ptr]));
-	  *ptr += 4;
-          ps -= 4;
-	}else{
-          if(ps < 8){
-            break;
-          }
-	  process_stripe_tir5((unsigned char *)&(data[*ptr]));
-	  *ptr += 8;
-          ps -= 8;
-	}
+      for(; ps >= 8; ps -= 8, *ptr += 8){
+        decode_stripe_tir5(dec, &(data[*ptr]));
       }
       have_frame = true;
       break;
@@ -287,11 +334,11 @@ static bool process_packet_tir5(unsigned char data[], size_t *ptr, unsigned int
   return have_frame;
 }
 
-static bool process_packet_sn4(unsigned char data[], size_t *ptr, unsigned int pktsize, int limit)
+static bool process_packet_sn4(tir_decoder_t *dec, unsigned char data[], size_t *ptr,
+                               unsigned int pktsize, unsigned int limit)
 {
   bool have_frame = false;
   unsigned int ps = 0;
-  static unsigned char prev_btns = 3;
   unsigned char btns = data[*ptr];
   unsigned char type = data[*ptr + 1];
 
@@ -310,13 +357,12 @@ static bool process_packet_sn4(unsigned char data[], size_t *ptr, unsigned int p
     return false;
   }
 
-  if(btns != prev_btns){
+  if(btns != dec->prev_btns){
     sn4_btn_event_t ev;
     ev.btns = btns;
-    prev_btns = btns;
+    dec->prev_btns = btns;
     gettimeofday(&(ev.timestamp), NULL);
     ltr_int_send_sn4_data((void*)&ev, sizeof(ev));
-//    printf("Sending %d!\n", btns);
   }
 
   ps -= 8; // header
@@ -325,23 +371,20 @@ static bool process_packet_sn4(unsigned char data[], size_t *ptr, unsigned int p
       if(ps > 8){
         ps -= 4; //skip threshold
         *ptr += (4 + 8); //header + threshold
-        have_frame = process_stripe_sn4gr((unsigned char *)&(data[*ptr]), ps);
+        have_frame = decode_stripes_sn4gr(dec, &(data[*ptr]), ps);
       }else{
         have_frame = false;
       }
       *ptr += limit;
       break;
     case 0:
-      pkt_no = data[*ptr+4];
-      pkt_no = (pkt_no << 8) + data[*ptr+5];
-      pkt_no = (pkt_no << 8) + data[*ptr+6];
-      pkt_no = (pkt_no << 8) + data[*ptr+7];
-      //printf("%d\n", pkt_no);
+      dec->pkt_no = data[*ptr+4];
+      dec->pkt_no = (dec->pkt_no << 8) + data[*ptr+5];
+      dec->pkt_no = (dec->pkt_no << 8) + data[*ptr+6];
+      dec->pkt_no = (dec->pkt_no << 8) + data[*ptr+7];
       *ptr += 8;
-      while(ps > 0){
-        process_stripe_sn4((unsigned char *)&(data[*ptr]));
-	*ptr += 4;
-        ps -= 4;
+      for(; ps > 0; ps -= 4, *ptr += 4){
+        decode_stripe_sn4(dec, &(data[*ptr]));
       }
       *ptr += 4;
       have_frame = true;
@@ -353,210 +396,225 @@ static bool process_packet_sn4(unsigned char data[], size_t *ptr, unsigned int p
   return have_frame;
 }
 
-static bool process_packet_tir4(unsigned char data[], size_t *ptr, int pktsize, unsigned int limit)
+static bool process_packet_tir4(tir_decoder_t *dec, unsigned char data[], size_t *ptr,
+                                unsigned int pktsize, unsigned int limit)
 {
-  (void) pktsize;
-  unsigned int *ui;
   bool have_frame = false;
-
-  ui = (unsigned int *)&(data[*ptr]);
-  bool go_on = true;
-  do{
-    if(*ui == 0){
-      current_line = 0;
+  while(1){
+    const unsigned char *stripe = &(data[*ptr]);
+    if((stripe[0] | stripe[1] | stripe[2] | stripe[3]) == 0){
+      dec->current_line = 0;
       have_frame = true;
-      go_on = false;
-      ++ui;
       (*ptr) += 4;
-    }else if(is_next_frame_tir((unsigned char *)ui)){
+    }else if(is_next_frame_tir(dec, stripe)){
       have_frame = true;
-      go_on = false;
     }else{
-//      log_message("\t%02X%02X%02X%02X\n", data[*ptr], data[*ptr + 1],
-//             data[*ptr + 2], data[*ptr + 3]);
-//!!!!      assert((data[*ptr + 3] & 7) == 0);
-      process_stripe_tir4((unsigned char *)ui);
-      ++ui;
+      decode_stripe_tir4(dec, stripe);
       (*ptr) += 4;
     }
     if(*ptr >= limit){
-//      log_message(">>>  size %d, limit %d, ptr %d\n", pktsize, limit, *ptr);
-      go_on = false;
       if(pktsize == 0x3E){
-	*ptr += 2;
+        *ptr += 2;
       }
+      break;
+    }
+    if(have_frame){
+      break;
     }
-  }while(go_on);
+  }
   return have_frame;
 }
 
-
-static bool process_packet_tir2(unsigned char data[], size_t *ptr, int pktsize, unsigned int limit)
+static bool process_packet_tir2(tir_decoder_t *dec, unsigned char data[], size_t *ptr,
+                                unsigned int pktsize, unsigned int limit)
 {
-  (void) pktsize;
-  uint8_t *ui;
   bool have_frame = false;
-
-  ui = (uint8_t *)&(data[*ptr]);
-  bool go_on = true;
-  do{
-    if((ui[0] == 0) && (ui[1] == 0) && (ui[2] == 0)){
-      current_line = 0;
+  while(1){
+    const unsigned char *stripe = &(data[*ptr]);
+    if((stripe[0] == 0) && (stripe[1] == 0) && (stripe[2] == 0)){
+      dec->current_line = 0;
       have_frame = true;
-      go_on = false;
-      ui += 3;
       (*ptr) += 3;
-    }else if(is_next_frame_tir2(ui)){
+    }else if(is_next_frame_tir2(dec, stripe)){
       ltr_int_log_message("Have frame!!!!!!\n");
       have_frame = true;
-      go_on = false;
     }else{
-//      log_message("\t%02X%02X%02X%02X\n", data[*ptr], data[*ptr + 1],
-//             data[*ptr + 2], data[*ptr + 3]);
-//!!!!      assert((data[*ptr + 3] & 7) == 0);
-      process_stripe_tir2((unsigned char *)ui);
-      ui += 3;
+      decode_stripe_tir2(dec, stripe);
       (*ptr) += 3;
     }
     if(*ptr >= limit){
-//      log_message(">>>  size %d, limit %d, ptr %d\n", pktsize, limit, *ptr);
-      go_on = false;
       if(pktsize == 0x3E){
-	*ptr += 2;
+        *ptr += 2;
       }
+      break;
     }
-  }while(go_on);
+    if(have_frame){
+      break;
+    }
+  }
   return have_frame;
 }
 
+static void set_type(tir_decoder_t *dec, unsigned char type, framing_t framing,
+                     packet_fun_t body, bool resumable)
+{
+  dec->types[type] = (packet_type_t){.valid = true, .framing = framing, .body = body,
+                                     .resumable = resumable};
+}
 
-bool process_packet(unsigned char data[], size_t *ptr, size_t size)
+//Selects the packet handlers for the device; called once the device is known
+void ltr_int_tir_decoder_init(dev_found device)
 {
-  static int type = -1;
-  static unsigned int limit = -1;
-  static int pktsize = 0;
-  bool have_frame;
+  tir_decoder_t *dec = &decoder;
+  memset(dec->types, 0, sizeof(dec->types));
+  dec->device = device;
+  dec->type = -1;
+  dec->limit = -1;
+  dec->pktsize = 0;
+  dec->current_line = 0;
+  dec->pkt_no = 0;
+  dec->prev_btns = 3;
+  dec->count = 0;
+  set_type(dec, 0x20, LEN_PREFIXED, NULL, false);  //status
+  set_type(dec, 0x40, LEN_PREFIXED, NULL, false);  //device info
+  set_type(dec, 0x1C, LEN_PREFIXED,
+           (device == TIR2) ? process_packet_tir2 : process_packet_tir4, true);
+  set_type(dec, 0x10, TIR5_FRAMED, process_packet_tir5, false);
+  set_type(dec, 0x00, WHOLE_TRANSFER, process_packet_sn4, false); //SmartNav4 normal data
+  set_type(dec, 0x04, WHOLE_TRANSFER, process_packet_sn4, false); //SmartNav4 greyscale data
+}
 
+static bool decode(tir_decoder_t *dec, unsigned char data[], size_t *ptr, size_t size)
+{
   while(1){
     if(*ptr >= size){
       return false;
     }
-    have_frame = false;
-    if(type == -1){
-      type = data[(*ptr) + 1];
-//      log_message("Packet type %02X\n", type);
-      switch(type){
-        case 0x20:
-        case 0x40:
-        case 0x1C:
-          pktsize = data[*ptr];
-          limit= (*ptr) + pktsize;
+    if(dec->type == -1){
+      unsigned char type = data[(*ptr) + 1];
+      const packet_type_t *pt = &(dec->types[type]);
+      if(!pt->valid){
+        ltr_int_log_message("ERROR!!! ('%02X %02X')\n", data[*ptr], data[*ptr + 1]);
+        *ptr = size; //Read new packet...
+        return false;
+      }
+      dec->type = type;
+      switch(pt->framing){
+        case LEN_PREFIXED:
+          dec->pktsize = data[*ptr];
+          dec->limit = (*ptr) + dec->pktsize;
           *ptr += 2;
           break;
-        case 0x10:
+        case TIR5_FRAMED:
           if((data[(*ptr) + 2] == 0) || (data[(*ptr) + 2] == 5)){
-            pktsize = size;
-            limit= (*ptr) + pktsize;
+            dec->pktsize = size;
           }else{
-            pktsize = data[*ptr];
-            limit= (*ptr) + pktsize;
+            dec->pktsize = data[*ptr];
           }
+          dec->limit = (*ptr) + dec->pktsize;
           break;
-        case 0x00:
-        case 0x04:
-          pktsize = size;
-          limit= (*ptr) + pktsize;
-          break;
-
-        default:
-          ltr_int_log_message("ERROR!!! ('%02X %02X')\n", data[*ptr], data[*ptr + 1]);
-/*	  printf("Error at %d\n", *ptr);
-	  int counter;
-	  for(counter = 0; counter < size+2; ++counter){
-	    if(counter % 16 == 0){
-	      printf("\n%6d ", counter);
-	    }
-	    printf("%02X ", data[counter]);
-	  }
-	  printf("\n");
-*/
-          type = -1;
-	  *ptr = size; //Read new packet...
-          return false;
+        case WHOLE_TRANSFER:
+          dec->pktsize = size;
+          dec->limit = (*ptr) + dec->pktsize;
           break;
       }
     }
-    if(limit > size){
-      break; //we're supposed to read beyond read-in data...
+    if(dec->limit > size){
+      return false; //we're supposed to read beyond read-in data...
     }
-    switch(type){
-      case 0x20:
-        //Status packet
-        *ptr = limit;
-        type = -1;
-        break;
-      case 0x40:
-        //DevInfo packet
-        *ptr = limit;
-        type = -1;
-        break;
-      case 0x10:
-        //TIR5 packet
-        have_frame = process_packet_tir5(data, ptr, pktsize, limit);
-        *ptr = limit;
-        type = -1;
-        break;
-      case 0x1C:
-        //TIR4 packet
-        if(device == TIR2){
-          have_frame = process_packet_tir2(data, ptr, pktsize, limit);
-        }else{
-          have_frame = process_packet_tir4(data, ptr, pktsize, limit);
-        }
-	if(*ptr >= limit){
-          type = -1;
-	}
-        //log_message("   size %d, limit %d, ptr %d\n", pktsize, limit, *ptr);
-        break;
-      case 0x04: //SmartNav4 greyscale data
-      case 0x00: //SmartNav4 normal data
-        have_frame = process_packet_sn4(data, ptr, pktsize, limit);
-        *ptr = limit;
-        type = -1;
-        break;
-      default:
-        type = -1;
-        break;
+    const packet_type_t *pt = &(dec->types[dec->type]);
+    bool have_frame = false;
+    if(pt->body != NULL){
+      have_frame = pt->body(dec, data, ptr, dec->pktsize, dec->limit);
     }
-
-    if(have_frame == true){
-      break;
+    if(!pt->resumable){
+      *ptr = dec->limit;
+    }
+    if(*ptr >= dec->limit){
+      dec->type = -1;
+    }
+    if(have_frame){
+      return true;
     }
   }
+}
+
+/*
+ * Decodes the data from *ptr on, until a frame is complete (returns true)
+ *   or the data run out. The stripes found go to the labeler.
+ */
+bool ltr_int_tir_decode(image_t *img, unsigned char data[], size_t *ptr, size_t size)
+{
+  decoder.img = img;
+  bool have_frame = decode(&decoder, data, ptr, size);
+  flush_stripes(&decoder);
   return have_frame;
 }
 
 
+//Transfers kept queued on the data endpoint when the usb library can stream
+#define STREAM_TRANSFERS 4
 
+static unsigned char *packet = NULL;
+static size_t packet_size = 0;
+static size_t packet_ptr = 0;
+static int64_t packet_ts = 0;
+static bool streaming = false;
+static bool stream_failed = false;
 
-int ltr_int_read_blobs_tir(struct bloblist_type *blt, int min, int max, image_t *img, tir_info *info)
+static bool next_packet(void)
+{
+  packet_ptr = 0;
+  packet_size = 0;
+  if((ltr_int_stream_start != NULL) && !streaming && !stream_failed){
+    streaming = ltr_int_stream_start(ltr_int_data_in_ep, sizeof(ltr_int_packet), STREAM_TRANSFERS);
+    if(!streaming){
+      ltr_int_log_message("Couldn't start streaming, falling back to synchronous reads.\n");
+      stream_failed = true;
+    }
+  }
+  if(streaming){
+    return ltr_int_stream_read(&packet, &packet_size, &packet_ts, 1000);
+  }
+  packet = ltr_int_packet;
+  bool res = ltr_int_receive_data(ltr_int_data_in_ep, ltr_int_packet, sizeof(ltr_int_packet),
+                                  &packet_size, 1000);
+  packet_ts = ltr_int_get_ts_ns();
+  return res;
+}
+
+//Must be called before anything else talks to the device (pause, close...)
+void ltr_int_stop_stream_tir(void)
+{
+  if(streaming){
+    ltr_int_stream_stop();
+    streaming = false;
+  }
+  stream_failed = false;
+  packet = NULL;
+  packet_ptr = 0;
+  packet_size = 0;
+}
+
+int ltr_int_read_blobs_tir(struct bloblist_type *blt, int min, int max, image_t *img, tir_info *info,
+                           int64_t *ts_ns)
 {
   assert(blt != NULL);
   assert(img != NULL);
-  device = info->dev_type;
-  p_img = img;
-  static size_t size = 0;
-  static size_t ptr = 0;
+  if(decoder.device != info->dev_type){
+    ltr_int_tir_decoder_init(info->dev_type);
+  }
   bool have_frame = false;
   while(1){
-    if(ptr >= size){
-      ptr = 0;
-      if(!ltr_int_receive_data(ltr_int_data_in_ep, ltr_int_packet, sizeof(ltr_int_packet), &size, 1000)){
+    if(packet_ptr >= packet_size){
+      if(!next_packet()){
 	ltr_int_log_message("Problem reading data from USB!\n");
         return -1;
       }
     }
-    if((have_frame = process_packet(ltr_int_packet, &ptr, size)) == true){
+    if((have_frame = ltr_int_tir_decode(img, packet, &packet_ptr, packet_size)) == true){
+      //Completion time of the packet finishing the frame
+      *ts_ns = packet_ts;
       break;
     }
     if(ltr_int_got_new_request()){
@@ -5,6 +5,10 @@
 #include "image_process.h"
 #include "tir_hw.h"
 
-int ltr_int_read_blobs_tir(struct bloblist_type *blt, int min, int max, image_t *img, tir_info *info);
+int ltr_int_read_blobs_tir(struct bloblist_type *blt, int min, int max, image_t *img, tir_info *info,
+                           int64_t *ts_ns);
+void ltr_int_stop_stream_tir(void);
+void ltr_int_tir_decoder_init(dev_found device);
+bool ltr_int_tir_decode(image_t *img, unsigned char data[], size_t *ptr, size_t size);
 
 #endif
@@ -191,7 +191,7 @@ static int update_pose_1pt(struct frame_type *frame)
   current_pose.abs_pose.abs_ty = 0;
   current_pose.abs_pose.abs_tz = 0;
   current_pose.prev_timestamp = current_pose.timestamp;
-  current_pose.timestamp = frame->usec;
+  current_pose.timestamp = frame->ts_ns;
   pthread_mutex_unlock(&pose_mutex);
   //printf("Pose updated => rp: %g, ry: %g...\n", current_pose.raw_pitch, current_pose.raw_yaw);
   return 0;
@@ -248,7 +248,7 @@ static int update_absolute_pose(struct frame_type *frame)
   current_pose.abs_pose.abs_ty = frame->bloblist.blobs[2].x;
   current_pose.abs_pose.abs_tz = frame->bloblist.blobs[2].y;
   current_pose.prev_timestamp = current_pose.timestamp;
-  current_pose.timestamp = frame->usec;
+  current_pose.timestamp = frame->ts_ns;
   pthread_mutex_unlock(&pose_mutex);
   //printf("Pose updated => rp: %g, ry: %g...\n", current_pose.raw_pitch, current_pose.raw_yaw);
   return 0;
@@ -328,7 +328,7 @@ static int update_pose_3pt(struct frame_type *frame)
   current_pose.abs_pose.abs_ty = abs_pose.abs_ty;
   current_pose.abs_pose.abs_tz = abs_pose.abs_tz;
   current_pose.prev_timestamp = current_pose.timestamp;
-  current_pose.timestamp = frame->usec;
+  current_pose.timestamp = frame->ts_ns;
   pthread_mutex_unlock(&pose_mutex);
   if(raw_dbg_flag == DBG_ON){
     printf("*DBG_r* yaw: %g pitch: %g roll: %g\n", tmp_angles[0], tmp_angles[1], tmp_angles[2]);
@@ -339,15 +339,14 @@ static int update_pose_3pt(struct frame_type *frame)
   return 0;
 }
 
-bool ltr_int_postprocess_axes(ltr_axes_t axes, linuxtrack_pose_t *pose, linuxtrack_pose_t *unfiltered)
+//Filter states, indexed by enum axis_t
+static ltr_filter_state_t axis_filters[MISC];
+
+bool ltr_int_postprocess_axes(ltr_axes_t axes, linuxtrack_pose_t *pose, linuxtrack_pose_t *unfiltered,
+                              int64_t timestamp)
 {
 //  printf(">>Pre: %f %f %f  %f %f %f\n", pose->raw_pitch, pose->raw_yaw, pose->raw_roll,
 //         pose->raw_tx, pose->raw_ty, pose->raw_tz);
-//  static float filterfactor=1.0;
-//  ltr_int_get_filter_factor(&filterfactor);
-  static float filtered_angles[3] = {0.0f, 0.0f, 0.0f};
-  static float filtered_translations[3] = {0.0f, 0.0f, 0.0f};
-  //ltr_int_get_axes_ff(axes, filter_factors);
   double raw_angles[3];
 
   //Single point must be "denormalized"
@@ -361,9 +360,12 @@ bool ltr_int_postprocess_axes(ltr_axes_t axes, linuxtrack_pose_t *pose, linuxtra
     return false;
   }
 
-  pose->pitch = clamp_angle(ltr_int_filter_axis(axes, PITCH, raw_angles[0], &(filtered_angles[0])));
-  pose->yaw = clamp_angle(ltr_int_filter_axis(axes, YAW, raw_angles[1], &(filtered_angles[1])));
-  pose->roll = clamp_angle(ltr_int_filter_axis(axes, ROLL, raw_angles[2], &(filtered_angles[2])));
+  pose->pitch = clamp_angle(ltr_int_filter_axis_ts(axes, PITCH, raw_angles[0], timestamp,
+                                                     &(axis_filters[PITCH])));
+  pose->yaw = clamp_angle(ltr_int_filter_axis_ts(axes, YAW, raw_angles[1], timestamp,
+                                                   &(axis_filters[YAW])));
+  pose->roll = clamp_angle(ltr_int_filter_axis_ts(axes, ROLL, raw_angles[2], timestamp,
+                                                    &(axis_filters[ROLL])));
 
   double rotated[3];
   double transform[3][3];
@@ -394,16 +396,15 @@ bool ltr_int_postprocess_axes(ltr_axes_t axes, linuxtrack_pose_t *pose, linuxtra
   }
 
   pose->tx =
-    ltr_int_filter_axis(axes, TX, unfiltered->tx, &(filtered_translations[0]));
+    ltr_int_filter_axis_ts(axes, TX, unfiltered->tx, timestamp, &(axis_filters[TX]));
   pose->ty =
-    ltr_int_filter_axis(axes, TY, unfiltered->ty, &(filtered_translations[1]));
+    ltr_int_filter_axis_ts(axes, TY, unfiltered->ty, timestamp, &(axis_filters[TY]));
   pose->tz =
-    ltr_int_filter_axis(axes, TZ, unfiltered->tz, &(filtered_translations[2]));
+    ltr_int_filter_axis_ts(axes, TZ, unfiltered->tz, timestamp, &(axis_filters[TZ]));
   //printf(">>Post: %f %f %f  %f %f %f\n", pose->pitch, pose->yaw, pose->roll, pose->tx, pose->ty, pose->tz);
   return true;
 }
 
-
 static uint32_t counter_d = 0;
 
 int ltr_int_update_pose(struct frame_type *frame)
@@ -26,7 +26,8 @@ bool ltr_int_init_tracking();
 int ltr_int_update_pose(struct frame_type *frame);
 int ltr_int_recenter_tracking();
 int ltr_int_tracking_get_pose(linuxtrack_full_pose_t *pose);
-bool ltr_int_postprocess_axes(ltr_axes_t axes, linuxtrack_pose_t *pose, linuxtrack_pose_t *unfiltered);
+bool ltr_int_postprocess_axes(ltr_axes_t axes, linuxtrack_pose_t *pose, linuxtrack_pose_t *unfiltered,
+                              int64_t timestamp);
 /*
 double ltr_int_nonlinfilt(double x, 
               double y_minus_1,
@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include <string.h>
+#include "usb_capture.h"
+#include "async_writer.h"
+#include "utils.h"
+
+#define CAPTURE_BUFFER_SIZE (4 * 1024 * 1024)
+
+static async_writer_t *capture = NULL;
+
+bool ltr_int_usb_capture_open(const char *fname, uint32_t dev_type)
+{
+  if(capture != NULL){
+    ltr_int_usb_capture_close();
+  }
+  usb_capture_hdr_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  strncpy(hdr.magic, USB_CAPTURE_MAGIC, sizeof(hdr.magic));
+  hdr.version = USB_CAPTURE_VERSION;
+  hdr.dev_type = dev_type;
+  hdr.start_ns = ltr_int_get_ts_ns();
+  capture = ltr_int_async_writer_open(fname, "USB capture", &hdr, sizeof(hdr), CAPTURE_BUFFER_SIZE);
+  if(capture == NULL){
+    return false;
+  }
+  ltr_int_log_message("Capturing USB traffic to '%s'.\n", fname);
+  return true;
+}
+
+bool ltr_int_usb_capture_active(void)
+{
+  return capture != NULL;
+}
+
+void ltr_int_usb_capture_add(usb_capture_dir_t dir, uint8_t ep, const unsigned char data[],
+                             size_t size, int64_t ts_ns)
+{
+  if(capture == NULL){
+    return;
+  }
+  usb_capture_rec_t rec = {.ts_ns = ts_ns, .size = size, .dir = dir, .ep = ep, .reserved = 0};
+  const void *parts[] = {&rec, data};
+  size_t sizes[] = {sizeof(rec), size};
+  ltr_int_async_writer_put(capture, parts, sizes, 2);
+}
+
+void ltr_int_usb_capture_close(void)
+{
+  ltr_int_async_writer_close(capture);
+  capture = NULL;
+}
+
+bool ltr_int_usb_capture_read_hdr(FILE *f, usb_capture_hdr_t *hdr)
+{
+  if((fread(hdr, sizeof(*hdr), 1, f) != 1) ||
+     (strncmp(hdr->magic, USB_CAPTURE_MAGIC, sizeof(hdr->magic)) != 0)){
+    ltr_int_log_message("Not a USB capture!\n");
+    return false;
+  }
+  if(hdr->version != USB_CAPTURE_VERSION){
+    ltr_int_log_message("Unsupported USB capture version %d!\n", hdr->version);
+    return false;
+  }
+  return true;
+}
+
+//Reads the next record; the payload must fit in size bytes
+bool ltr_int_usb_capture_read_rec(FILE *f, usb_capture_rec_t *rec, unsigned char data[], size_t size)
+{
+  if(fread(rec, sizeof(*rec), 1, f) != 1){
+    return false;
+  }
+  if(rec->size > size){
+    ltr_int_log_message("USB capture record too big (%d bytes)!\n", rec->size);
+    return false;
+  }
+  return fread(data, 1, rec->size, f) == rec->size;
+}
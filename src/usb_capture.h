@@ -0,0 +1,57 @@
+#ifndef USB_CAPTURE__H
+#define USB_CAPTURE__H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Binary capture of the USB traffic of a device, for offline replay.
+ *
+ * The file starts with usb_capture_hdr_t, records follow back to back:
+ *   usb_capture_rec_t and size bytes of payload. Everything is in host
+ *   byte order. The capturing side only copies the payload into a memory
+ *   buffer; a background thread writes it out. When the buffer is full,
+ *   whole records are dropped (and counted) rather than stalling the device.
+ */
+#define USB_CAPTURE_MAGIC "LTRUSBC"
+#define USB_CAPTURE_VERSION 1
+
+typedef enum {USB_CAPTURE_IN = 0, USB_CAPTURE_OUT, USB_CAPTURE_CTRL} usb_capture_dir_t;
+
+typedef struct{
+  char magic[8];
+  uint32_t version;
+  uint32_t dev_type;   //dev_found of the captured device
+  int64_t start_ns;    //ltr_int_get_ts_ns() when the capture started
+} usb_capture_hdr_t;
+
+typedef struct{
+  int64_t ts_ns;       //completion time of the transfer
+  uint32_t size;       //payload bytes following the record
+  uint8_t dir;         //usb_capture_dir_t
+  uint8_t ep;
+  uint16_t reserved;
+} usb_capture_rec_t;
+
+//Writing side
+bool ltr_int_usb_capture_open(const char *fname, uint32_t dev_type);
+bool ltr_int_usb_capture_active(void);
+void ltr_int_usb_capture_add(usb_capture_dir_t dir, uint8_t ep, const unsigned char data[],
+                             size_t size, int64_t ts_ns);
+void ltr_int_usb_capture_close(void);
+
+//Reading side
+bool ltr_int_usb_capture_read_hdr(FILE *f, usb_capture_hdr_t *hdr);
+bool ltr_int_usb_capture_read_rec(FILE *f, usb_capture_rec_t *rec, unsigned char data[], size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -18,6 +18,15 @@ typedef bool (receive_data_fun)(int in_ep, unsigned char data[], size_t size, si
 typedef void (finish_usb_fun)(unsigned int interface);
 typedef bool (ctrl_data_fun)(uint8_t req_type, uint8_t req, uint16_t val, uint16_t index,
                             unsigned char data[], size_t size);
+//Optional streaming interface: keeps several bulk transfers in flight, so that
+//  the endpoint is never left without a request. Packets are handed out in order
+//  together with their completion time; a packet stays valid until it is released
+//  (or the next read does so). Read returns true and zero transferred on timeout.
+typedef bool (stream_start_fun)(int in_ep, size_t size, unsigned int transfers);
+typedef bool (stream_read_fun)(unsigned char **data, size_t *transferred, int64_t *ts_ns,
+                               long timeout);
+typedef void (stream_release_fun)(void);
+typedef void (stream_stop_fun)(void);
 
 
 #ifndef USB_IMPL_ONLY
@@ -29,6 +38,10 @@ extern send_data_fun *ltr_int_send_data;
 extern receive_data_fun *ltr_int_receive_data;
 extern ctrl_data_fun *ltr_int_ctrl_data;
 extern finish_usb_fun *ltr_int_finish_usb;
+extern stream_start_fun *ltr_int_stream_start;
+extern stream_read_fun *ltr_int_stream_read;
+extern stream_release_fun *ltr_int_stream_release;
+extern stream_stop_fun *ltr_int_stream_stop;
 #else
 /*
 bool ltr_int_init_usb();
@@ -47,6 +60,10 @@ extern send_data_fun ltr_int_send_data;
 extern receive_data_fun ltr_int_receive_data;
 extern ctrl_data_fun ltr_int_ctrl_data;
 extern finish_usb_fun ltr_int_finish_usb;
+extern stream_start_fun ltr_int_stream_start;
+extern stream_read_fun ltr_int_stream_read;
+extern stream_release_fun ltr_int_stream_release;
+extern stream_stop_fun ltr_int_stream_stop;
 
 
 #endif
@@ -437,17 +437,23 @@ void ltr_int_check_root()
 }
 
 
+// CLOCK_MONOTONIC in nanoseconds; all the timestamps passed around
+//  (frames, poses, client API) use this clock.
+int64_t ltr_int_get_ts_ns()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (int64_t)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
 // Used to get timestamp with ~us precision;
 //  Overflows every 1024 seconds!
+//  Kept for compatibility only, derived from ltr_int_get_ts_ns.
 static const int c_MAX_SEC = 1024;
 int ltr_int_get_ts()
 {
-  struct timespec t;
-  int usecs;
-  clock_gettime(CLOCK_MONOTONIC, &t);
-
-  usecs = (t.tv_sec & (c_MAX_SEC - 1)) * 1000000 + (t.tv_nsec / 1000);
-  return usecs;
+  int64_t usecs = ltr_int_get_ts_ns() / 1000;
+  return (int)(usecs % ((int64_t)c_MAX_SEC * 1000000));
 }
 
 // Returns difference between two timestamps in us.
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -38,6 +39,8 @@ typedef enum {DBG_CHECK, DBG_ON, DBG_OFF} dbg_flag_type;
 dbg_flag_type ltr_int_get_dbg_flag(const int flag);
 void ltr_int_usleep(unsigned int usec);
 void ltr_int_check_root();
+int64_t ltr_int_get_ts_ns();
+//Old 32bit us timestamps, wrapping every 1024s; use ltr_int_get_ts_ns instead
 int ltr_int_get_ts();
 int ltr_int_ts_diff(int ts1, int ts2);
 #ifdef __cplusplus
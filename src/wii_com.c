@@ -82,7 +82,7 @@ void ltr_int_closeWiiCom()
     free(fullPrefFile);
     fullPrefFile = NULL;
   }
-  ltr_int_log_message("Wii com Closed!\n");
+  ltr_int_log_message("Wii com Closed (%u reports missed)!\n", ltr_int_getMissedBlobs(&mmm));
 }
 
 void ltr_int_pauseWii()
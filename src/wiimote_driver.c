@@ -6,6 +6,9 @@
 #include <assert.h>
 #include <cwiid.h>
 #include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
 #include "wiimote_driver.h"
 #include "image_process.h"
 #include "runloop.h"
@@ -16,7 +19,12 @@
 /*********************/
 /* private Constants */
 /*********************/
-#define STATE_CHECK_INTERVAL 150
+//Status is requested this often to find out about a lost connection
+#define STATE_CHECK_INTERVAL_NS 1250000000LL
+//IR reports waiting for the runloop; the oldest is overwritten when full
+#define REPORT_RING_SIZE 8
+//Longest wait for a report, so that the runloop can handle requests
+#define REPORT_WAIT_NS 100000000LL
 
 /**********************/
 /* private data types */
@@ -24,7 +32,22 @@
 // Wiimote handler
 static cwiid_wiimote_t *gWiimote = NULL;
 
-static int gStateCheckIn = STATE_CHECK_INTERVAL;
+static int64_t gLastStateCheck = 0;
+
+typedef struct{
+  struct cwiid_ir_src src[CWIID_IR_SRC_COUNT];
+  int64_t ts_ns;
+} ir_report_t;
+
+//Filled by the cwiid thread through the message callback
+static pthread_mutex_t report_mx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t report_cv;
+static ir_report_t reports[REPORT_RING_SIZE];
+//head and tail grow monotonically, reports live at (pos % REPORT_RING_SIZE)
+static unsigned int report_head = 0;
+static unsigned int report_tail = 0;
+static uint64_t reports_overwritten = 0;
+static bool wii_error = false;
 
 /*******************************/
 /* private function prototypes */
@@ -59,6 +82,66 @@ static void set_leds_paused()
 }
 
 
+//cwiid stamps the messages with CLOCK_REALTIME, the frames need CLOCK_MONOTONIC
+static int64_t report_ts(const struct timespec *time)
+{
+  int64_t now = ltr_int_get_ts_ns();
+  if(time == NULL){
+    return now;
+  }
+  struct timespec real;
+  clock_gettime(CLOCK_REALTIME, &real);
+  int64_t age = (real.tv_sec - time->tv_sec) * 1000000000LL + (real.tv_nsec - time->tv_nsec);
+  return ((age >= 0) && (age < 1000000000LL)) ? now - age : now;
+}
+
+static void wii_callback(cwiid_wiimote_t *wii, int count, union cwiid_mesg mesg[],
+                         struct timespec *time)
+{
+  (void) wii;
+  int i;
+  for(i = 0; i < count; ++i){
+    switch(mesg[i].type){
+      case CWIID_MESG_IR:
+        pthread_mutex_lock(&report_mx);
+        if(report_tail - report_head >= REPORT_RING_SIZE){
+          ++report_head;
+          ++reports_overwritten;
+        }
+        ir_report_t *rep = &(reports[report_tail % REPORT_RING_SIZE]);
+        memcpy(rep->src, mesg[i].ir_mesg.src, sizeof(rep->src));
+        rep->ts_ns = report_ts(time);
+        ++report_tail;
+        pthread_cond_signal(&report_cv);
+        pthread_mutex_unlock(&report_mx);
+        break;
+      case CWIID_MESG_ERROR:
+        if(mesg[i].error_mesg.error != CWIID_ERROR_NONE){
+          pthread_mutex_lock(&report_mx);
+          wii_error = true;
+          pthread_cond_signal(&report_cv);
+          pthread_mutex_unlock(&report_mx);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+static void flush_reports()
+{
+  pthread_mutex_lock(&report_mx);
+  report_head = report_tail;
+  pthread_mutex_unlock(&report_mx);
+}
+
+static void disconnect()
+{
+  cwiid_set_mesg_callback(gWiimote, NULL);
+  cwiid_close(gWiimote);
+  gWiimote = NULL;
+}
 
 /* call to init an uninitialized wiimote device 
  * typically called once at setup
@@ -70,15 +153,25 @@ int ltr_int_tracker_init(struct camera_control_block *ccb) {
     bdaddr_t bdaddr;
     
     bdaddr = *BDADDR_ANY;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&report_cv, &attr);
+    pthread_condattr_destroy(&attr);
+    report_head = report_tail = 0;
+    reports_overwritten = 0;
+    wii_error = false;
     
     //fprintf(stderr, "Put Wiimote in discoverable mode now (press 1+2)...\n");
     
-    if (!(gWiimote = cwiid_open(&bdaddr, 0))) {
+    if (!(gWiimote = cwiid_open(&bdaddr, CWIID_FLAG_MESG_IFC))) {
         //fprintf(stderr, "Wiimote not found\n");
         return -1;
     } else {
         set_leds_running();
         cwiid_set_rpt_mode(gWiimote, CWIID_RPT_STATUS | CWIID_RPT_IR);
+        cwiid_set_mesg_callback(gWiimote, wii_callback);
+        gLastStateCheck = ltr_int_get_ts_ns();
         ltr_int_log_message("Wiimote connected\n");
     }
     return 0;
@@ -91,7 +184,12 @@ int ltr_int_tracker_init(struct camera_control_block *ccb) {
  * must call init to restart
  * a return value < 0 indicates error */
 int ltr_int_tracker_close() {
-    if (gWiimote) cwiid_close(gWiimote);
+    if (gWiimote) disconnect();
+    if(reports_overwritten > 0){
+      ltr_int_log_message("%llu IR reports overwritten before being processed\n",
+                          (unsigned long long)reports_overwritten);
+    }
+    pthread_cond_destroy(&report_cv);
     return 0;
 }
 
@@ -100,6 +198,7 @@ int ltr_int_tracker_close() {
 int ltr_int_tracker_pause() {
     set_leds_paused();
     cwiid_set_rpt_mode(gWiimote, CWIID_RPT_STATUS);
+    flush_reports();
     return 0;
 }
 
@@ -109,56 +208,68 @@ int ltr_int_tracker_pause() {
  * a return value < 0 indicates error */
 int ltr_int_tracker_resume() {
     set_leds_running();
+    flush_reports();
     cwiid_set_rpt_mode(gWiimote, CWIID_RPT_STATUS | CWIID_RPT_IR);
     return 0;
 }
 
-/* read the usb, and process it into frames
+/* wait for the next IR report and process it into a frame
  * a return value < 0 indicates error */
 int ltr_int_tracker_get_frame(struct camera_control_block *ccb,
                    struct frame_type *f, bool *frame_acquired)
 {
   (void) ccb;
-    struct cwiid_state state;
     unsigned int required_blobnum = 3;
     unsigned int valid;
     int i;
-    
-    //Otherwise the polling takes too much processor
-    ltr_int_usleep(8334);
+    ir_report_t rep;
 
-    if (!gStateCheckIn--) {
-        gStateCheckIn = STATE_CHECK_INTERVAL;
+    int64_t now = ltr_int_get_ts_ns();
+    if (now - gLastStateCheck > STATE_CHECK_INTERVAL_NS) {
+        gLastStateCheck = now;
 
         if (cwiid_request_status(gWiimote)) {
             ltr_int_log_message("Requesting status failed, disconnecting\n");
-            cwiid_close(gWiimote);
-            gWiimote = NULL;
+            disconnect();
             return -1;
         }
     }
 
-    if (cwiid_get_state(gWiimote, &state)) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += REPORT_WAIT_NS;
+    if(deadline.tv_nsec >= 1000000000L){
+      deadline.tv_nsec -= 1000000000L;
+      ++deadline.tv_sec;
+    }
+    pthread_mutex_lock(&report_mx);
+    while((report_head == report_tail) && !wii_error){
+      if(pthread_cond_timedwait(&report_cv, &report_mx, &deadline) == ETIMEDOUT){
+        break;
+      }
+    }
+    bool error = wii_error;
+    bool have_report = (report_head != report_tail);
+    if(have_report){
+      rep = reports[report_head % REPORT_RING_SIZE];
+      ++report_head;
+    }
+    pthread_mutex_unlock(&report_mx);
+
+    if (error) {
         // Treat connection as disconnected on error
-        ltr_int_log_message("Error reading wiimote state\n");
-        cwiid_close(gWiimote);
-        gWiimote = NULL;
+        ltr_int_log_message("Wiimote reported an error, disconnecting\n");
+        disconnect();
         return -1;
     }
-    
-    valid = 0;
-    for (i=0; i<CWIID_IR_SRC_COUNT; i++) {
-        if (state.ir_src[i].valid) {
-            valid++;
-        }
+    if (!have_report) {
+        *frame_acquired = false;
+        return 0;
     }
     
     f->width = WIIMOTE_HORIZONTAL_RESOLUTION / 2;
     f->height = WIIMOTE_VERTICAL_RESOLUTION / 2;
-    f->bloblist.num_blobs = valid < required_blobnum ? valid : required_blobnum;
-    f->bloblist.blobs = (struct blob_type *)
-        ltr_int_my_malloc(f->bloblist.num_blobs*sizeof(struct blob_type));
-    assert(f->bloblist.blobs);
+    f->ts_ns = rep.ts_ns;
     bool draw;
     if(f->bitmap != NULL){
       draw = true;
@@ -171,21 +282,23 @@ int ltr_int_tracker_get_frame(struct camera_control_block *ccb,
       .bitmap = f->bitmap,
       .ratio = 1.0
     };
+    //The runloop provides room for MAX_BLOBS blobs
     valid = 0;
     for (i=0; i<CWIID_IR_SRC_COUNT; i++) {
-        if (state.ir_src[i].valid) {
+        if (rep.src[i].valid) {
             if (valid<required_blobnum) {
-                f->bloblist.blobs[valid].x = -1 * state.ir_src[i].pos[CWIID_X] + WIIMOTE_HORIZONTAL_RESOLUTION/2;
-                f->bloblist.blobs[valid].y = state.ir_src[i].pos[CWIID_Y] - WIIMOTE_VERTICAL_RESOLUTION/2;
-                f->bloblist.blobs[valid].score = state.ir_src[i].size;
+                f->bloblist.blobs[valid].x = -1 * rep.src[i].pos[CWIID_X] + WIIMOTE_HORIZONTAL_RESOLUTION/2;
+                f->bloblist.blobs[valid].y = rep.src[i].pos[CWIID_Y] - WIIMOTE_VERTICAL_RESOLUTION/2;
+                f->bloblist.blobs[valid].score = rep.src[i].size;
                 if(draw){
-                  ltr_int_draw_square(&img, state.ir_src[i].pos[CWIID_X] / 2, (WIIMOTE_VERTICAL_RESOLUTION - state.ir_src[i].pos[CWIID_Y]) / 2, 2*state.ir_src[i].size);
-                  ltr_int_draw_cross(&img, state.ir_src[i].pos[CWIID_X] / 2, (WIIMOTE_VERTICAL_RESOLUTION - state.ir_src[i].pos[CWIID_Y]) / 2, (int)WIIMOTE_HORIZONTAL_RESOLUTION/100.0);
+                  ltr_int_draw_square(&img, rep.src[i].pos[CWIID_X] / 2, (WIIMOTE_VERTICAL_RESOLUTION - rep.src[i].pos[CWIID_Y]) / 2, 2*rep.src[i].size);
+                  ltr_int_draw_cross(&img, rep.src[i].pos[CWIID_X] / 2, (WIIMOTE_VERTICAL_RESOLUTION - rep.src[i].pos[CWIID_Y]) / 2, (int)WIIMOTE_HORIZONTAL_RESOLUTION/100.0);
                 }
             }
             valid++;
         }
     }
+    f->bloblist.num_blobs = valid < required_blobnum ? valid : required_blobnum;
     *frame_acquired = true;
     return 0;
 }